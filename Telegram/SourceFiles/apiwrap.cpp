@@ -104,6 +104,7 @@ constexpr auto kUnreadMentionsNextRequestLimit = 100;
 constexpr auto kSharedMediaLimit = 100;
 constexpr auto kReadFeaturedSetsTimeout = crl::time(1000);
 constexpr auto kFileLoaderQueueStopTimeout = crl::time(5000);
+constexpr auto kFileLoaderMaxWorkers = 4;
 constexpr auto kStickersByEmojiInvalidateTimeout = crl::time(60 * 60 * 1000);
 constexpr auto kNotifySettingSaveTimeout = crl::time(1000);
 constexpr auto kDialogsFirstLoad = 20;
@@ -178,12 +179,15 @@ bool ApiWrap::BlockedPeersSlice::operator!=(const BlockedPeersSlice &other) cons
 ApiWrap::ApiWrap(not_null<Main::Session*> session)
 : MTP::Sender(&session->account().mtp())
 , _session(session)
+, _singleFlight(&session->account().mtp())
 , _messageDataResolveDelayed([=] { resolveMessageDatas(); })
 , _webPagesTimer([=] { resolveWebPages(); })
 , _draftsSaveTimer([=] { saveDraftsToCloud(); })
 , _featuredSetsReadTimer([=] { readFeaturedSets(); })
 , _dialogsLoadState(std::make_unique<DialogsLoadState>())
-, _fileLoader(std::make_unique<TaskQueue>(kFileLoaderQueueStopTimeout))
+, _fileLoader(std::make_unique<TaskQueue>(
+	kFileLoaderQueueStopTimeout,
+	std::clamp(QThread::idealThreadCount() - 1, 1, kFileLoaderMaxWorkers)))
 , _topPromotionTimer([=] { refreshTopPromotion(); })
 , _updateNotifySettingsTimer([=] { sendNotifySettingsUpdates(); })
 , _authorizations(std::make_unique<Api::Authorizations>(this))
@@ -1063,59 +1067,56 @@ void ApiWrap::requestFullPeer(not_null<PeerData*> peer) {
 		return;
 	}
 
-	const auto requestId = [&] {
-		const auto failHandler = [=](const RPCError &error) {
+	const auto failHandler = [=](const RPCError &error) {
+		_fullPeerRequests.remove(peer);
+		migrateFail(peer, error);
+	};
+	_fullPeerRequests.emplace(peer);
+	if (const auto user = peer->asUser()) {
+		if (_session->supportMode()) {
+			_session->supportHelper().refreshInfo(user);
+		}
+		_singleFlight.request(MTPusers_GetFullUser(
+			user->inputUser
+		)).done([=](const MTPUserFull &result) {
+			_fullPeerRequests.remove(user);
+			gotUserFull(user, result);
+		}).fail(failHandler).send();
+	} else if (const auto chat = peer->asChat()) {
+		_singleFlight.request(MTPmessages_GetFullChat(
+			chat->inputChat
+		)).done([=](const MTPmessages_ChatFull &result) {
 			_fullPeerRequests.remove(peer);
-			migrateFail(peer, error);
-		};
-		if (const auto user = peer->asUser()) {
-			if (_session->supportMode()) {
-				_session->supportHelper().refreshInfo(user);
-			}
-			return request(MTPusers_GetFullUser(
-				user->inputUser
-			)).done([=](const MTPUserFull &result, mtpRequestId requestId) {
-				gotUserFull(user, result, requestId);
-			}).fail(failHandler).send();
-		} else if (const auto chat = peer->asChat()) {
-			return request(MTPmessages_GetFullChat(
-				chat->inputChat
-			)).done([=](
-					const MTPmessages_ChatFull &result,
-					mtpRequestId requestId) {
-				gotChatFull(peer, result, requestId);
-			}).fail(failHandler).send();
-		} else if (const auto channel = peer->asChannel()) {
-			return request(MTPchannels_GetFullChannel(
-				channel->inputChannel
-			)).done([=](
-					const MTPmessages_ChatFull &result,
-					mtpRequestId requestId) {
-				gotChatFull(peer, result, requestId);
-				migrateDone(channel, channel);
-			}).fail(failHandler).send();
-		}
+			gotChatFull(peer, result);
+		}).fail(failHandler).send();
+	} else if (const auto channel = peer->asChannel()) {
+		_singleFlight.request(MTPchannels_GetFullChannel(
+			channel->inputChannel
+		)).done([=](const MTPmessages_ChatFull &result) {
+			_fullPeerRequests.remove(peer);
+			gotChatFull(peer, result);
+			migrateDone(channel, channel);
+		}).fail(failHandler).send();
+	} else {
 		Unexpected("Peer type in requestFullPeer.");
-	}();
-	_fullPeerRequests.insert(peer, requestId);
+	}
 }
 
 void ApiWrap::processFullPeer(
 		not_null<PeerData*> peer,
 		const MTPmessages_ChatFull &result) {
-	gotChatFull(peer, result, mtpRequestId(0));
+	gotChatFull(peer, result);
 }
 
 void ApiWrap::processFullPeer(
 		not_null<UserData*> user,
 		const MTPUserFull &result) {
-	gotUserFull(user, result, mtpRequestId(0));
+	gotUserFull(user, result);
 }
 
 void ApiWrap::gotChatFull(
 		not_null<PeerData*> peer,
-		const MTPmessages_ChatFull &result,
-		mtpRequestId req) {
+		const MTPmessages_ChatFull &result) {
 	const auto &d = result.c_messages_chatFull();
 	_session->data().applyMaximumChatVersions(d.vchats());
 
@@ -1138,19 +1139,12 @@ void ApiWrap::gotChatFull(
 		}
 	});
 
-	if (req) {
-		const auto i = _fullPeerRequests.find(peer);
-		if (i != _fullPeerRequests.cend() && i.value() == req) {
-			_fullPeerRequests.erase(i);
-		}
-	}
 	fullPeerUpdated().notify(peer);
 }
 
 void ApiWrap::gotUserFull(
 		not_null<UserData*> user,
-		const MTPUserFull &result,
-		mtpRequestId req) {
+		const MTPUserFull &result) {
 	const auto &d = result.c_userFull();
 	if (user == _session->user() && !_session->validateSelf(d.vuser())) {
 		constexpr auto kRequestUserAgainTimeout = crl::time(10000);
@@ -1161,12 +1155,6 @@ void ApiWrap::gotUserFull(
 	}
 	Data::ApplyUserUpdate(user, d);
 
-	if (req) {
-		const auto i = _fullPeerRequests.find(user);
-		if (i != _fullPeerRequests.cend() && i.value() == req) {
-			_fullPeerRequests.erase(i);
-		}
-	}
 	fullPeerUpdated().notify(user);
 }
 
@@ -1175,52 +1163,45 @@ void ApiWrap::requestPeer(not_null<PeerData*> peer) {
 		return;
 	}
 
-	const auto requestId = [&] {
-		const auto failHandler = [=](const RPCError &error) {
-			_peerRequests.remove(peer);
-		};
-		const auto chatHandler = [=](const MTPmessages_Chats &result) {
-			_peerRequests.remove(peer);
-			const auto &chats = result.match([](const auto &data) {
-				return data.vchats();
-			});
-			_session->data().applyMaximumChatVersions(chats);
-			_session->data().processChats(chats);
-		};
-		if (const auto user = peer->asUser()) {
-			return request(MTPusers_GetUsers(
-				MTP_vector<MTPInputUser>(1, user->inputUser)
-			)).done([=](const MTPVector<MTPUser> &result) {
-				_peerRequests.remove(user);
-				_session->data().processUsers(result);
-			}).fail(failHandler).send();
-		} else if (const auto chat = peer->asChat()) {
-			return request(MTPmessages_GetChats(
-				MTP_vector<MTPint>(1, chat->inputChat)
-			)).done(chatHandler).fail(failHandler).send();
-		} else if (const auto channel = peer->asChannel()) {
-			return request(MTPchannels_GetChannels(
-				MTP_vector<MTPInputChannel>(1, channel->inputChannel)
-			)).done(chatHandler).fail(failHandler).send();
-		}
+	const auto failHandler = [=](const RPCError &error) {
+		_peerRequests.remove(peer);
+	};
+	const auto chatHandler = [=](const MTPmessages_Chats &result) {
+		_peerRequests.remove(peer);
+		const auto &chats = result.match([](const auto &data) {
+			return data.vchats();
+		});
+		_session->data().applyMaximumChatVersions(chats);
+		_session->data().processChats(chats);
+	};
+	_peerRequests.emplace(peer);
+	if (const auto user = peer->asUser()) {
+		_singleFlight.request(MTPusers_GetUsers(
+			MTP_vector<MTPInputUser>(1, user->inputUser)
+		)).done([=](const MTPVector<MTPUser> &result) {
+			_peerRequests.remove(user);
+			_session->data().processUsers(result);
+		}).fail(failHandler).send();
+	} else if (const auto chat = peer->asChat()) {
+		_singleFlight.request(MTPmessages_GetChats(
+			MTP_vector<MTPint>(1, chat->inputChat)
+		)).done(chatHandler).fail(failHandler).send();
+	} else if (const auto channel = peer->asChannel()) {
+		_singleFlight.request(MTPchannels_GetChannels(
+			MTP_vector<MTPInputChannel>(1, channel->inputChannel)
+		)).done(chatHandler).fail(failHandler).send();
+	} else {
 		Unexpected("Peer type in requestPeer.");
-	}();
-	_peerRequests.insert(peer, requestId);
+	}
 }
 
 void ApiWrap::requestPeerSettings(not_null<PeerData*> peer) {
-	if (!_requestedPeerSettings.emplace(peer).second) {
-		return;
-	}
-	request(MTPmessages_GetPeerSettings(
+	_singleFlight.request(MTPmessages_GetPeerSettings(
 		peer->input
 	)).done([=](const MTPPeerSettings &result) {
 		peer->setSettings(result.match([&](const MTPDpeerSettings &data) {
 			return data.vflags().v;
 		}));
-		_requestedPeerSettings.erase(peer);
-	}).fail([=](const RPCError &error) {
-		_requestedPeerSettings.erase(peer);
 	}).send();
 }
 
@@ -1822,20 +1803,22 @@ void ApiWrap::requestChannelMembersForAdd(
 }
 
 void ApiWrap::scheduleStickerSetRequest(uint64 setId, uint64 access) {
-	if (!_stickerSetRequests.contains(setId)) {
-		_stickerSetRequests.insert(setId, qMakePair(access, 0));
-	}
+	_stickerSetRequests.emplace(setId, access);
 }
 
 void ApiWrap::requestStickerSets() {
-	for (auto i = _stickerSetRequests.begin(), j = i, e = _stickerSetRequests.end(); i != e; i = j) {
-		++j;
-		if (i.value().second) continue;
-
-		auto waitMs = (j == e) ? 0 : kSmallDelayMs;
-		i.value().second = request(MTPmessages_GetStickerSet(MTP_inputStickerSetID(MTP_long(i.key()), MTP_long(i.value().first)))).done([this, setId = i.key()](const MTPmessages_StickerSet &result) {
+	// Sets still in flight are requested again, _singleFlight sends them once.
+	// A request may fail right away, so iterate over a copy.
+	const auto requests = _stickerSetRequests;
+	for (auto i = begin(requests), e = end(requests); i != e; ++i) {
+		const auto setId = i->first;
+		const auto access = i->second;
+		const auto waitMs = (i + 1 == e) ? 0 : kSmallDelayMs;
+		_singleFlight.request(MTPmessages_GetStickerSet(
+			MTP_inputStickerSetID(MTP_long(setId), MTP_long(access))
+		)).done([=](const MTPmessages_StickerSet &result) {
 			gotStickerSet(setId, result);
-		}).fail([this, setId = i.key()](const RPCError &error) {
+		}).fail([=](const RPCError &error) {
 			_stickerSetRequests.remove(setId);
 		}).afterDelay(waitMs).send();
 	}
@@ -2565,7 +2548,10 @@ void ApiWrap::applyNotifySettings(
 }
 
 void ApiWrap::gotStickerSet(uint64 setId, const MTPmessages_StickerSet &result) {
-	_stickerSetRequests.remove(setId);
+	if (!_stickerSetRequests.remove(setId)) {
+		// Delivered already to the request merged with this one.
+		return;
+	}
 	_session->data().stickers().feedSetFull(result);
 }
 
@@ -2629,35 +2615,34 @@ void ApiWrap::resolveWebPages() {
 		}
 	}
 
-	auto requestId = mtpRequestId(0);
+	auto batchId = 0;
 	if (!ids.isEmpty()) {
-		requestId = request(MTPmessages_GetMessages(
+		batchId = ++_webPagesBatchIdAutoIncrement;
+		_singleFlight.request(MTPmessages_GetMessages(
 			MTP_vector<MTPInputMessage>(ids)
-		)).done([=](
-				const MTPmessages_Messages &result,
-				mtpRequestId requestId) {
-			gotWebPages(nullptr, result, requestId);
+		)).done([=](const MTPmessages_Messages &result) {
+			gotWebPages(nullptr, result, batchId);
 		}).afterDelay(kSmallDelayMs).send();
 	}
-	QVector<mtpRequestId> reqsByIndex(idsByChannel.size(), 0);
+	QVector<int> batchesByIndex(idsByChannel.size(), 0);
 	for (auto i = idsByChannel.cbegin(), e = idsByChannel.cend(); i != e; ++i) {
-		reqsByIndex[i.value().first] = request(MTPchannels_GetMessages(
+		const auto channelBatchId = ++_webPagesBatchIdAutoIncrement;
+		batchesByIndex[i.value().first] = channelBatchId;
+		_singleFlight.request(MTPchannels_GetMessages(
 			i.key()->inputChannel,
 			MTP_vector<MTPInputMessage>(i.value().second)
-		)).done([=, channel = i.key()](
-				const MTPmessages_Messages &result,
-				mtpRequestId requestId) {
-			gotWebPages(channel, result, requestId);
+		)).done([=, channel = i.key()](const MTPmessages_Messages &result) {
+			gotWebPages(channel, result, channelBatchId);
 		}).afterDelay(kSmallDelayMs).send();
 	}
-	if (requestId || !reqsByIndex.isEmpty()) {
-		for (auto &pendingRequestId : _webPagesPending) {
-			if (pendingRequestId > 0) continue;
-			if (pendingRequestId < 0) {
-				if (pendingRequestId == -1) {
-					pendingRequestId = requestId;
+	if (batchId || !batchesByIndex.isEmpty()) {
+		for (auto &pendingBatchId : _webPagesPending) {
+			if (pendingBatchId > 0) continue;
+			if (pendingBatchId < 0) {
+				if (pendingBatchId == -1) {
+					pendingBatchId = batchId;
 				} else {
-					pendingRequestId = reqsByIndex[-pendingRequestId - 2];
+					pendingBatchId = batchesByIndex[-pendingBatchId - 2];
 				}
 			}
 		}
@@ -2843,10 +2828,10 @@ void ApiWrap::refreshFileReference(
 	});
 }
 
-void ApiWrap::gotWebPages(ChannelData *channel, const MTPmessages_Messages &result, mtpRequestId req) {
+void ApiWrap::gotWebPages(ChannelData *channel, const MTPmessages_Messages &result, int batchId) {
 	WebPageData::ApplyChanges(_session, channel, result);
 	for (auto i = _webPagesPending.begin(); i != _webPagesPending.cend();) {
-		if (i.value() == req) {
+		if (i.value() == batchId) {
 			if (i.key()->pendingTill > 0) {
 				i.key()->pendingTill = -1;
 				_session->data().notifyWebPageUpdateDelayed(i.key());
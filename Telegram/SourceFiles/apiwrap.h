@@ -12,6 +12,7 @@ https://github.com/telegramdesktop/tdesktop/blob/master/LEGAL
 #include "base/flat_map.h"
 #include "base/flat_set.h"
 #include "mtproto/sender.h"
+#include "mtproto/single_flight_sender.h"
 #include "data/stickers/data_stickers_set.h"
 #include "data/data_messages.h"
 
@@ -511,12 +512,10 @@ private:
 
 	void gotChatFull(
 		not_null<PeerData*> peer,
-		const MTPmessages_ChatFull &result,
-		mtpRequestId req);
+		const MTPmessages_ChatFull &result);
 	void gotUserFull(
 		not_null<UserData*> user,
-		const MTPUserFull &result,
-		mtpRequestId req);
+		const MTPUserFull &result);
 	void applyLastParticipantsList(
 		not_null<ChannelData*> channel,
 		int availableCount,
@@ -529,7 +528,7 @@ private:
 	void gotWebPages(
 		ChannelData *channel,
 		const MTPmessages_Messages &result,
-		mtpRequestId req);
+		int batchId);
 	void gotStickerSet(uint64 setId, const MTPmessages_StickerSet &result);
 
 	void stickerSetDisenabled(mtpRequestId requestId);
@@ -631,6 +630,7 @@ private:
 	void migrateFail(not_null<PeerData*> peer, const RPCError &error);
 
 	not_null<Main::Session*> _session;
+	MTP::SingleFlightSender _singleFlight;
 
 	base::flat_map<QString, int> _modifyRequests;
 
@@ -638,10 +638,10 @@ private:
 	QMap<ChannelData*, MessageDataRequests> _channelMessageDataRequests;
 	SingleQueuedInvokation _messageDataResolveDelayed;
 
+	base::flat_set<not_null<PeerData*>> _fullPeerRequests;
+	base::flat_set<not_null<PeerData*>> _peerRequests;
+
 	using PeerRequests = QMap<PeerData*, mtpRequestId>;
-	PeerRequests _fullPeerRequests;
-	PeerRequests _peerRequests;
-	base::flat_set<not_null<PeerData*>> _requestedPeerSettings;
 
 	PeerRequests _participantsRequests;
 	PeerRequests _botsRequests;
@@ -663,10 +663,11 @@ private:
 
 	base::flat_set<not_null<ChannelData*>> _selfParticipantRequests;
 
-	QMap<WebPageData*, mtpRequestId> _webPagesPending;
+	QMap<WebPageData*, int> _webPagesPending; // page -> batch id
+	int _webPagesBatchIdAutoIncrement = 0;
 	base::Timer _webPagesTimer;
 
-	QMap<uint64, QPair<uint64, mtpRequestId> > _stickerSetRequests;
+	base::flat_map<uint64, uint64> _stickerSetRequests; // setId -> access
 
 	QMap<ChannelData*, mtpRequestId> _channelAmInRequests;
 	base::flat_map<not_null<PeerData*>, mtpRequestId> _blockRequests;
@@ -67,6 +67,61 @@ HistoryView::Element *hoveredItem = nullptr,
 	*pressedLinkItem = nullptr,
 	*mousedItem = nullptr;
 
+[[nodiscard]] QImage ReadImageFrom(
+		not_null<QIODevice*> device,
+		not_null<QByteArray*> format,
+		bool *animated,
+		int sideLimit = 0,
+		QSize *original = nullptr) {
+	QImageReader reader(device, *format);
+#ifndef OS_MAC_OLD
+	reader.setAutoTransform(true);
+#endif // OS_MAC_OLD
+	if (animated) *animated = reader.supportsAnimation() && reader.imageCount() > 1;
+	if (!reader.canRead()) {
+		return QImage();
+	}
+	const auto imageSize = reader.size();
+	if (imageSize.width() * imageSize.height() > kImageAreaLimit) {
+		return QImage();
+	}
+	auto fmt = reader.format();
+	if (!fmt.isEmpty()) *format = fmt;
+
+	// Handlers with the ScaledSize option (JPEG) scale while decoding, so
+	// the full resolution frame of a large photo is never allocated.
+	// Other formats (PNG, WebP, GIF) are decoded in full, limited only by
+	// kImageAreaLimit, and the reader scales them down right after that.
+	const auto scale = (sideLimit > 0)
+		&& (imageSize.width() > sideLimit || imageSize.height() > sideLimit);
+	if (scale) {
+		reader.setScaledSize(
+			imageSize.scaled(sideLimit, sideLimit, Qt::KeepAspectRatio));
+	}
+	auto result = QImage();
+	if (!reader.read(&result)) {
+		return QImage();
+	}
+	fmt = reader.format();
+	if (!fmt.isEmpty()) *format = fmt;
+	if (original) {
+		*original = scale ? imageSize : result.size();
+#ifndef OS_MAC_OLD
+		if (scale
+			&& (reader.transformation()
+				& QImageIOHandler::TransformationRotate90)) {
+			original->transpose();
+		}
+#endif // OS_MAC_OLD
+	}
+	return result;
+}
+
+[[nodiscard]] bool IsJpegFormat(const QByteArray &format) {
+	const auto fmt = QString::fromUtf8(format).toLower();
+	return (fmt == "jpg" || fmt == "jpeg");
+}
+
 } // namespace
 
 namespace App {
@@ -216,30 +271,12 @@ namespace App {
 		if (!format) {
 			format = &tmpFormat;
 		}
-		{
-			QImageReader reader(&buffer, *format);
-#ifndef OS_MAC_OLD
-			reader.setAutoTransform(true);
-#endif // OS_MAC_OLD
-			if (animated) *animated = reader.supportsAnimation() && reader.imageCount() > 1;
-			if (!reader.canRead()) {
-				return QImage();
-			}
-			const auto imageSize = reader.size();
-			if (imageSize.width() * imageSize.height() > kImageAreaLimit) {
-				return QImage();
-			}
-			QByteArray fmt = reader.format();
-			if (!fmt.isEmpty()) *format = fmt;
-			if (!reader.read(&result)) {
-				return QImage();
-			}
-			fmt = reader.format();
-			if (!fmt.isEmpty()) *format = fmt;
+		result = ReadImageFrom(&buffer, format, animated);
+		if (result.isNull()) {
+			return QImage();
 		}
 		buffer.seek(0);
-		auto fmt = QString::fromUtf8(*format).toLower();
-		if (fmt == "jpg" || fmt == "jpeg") {
+		if (IsJpegFormat(*format)) {
 #ifdef OS_MAC_OLD
 			if (auto exifData = exif_data_new_from_data((const uchar*)(data.constData()), data.size())) {
 				auto byteOrder = exif_data_get_byte_order(exifData);
@@ -269,6 +306,21 @@ namespace App {
 	}
 
 	QImage readImage(const QString &file, QByteArray *format, bool opaque, bool *animated, QByteArray *content) {
+#ifndef OS_MAC_OLD
+		if (!content) {
+			// Nothing needs the file bytes, decode right from the file.
+			auto tmpFormat = QByteArray();
+			auto result = readImageBounded(
+				file,
+				0,
+				nullptr,
+				format ? format : &tmpFormat,
+				animated);
+			return (opaque && !IsJpegFormat(format ? *format : tmpFormat))
+				? Images::prepareOpaque(std::move(result))
+				: result;
+		}
+#endif // OS_MAC_OLD
 		QFile f(file);
 		if (f.size() > kImageSizeLimit || !f.open(QIODevice::ReadOnly)) {
 			if (animated) *animated = false;
@@ -282,6 +334,33 @@ namespace App {
 		return result;
 	}
 
+	QImage readImageBounded(
+			const QString &file,
+			int sideLimit,
+			QSize *original,
+			QByteArray *format,
+			bool *animated) {
+#ifdef OS_MAC_OLD
+		// The orientation is applied from the EXIF data of the file bytes.
+		auto result = readImage(file, format, false, animated);
+		if (original) *original = result.size();
+		return result;
+#else // OS_MAC_OLD
+		QFile f(file);
+		if (f.size() > kImageSizeLimit || !f.open(QIODevice::ReadOnly)) {
+			if (animated) *animated = false;
+			return QImage();
+		}
+		auto tmpFormat = QByteArray();
+		return ReadImageFrom(
+			&f,
+			format ? format : &tmpFormat,
+			animated,
+			sideLimit,
+			original);
+#endif // OS_MAC_OLD
+	}
+
 	QPixmap pixmapFromImageInPlace(QImage &&image) {
 		return QPixmap::fromImage(std::move(image), Qt::ColorOnly);
 	}
@@ -45,6 +45,17 @@ namespace App {
 	constexpr auto kImageSizeLimit = 64 * 1024 * 1024; // Open images up to 64mb jpg/png/gif
 	QImage readImage(QByteArray data, QByteArray *format = nullptr, bool opaque = true, bool *animated = nullptr);
 	QImage readImage(const QString &file, QByteArray *format = nullptr, bool opaque = true, bool *animated = nullptr, QByteArray *content = 0);
+
+	// Reads the image right from the file, never keeping its bytes.
+	// Images larger than sideLimit are returned downscaled, the dimensions
+	// of the file are returned in original then. Only JPEG is decoded
+	// downscaled, other formats are decoded in full and scaled after.
+	QImage readImageBounded(
+		const QString &file,
+		int sideLimit,
+		QSize *original = nullptr,
+		QByteArray *format = nullptr,
+		bool *animated = nullptr);
 	QPixmap pixmapFromImageInPlace(QImage &&image);
 
 };
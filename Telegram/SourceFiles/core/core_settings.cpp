@@ -89,6 +89,7 @@ QByteArray Settings::serialize() const {
 	}
 	size += Serialize::bytearraySize(_videoPipGeometry);
 	size += Serialize::bytearraySize(windowPosition);
+	size += sizeof(qint64);
 
 	auto result = QByteArray();
 	result.reserve(size);
@@ -165,7 +166,8 @@ QByteArray Settings::serialize() const {
 			<< qint64(_groupCallPushToTalkDelay)
 			<< qint32(0) // Call audio backend
 			<< qint32(_disableCalls ? 1 : 0)
-			<< windowPosition;
+			<< windowPosition
+			<< qint64(_downloadSpeedLimit.current());
 	}
 	return result;
 }
@@ -239,6 +241,7 @@ void Settings::addFromSerialized(const QByteArray &serialized) {
 	qint32 callAudioBackend = 0;
 	qint32 disableCalls = _disableCalls ? 1 : 0;
 	QByteArray windowPosition;
+	qint64 downloadSpeedLimit = _downloadSpeedLimit.current();
 
 	stream >> themesAccentColors;
 	if (!stream.atEnd()) {
@@ -343,6 +346,9 @@ void Settings::addFromSerialized(const QByteArray &serialized) {
 	if (!stream.atEnd()) {
 		stream >> windowPosition;
 	}
+	if (!stream.atEnd()) {
+		stream >> downloadSpeedLimit;
+	}
 	if (stream.status() != QDataStream::Ok) {
 		LOG(("App Error: "
 			"Bad data for Core::Settings::constructFromSerialized()"));
@@ -446,6 +452,7 @@ void Settings::addFromSerialized(const QByteArray &serialized) {
 	if (!windowPosition.isEmpty()) {
 		_windowPosition = Deserialize(windowPosition);
 	}
+	_downloadSpeedLimit = std::max(downloadSpeedLimit, qint64(0));
 }
 
 bool Settings::chatWide() const {
@@ -502,6 +502,15 @@ public:
 	[[nodiscard]] rpl::producer<bool> systemDarkModeEnabledChanges() const {
 		return _systemDarkModeEnabled.changes();
 	}
+	void setDownloadSpeedLimit(int64 value) {
+		_downloadSpeedLimit = value;
+	}
+	[[nodiscard]] int64 downloadSpeedLimit() const {
+		return _downloadSpeedLimit.current();
+	}
+	[[nodiscard]] rpl::producer<int64> downloadSpeedLimitValue() const {
+		return _downloadSpeedLimit.value();
+	}
 	[[nodiscard]] const WindowPosition &windowPosition() const {
 		return _windowPosition;
 	}
@@ -590,6 +599,8 @@ private:
 	rpl::variable<std::optional<bool>> _systemDarkMode = std::nullopt;
 	rpl::variable<bool> _systemDarkModeEnabled = false;
 	WindowPosition _windowPosition; // per-window
+	// Bytes per second, only for the downloads from the MTProto servers.
+	rpl::variable<int64> _downloadSpeedLimit = 0;
 
 	bool _tabbedReplacedWithInfo = false; // per-window
 	rpl::event_stream<bool> _tabbedReplacedWithInfoValue; // per-window
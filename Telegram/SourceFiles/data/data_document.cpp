@@ -25,6 +25,7 @@ https://github.com/telegramdesktop/tdesktop/blob/master/LEGAL
 #include "media/streaming/media_streaming_loader_local.h"
 #include "storage/localstorage.h"
 #include "storage/storage_account.h"
+#include "storage/storage_file_writer.h"
 #include "storage/streamed_file_downloader.h"
 #include "storage/file_download_mtproto.h"
 #include "storage/file_download_web.h"
@@ -137,7 +138,8 @@ QString FileNameUnsafe(
 		const QString &prefix,
 		QString name,
 		bool savingAs,
-		const QDir &dir) {
+		const QDir &dir,
+		Fn<bool(const QString &path)> reuse) {
 	name = base::FileNameFromUserString(name);
 	if (Core::App().settings().askDownloadPath() || savingAs) {
 		if (!name.isEmpty() && name.at(0) == QChar::fromLatin1('.')) {
@@ -183,16 +185,7 @@ QString FileNameUnsafe(
 		return filedialogGetSaveFile(name, title, fil, name) ? name : QString();
 	}
 
-	auto path = [&] {
-		const auto path = Core::App().settings().downloadPath();
-		if (path.isEmpty()) {
-			return File::DefaultDownloadPath(session);
-		} else if (path == qsl("tmp")) {
-			return session->local().tempDirectory();
-		} else {
-			return path;
-		}
-	}();
+	auto path = DownloadFolderPath(session);
 	if (name.isEmpty()) name = qsl(".unknown");
 	if (name.at(0) == QChar::fromLatin1('.')) {
 		if (!QDir().exists(path)) QDir().mkpath(path);
@@ -210,9 +203,14 @@ QString FileNameUnsafe(
 	} else {
 		nameStart = name;
 	}
+	const auto taken = [&](const QString &name) {
+		const auto exists = QFileInfo(name).exists()
+			|| Storage::FileWriter::HasPartial(name);
+		return exists && !(reuse && reuse(name));
+	};
 	QString nameBase = path + nameStart;
 	name = nameBase + extension;
-	for (int i = 0; QFileInfo(name).exists(); ++i) {
+	for (int i = 0; taken(name); ++i) {
 		name = nameBase + QString(" (%1)").arg(i + 2) + extension;
 	}
 
@@ -220,6 +218,16 @@ QString FileNameUnsafe(
 	return name;
 }
 
+QString DownloadFolderPath(not_null<Main::Session*> session) {
+	const auto path = Core::App().settings().downloadPath();
+	if (path.isEmpty()) {
+		return File::DefaultDownloadPath(session);
+	} else if (path == qsl("tmp")) {
+		return session->local().tempDirectory();
+	}
+	return path;
+}
+
 QString FileNameForSave(
 		not_null<Main::Session*> session,
 		const QString &title,
@@ -227,7 +235,8 @@ QString FileNameForSave(
 		const QString &prefix,
 		QString name,
 		bool savingAs,
-		const QDir &dir) {
+		const QDir &dir,
+		Fn<bool(const QString &path)> reuse) {
 	const auto result = FileNameUnsafe(
 		session,
 		title,
@@ -235,7 +244,8 @@ QString FileNameForSave(
 		prefix,
 		name,
 		savingAs,
-		dir);
+		dir,
+		std::move(reuse));
 #ifdef Q_OS_WIN
 	const auto lower = result.trimmed().toLower();
 	const auto kBadExtensions = { qstr(".lnk"), qstr(".scf") };
@@ -298,6 +308,12 @@ QString DocumentFileNameForSave(
 		prefix = qsl("doc");
 	}
 
+	// Continue an interrupted download of this file, if there is one.
+	const auto key = data->cacheKey();
+	const auto size = data->size;
+	const auto reuse = [=](const QString &path) {
+		return Storage::FileWriter::CanResume(path, key, size);
+	};
 	return FileNameForSave(
 		&data->session(),
 		caption,
@@ -305,7 +321,8 @@ QString DocumentFileNameForSave(
 		prefix,
 		name,
 		forceSavingAs,
-		dir);
+		dir,
+		reuse);
 }
 
 DocumentClickHandler::DocumentClickHandler(
@@ -1122,6 +1139,12 @@ void DocumentData::cancel() {
 	_owner->documentLoadDone(this);
 }
 
+void DocumentData::markLoadShown() {
+	if (loading()) {
+		_loader->markShown();
+	}
+}
+
 bool DocumentData::cancelled() const {
 	return (_flags & Flag::DownloadCancelled);
 }
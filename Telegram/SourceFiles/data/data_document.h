@@ -105,6 +105,7 @@ public:
 		LoadFromCloudSetting fromCloud = LoadFromCloudOrLocal,
 		bool autoLoading = false);
 	void cancel();
+	void markLoadShown();
 	[[nodiscard]] bool cancelled() const;
 	[[nodiscard]] float64 progress() const;
 	[[nodiscard]] int loadOffset() const;
@@ -426,6 +427,8 @@ private:
 
 };
 
+[[nodiscard]] QString DownloadFolderPath(not_null<Main::Session*> session);
+
 QString FileNameForSave(
 	not_null<Main::Session*> session,
 	const QString &title,
@@ -433,7 +436,8 @@ QString FileNameForSave(
 	const QString &prefix,
 	QString name,
 	bool savingAs,
-	const QDir &dir = QDir());
+	const QDir &dir = QDir(),
+	Fn<bool(const QString &path)> reuse = nullptr);
 
 QString DocumentFileNameForSave(
 	not_null<const DocumentData*> data,
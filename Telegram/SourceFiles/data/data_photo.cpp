@@ -161,6 +161,12 @@ void PhotoData::cancel() {
 	}
 }
 
+void PhotoData::markLoadShown() {
+	if (loading()) {
+		_images[PhotoSizeIndex(PhotoSize::Large)].loader->markShown();
+	}
+}
+
 float64 PhotoData::progress() const {
 	if (uploading()) {
 		if (uploadingData->size > 0) {
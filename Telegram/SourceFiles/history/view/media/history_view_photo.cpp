@@ -219,6 +219,7 @@ void Photo::draw(Painter &p, const QRect &r, TextSelection selection, crl::time
 
 	ensureDataMediaCreated();
 	_dataMedia->automaticLoad(_realParent->fullId(), _parent->data());
+	_data->markLoadShown();
 	auto selected = (selection == FullSelection);
 	auto loaded = _dataMedia->loaded();
 	auto displayLoading = _data->displayLoading();
@@ -491,6 +492,7 @@ void Photo::drawGrouped(
 		not_null<QPixmap*> cache) const {
 	ensureDataMediaCreated();
 	_dataMedia->automaticLoad(_realParent->fullId(), _parent->data());
+	_data->markLoadShown();
 
 	validateGroupedCache(geometry, corners, cacheKey, cache);
 
@@ -117,6 +117,7 @@ void ThemeDocument::draw(Painter &p, const QRect &r, TextSelection selection, cr
 	ensureDataMediaCreated();
 
 	_dataMedia->automaticLoad(_realParent->fullId(), _parent->data());
+	_data->markLoadShown();
 	auto selected = (selection == FullSelection);
 	auto loaded = dataLoaded();
 	auto displayLoading = _data->displayLoading();
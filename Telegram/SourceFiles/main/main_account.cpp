@@ -407,7 +407,8 @@ void Account::startMtp(std::unique_ptr<MTP::Config> config) {
 	const auto writingConfig = _lifetime.make_state<bool>(false);
 	rpl::merge(
 		_mtp->config().updates(),
-		_mtp->dcOptions().changed() | rpl::to_empty
+		_mtp->dcOptions().changed() | rpl::to_empty,
+		_mtp->dcOptions().endpointsHistoryChanged()
 	) | rpl::filter([=] {
 		return !*writingConfig;
 	}) | rpl::start_with_next([=] {
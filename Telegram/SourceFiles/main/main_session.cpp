@@ -22,6 +22,7 @@ https://github.com/telegramdesktop/tdesktop/blob/master/LEGAL
 #include "storage/file_upload.h"
 #include "storage/storage_account.h"
 #include "storage/storage_facade.h"
+#include "storage/storage_file_writer.h"
 #include "storage/storage_account.h"
 #include "data/data_session.h"
 #include "data/data_changes.h"
@@ -43,6 +44,7 @@ namespace Main {
 namespace {
 
 constexpr auto kLegacyCallsPeerToPeerNobody = 4;
+constexpr auto kPartialDownloadsKeep = 7 * 86400 * crl::time(1000);
 
 [[nodiscard]] QString ValidatedInternalLinksDomain(
 		not_null<const Session*> session) {
@@ -144,6 +146,15 @@ Session::Session(
 		local().readSavedGifs();
 		data().stickers().notifyUpdated();
 		data().stickers().notifySavedGifsUpdated();
+
+		// Downloads interrupted long ago won't be resumed anymore.
+		const auto &partial = local().partialDownloads();
+		Storage::FileWriter::RemovePartial(
+			std::vector<QString>(begin(partial), end(partial)),
+			kPartialDownloadsKeep,
+			crl::guard(this, [=](std::vector<QString> removed) {
+				local().removePartialDownloads(removed);
+			}));
 	});
 
 #ifndef TDESKTOP_DISABLE_SPELLCHECK
@@ -159,6 +170,11 @@ Session::Session(
 void Session::finishLogout() {
 	updates().updateOnline();
 	unlockTerms();
+	const auto &partial = local().partialDownloads();
+	Storage::FileWriter::RemovePartial(
+		std::vector<QString>(begin(partial), end(partial)),
+		0,
+		nullptr);
 	data().clear();
 	data().clearLocalStorage();
 }
@@ -39,6 +39,7 @@ QByteArray SessionSettings::serialize() const {
 	size += _mediaLastPlaybackPosition.size() * 2 * sizeof(quint64);
 	size += Serialize::bytearraySize(autoDownload);
 	size += sizeof(qint32) + _hiddenPinnedMessages.size() * (sizeof(quint64) + sizeof(qint32));
+	size += sizeof(qint32) + _uploadPartSizes.size() * 2 * sizeof(qint32);
 
 	auto result = QByteArray();
 	result.reserve(size);
@@ -70,6 +71,10 @@ QByteArray SessionSettings::serialize() const {
 		}
 		stream << qint32(_dialogsFiltersEnabled ? 1 : 0);
 		stream << qint32(_supportAllSilent ? 1 : 0);
+		stream << qint32(_uploadPartSizes.size());
+		for (const auto &[dcId, size] : _uploadPartSizes) {
+			stream << qint32(dcId) << qint32(size);
+		}
 	}
 	return result;
 }
@@ -129,6 +134,7 @@ void SessionSettings::addFromSerialized(const QByteArray &serialized) {
 	base::flat_map<PeerId, MsgId> hiddenPinnedMessages;
 	qint32 dialogsFiltersEnabled = _dialogsFiltersEnabled ? 1 : 0;
 	qint32 supportAllSilent = _supportAllSilent ? 1 : 0;
+	base::flat_map<MTP::DcId, int> uploadPartSizes;
 
 	stream >> versionTag;
 	if (versionTag == kVersionTag) {
@@ -326,6 +332,23 @@ void SessionSettings::addFromSerialized(const QByteArray &serialized) {
 	if (!stream.atEnd()) {
 		stream >> supportAllSilent;
 	}
+	if (!stream.atEnd()) {
+		auto count = qint32(0);
+		stream >> count;
+		if (stream.status() == QDataStream::Ok) {
+			for (auto i = 0; i != count; ++i) {
+				auto dcId = qint32();
+				auto size = qint32();
+				stream >> dcId >> size;
+				if (stream.status() != QDataStream::Ok) {
+					LOG(("App Error: "
+						"Bad data for SessionSettings::addFromSerialized()"));
+					return;
+				}
+				uploadPartSizes.emplace(dcId, size);
+			}
+		}
+	}
 	if (stream.status() != QDataStream::Ok) {
 		LOG(("App Error: "
 			"Bad data for SessionSettings::addFromSerialized()"));
@@ -368,6 +391,7 @@ void SessionSettings::addFromSerialized(const QByteArray &serialized) {
 	_hiddenPinnedMessages = std::move(hiddenPinnedMessages);
 	_dialogsFiltersEnabled = (dialogsFiltersEnabled == 1);
 	_supportAllSilent = (supportAllSilent == 1);
+	_uploadPartSizes = std::move(uploadPartSizes);
 
 	if (version < 2) {
 		app.setLastSeenWarningSeen(appLastSeenWarningSeen == 1);
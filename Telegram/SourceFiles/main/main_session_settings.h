@@ -120,6 +120,15 @@ public:
 		_dialogsFiltersEnabled = value;
 	}
 
+	// Document upload part size learned from the recent uploads.
+	[[nodiscard]] int uploadPartSize(MTP::DcId dcId) const {
+		const auto i = _uploadPartSizes.find(dcId);
+		return (i != end(_uploadPartSizes)) ? i->second : 0;
+	}
+	void setUploadPartSize(MTP::DcId dcId, int size) {
+		_uploadPartSizes[dcId] = size;
+	}
+
 private:
 	static constexpr auto kDefaultSupportChatsLimitSlice = 7 * 24 * 60 * 60;
 
@@ -133,6 +142,7 @@ private:
 	std::vector<std::pair<DocumentId, crl::time>> _mediaLastPlaybackPosition;
 	base::flat_map<PeerId, MsgId> _hiddenPinnedMessages;
 	bool _dialogsFiltersEnabled = false;
+	base::flat_map<MTP::DcId, int> _uploadPartSizes;
 
 	Support::SwitchSettings _supportSwitch;
 	bool _supportFixChatsOrder = true;
@@ -10,6 +10,9 @@ https://github.com/telegramdesktop/tdesktop/blob/master/LEGAL
 #include "core/file_location.h"
 #include "logs.h"
 
+#include <lz4.h>
+#include <mutex>
+
 namespace Media {
 namespace Clip {
 namespace internal {
@@ -19,6 +22,14 @@ constexpr auto kSkipInvalidDataPackets = 10;
 constexpr auto kMaxInlineArea = 1280 * 720;
 constexpr auto kMaxSendingArea = 3840 * 2160; // usual 4K
 
+constexpr auto kLoopCacheMaxDuration = crl::time(10000);
+constexpr auto kLoopCacheMaxArea = 640 * 640;
+constexpr auto kLoopCacheMaxBytes = int64(16 * 1024 * 1024);
+constexpr auto kLoopCacheBudget = int64(96 * 1024 * 1024);
+constexpr auto kLoopCacheExpectedRatio = 4; // Usual LZ4 ratio on GIFs.
+constexpr auto kLoopCacheFrameDuration = crl::time(40);
+constexpr auto kLoopCacheKeepPlayed = crl::time(1000);
+
 // See https://github.com/telegramdesktop/tdesktop/issues/7225
 constexpr auto kAlignImageBy = 64;
 
@@ -47,15 +58,120 @@ bool isAlignedImage(const QImage &image) {
 
 } // namespace
 
+struct LoopCacheFrame {
+	QByteArray compressed;
+	QSize request;
+	QSize size;
+	int bytesPerLine = 0;
+	crl::time frameMs = 0;
+	int delay = 0;
+	bool alpha = false;
+};
+
+// Readers of other clips may evict the frames to fit the global budget.
+struct LoopCache {
+	// Guards frames and evicted, locked after LoopCachesMutex.
+	std::mutex mutex;
+	std::vector<LoopCacheFrame> frames;
+	bool evicted = false;
+
+	// Guarded by LoopCachesMutex.
+	int64 bytes = 0;
+
+	std::atomic<crl::time> played = 0;
+
+	// Accessed only by the owning reader.
+	LoopCacheFrame current;
+};
+
+namespace {
+
+// Caches of all the looped clips that have some bytes accounted.
+std::mutex LoopCachesMutex;
+base::flat_set<not_null<LoopCache*>> LoopCaches;
+int64 LoopCachesBytes = 0;
+
+void AccountLoopCache(not_null<LoopCache*> cache, int64 bytes) {
+	LoopCachesBytes += bytes - cache->bytes;
+	cache->bytes = bytes;
+	if (bytes) {
+		LoopCaches.emplace(cache);
+	} else {
+		LoopCaches.remove(cache);
+	}
+}
+
+void EvictLoopCache(not_null<LoopCache*> cache) {
+	AccountLoopCache(cache, 0);
+
+	std::lock_guard<std::mutex> lock(cache->mutex);
+	cache->frames.clear();
+	cache->evicted = true;
+}
+
+// Caches that were played recently are kept, the one evicted now
+// would only start recording again and evict some other cache.
+[[nodiscard]] bool MakeRoomInLoopCaches(
+		not_null<LoopCache*> except,
+		int64 bytes) {
+	const auto now = crl::now();
+	while (LoopCachesBytes + bytes > kLoopCacheBudget) {
+		auto oldest = (LoopCache*)nullptr;
+		for (const auto cache : LoopCaches) {
+			const auto played = cache->played.load();
+			if (cache == except || now - played < kLoopCacheKeepPlayed) {
+				continue;
+			} else if (!oldest || played < oldest->played.load()) {
+				oldest = cache;
+			}
+		}
+		if (!oldest) {
+			return false;
+		}
+		EvictLoopCache(oldest);
+	}
+	return true;
+}
+
+[[nodiscard]] bool ResizeLoopCache(not_null<LoopCache*> cache, int64 bytes) {
+	std::lock_guard<std::mutex> lock(LoopCachesMutex);
+	if (cache->evicted) {
+		return false;
+	} else if (bytes > cache->bytes
+		&& !MakeRoomInLoopCaches(cache, bytes - cache->bytes)) {
+		return false;
+	}
+	AccountLoopCache(cache, bytes);
+	return true;
+}
+
+void ReleaseLoopCache(not_null<LoopCache*> cache) {
+	std::lock_guard<std::mutex> lock(LoopCachesMutex);
+	AccountLoopCache(cache, 0);
+
+	std::lock_guard<std::mutex> framesLock(cache->mutex);
+	cache->frames.clear();
+	cache->evicted = false;
+}
+
+} // namespace
+
 FFMpegReaderImplementation::FFMpegReaderImplementation(
 	Core::FileLocation *location,
 	QByteArray *data)
 : ReaderImplementation(location, data)
-, _frame(FFmpeg::MakeFramePointer()) {
+, _frame(FFmpeg::MakeFramePointer())
+, _loopCache(std::make_unique<LoopCache>()) {
 }
 
 ReaderImplementation::ReadResult FFMpegReaderImplementation::readNextFrame() {
+	if (_loopCacheState == LoopCacheState::Recording && _frameRead) {
+		recordSkippedFrame();
+	}
 	do {
+		if (_loopCacheState == LoopCacheState::Playing && readCachedFrame()) {
+			return ReadResult::Success;
+		}
 		int res = avcodec_receive_frame(_codecContext, _frame.get());
 		if (res >= 0) {
 			const auto limit = (_mode == Mode::Inspecting)
@@ -91,6 +207,7 @@ ReaderImplementation::ReadResult FFMpegReaderImplementation::readNextFrame() {
 			_frameMs = 0;
 			_lastReadVideoMs = _lastReadAudioMs = 0;
 			_skippedInvalidDataPackets = 0;
+			finishLoopCacheRecording();
 
 			continue;
 		} else if (res != AVERROR(EAGAIN)) {
@@ -162,6 +279,9 @@ void FFMpegReaderImplementation::processReadFrame() {
 
 	_hadFrame = _frameRead = true;
 	_frameTime += _currentFrameDelay;
+	if (_loopCacheState == LoopCacheState::Recording) {
+		++_loopCacheDecoded;
+	}
 }
 
 ReaderImplementation::ReadResult FFMpegReaderImplementation::readFramesTill(crl::time frameMs, crl::time systemMs) {
@@ -193,6 +313,18 @@ crl::time FFMpegReaderImplementation::durationMs() const {
 }
 
 bool FFMpegReaderImplementation::renderFrame(QImage &to, bool &hasAlpha, const QSize &size) {
+	_loopCacheRequest = size;
+	if (_loopCacheState == LoopCacheState::Playing) {
+		return renderCachedFrame(to, hasAlpha, size);
+	} else if (!renderDecodedFrame(to, hasAlpha, size)) {
+		return false;
+	} else if (_loopCacheState == LoopCacheState::Recording) {
+		recordLoopFrame(to, hasAlpha, size);
+	}
+	return true;
+}
+
+bool FFMpegReaderImplementation::renderDecodedFrame(QImage &to, bool &hasAlpha, const QSize &size) {
 	Expects(_frameRead);
 	_frameRead = false;
 
@@ -246,6 +378,212 @@ bool FFMpegReaderImplementation::renderFrame(QImage &to, bool &hasAlpha, const Q
 	return true;
 }
 
+bool FFMpegReaderImplementation::renderCachedFrame(QImage &to, bool &hasAlpha, const QSize &size) {
+	Expects(_frameRead);
+	Expects(!_loopCache->current.compressed.isEmpty());
+	_frameRead = false;
+
+	const auto &frame = _loopCache->current;
+	if (frame.request != size) {
+		// The caller will scale this frame, decode again from the next loop.
+		_loopCacheInvalid = true;
+	}
+	if (to.isNull() || to.size() != frame.size || !to.isDetached() || !isAlignedImage(to)) {
+		to = createAlignedImage(frame.size);
+	}
+	const auto perLine = to.bytesPerLine();
+	const auto unpackedSize = frame.bytesPerLine * frame.size.height();
+	auto unpacked = (perLine == frame.bytesPerLine)
+		? QByteArray()
+		: QByteArray(unpackedSize, Qt::Uninitialized);
+	const auto destination = unpacked.isEmpty()
+		? reinterpret_cast<char*>(to.bits())
+		: unpacked.data();
+	const auto result = LZ4_decompress_safe(
+		frame.compressed.constData(),
+		destination,
+		frame.compressed.size(),
+		unpackedSize);
+	if (result != unpackedSize) {
+		LOG(("Gif Error: Unable to decompress a cached frame %1").arg(logData()));
+		return false;
+	}
+	if (!unpacked.isEmpty()) {
+		const auto lineSize = std::min(perLine, frame.bytesPerLine);
+		auto from = unpacked.constData();
+		auto till = to.bits();
+		for (auto i = 0, height = frame.size.height(); i != height; ++i) {
+			memcpy(till, from, lineSize);
+			from += frame.bytesPerLine;
+			till += perLine;
+		}
+	}
+	hasAlpha = frame.alpha;
+	return true;
+}
+
+bool FFMpegReaderImplementation::readCachedFrame() {
+	auto lock = std::unique_lock<std::mutex>(_loopCache->mutex);
+	const auto evicted = _loopCache->evicted;
+	if (evicted || _loopCacheIndex == int(_loopCache->frames.size())) {
+		if (evicted || _loopCacheInvalid) {
+			lock.unlock();
+
+			// The decoder is still at the start of the clip.
+			clearLoopCache(evicted
+				? LoopCacheState::Waiting
+				: LoopCacheState::Recording);
+			_hadFrame = false;
+			_frameMs = 0;
+			return false;
+		}
+		_loopCacheIndex = 0;
+	}
+	_loopCache->current = _loopCache->frames[_loopCacheIndex++];
+	lock.unlock();
+
+	_loopCache->played = crl::now();
+	const auto &frame = _loopCache->current;
+	_frameMs = frame.frameMs;
+	_currentFrameDelay = frame.delay;
+	_hadFrame = _frameRead = true;
+	_frameTime += _currentFrameDelay;
+	return true;
+}
+
+int FFMpegReaderImplementation::estimatedFramesCount() const {
+	const auto stream = _fmtContext->streams[_streamId];
+	if (stream->nb_frames > 0) {
+		return int(stream->nb_frames);
+	}
+	const auto rate = stream->avg_frame_rate;
+	const auto duration = durationMs();
+	return (rate.num > 0 && rate.den > 0)
+		? int(duration * rate.num / (1000LL * rate.den)) + 1
+		: int(duration / kLoopCacheFrameDuration) + 1;
+}
+
+bool FFMpegReaderImplementation::reserveLoopCache(const QImage &frame) {
+	const auto estimated = int64(estimatedFramesCount())
+		* frame.bytesPerLine()
+		* frame.height()
+		/ kLoopCacheExpectedRatio;
+	if (estimated > kLoopCacheMaxBytes) {
+		clearLoopCache(LoopCacheState::Disabled);
+		return false;
+	}
+	_loopCache->played = crl::now();
+	if (!ResizeLoopCache(_loopCache.get(), estimated)) {
+		// Try again when some other clips are not played for a while.
+		clearLoopCache(LoopCacheState::Waiting);
+		return false;
+	}
+	_loopCacheReserved = estimated;
+	return true;
+}
+
+void FFMpegReaderImplementation::recordLoopFrame(
+		const QImage &frame,
+		bool alpha,
+		const QSize &request) {
+	if (frame.width() * frame.height() > kLoopCacheMaxArea) {
+		clearLoopCache(LoopCacheState::Disabled);
+		return;
+	} else if (!_loopCacheBytes) {
+		if (!reserveLoopCache(frame)) {
+			return;
+		}
+	} else if (_loopCache->current.request != request) {
+		// The frames size has changed, record the next loop.
+		clearLoopCache(LoopCacheState::Waiting);
+		return;
+	}
+	const auto size = frame.bytesPerLine() * frame.height();
+	auto compressed = QByteArray(LZ4_compressBound(size), Qt::Uninitialized);
+	const auto written = LZ4_compress_default(
+		reinterpret_cast<const char*>(frame.constBits()),
+		compressed.data(),
+		size,
+		compressed.size());
+	if (written <= 0) {
+		clearLoopCache(LoopCacheState::Disabled);
+		return;
+	}
+	compressed.resize(written);
+	_loopCacheBytes += written;
+	if (_loopCacheBytes > kLoopCacheMaxBytes) {
+		clearLoopCache(LoopCacheState::Disabled);
+		return;
+	}
+	_loopCache->played = crl::now();
+	const auto accounted = std::max(_loopCacheBytes, _loopCacheReserved);
+	if (!ResizeLoopCache(_loopCache.get(), accounted)) {
+		clearLoopCache(LoopCacheState::Waiting);
+		return;
+	}
+	auto lock = std::unique_lock<std::mutex>(_loopCache->mutex);
+	if (_loopCache->evicted) {
+		lock.unlock();
+		clearLoopCache(LoopCacheState::Waiting);
+		return;
+	}
+	_loopCache->frames.push_back({
+		std::move(compressed),
+		request,
+		frame.size(),
+		frame.bytesPerLine(),
+		_frameMs,
+		_currentFrameDelay,
+		alpha
+	});
+
+	// Only the request is used by the owner while recording.
+	_loopCache->current.request = request;
+}
+
+void FFMpegReaderImplementation::recordSkippedFrame() {
+	// This frame was skipped to keep up, but the loop needs all of them.
+	auto alpha = false;
+	if (!renderFrame(_loopCacheSkipped, alpha, _loopCacheRequest)) {
+		clearLoopCache(LoopCacheState::Disabled);
+	}
+}
+
+void FFMpegReaderImplementation::finishLoopCacheRecording() {
+	if (_loopCacheState == LoopCacheState::Waiting) {
+		clearLoopCache(LoopCacheState::Recording);
+	} else if (_loopCacheState == LoopCacheState::Recording) {
+		const auto recorded = [&] {
+			std::lock_guard<std::mutex> lock(_loopCache->mutex);
+			return _loopCache->evicted
+				? -1
+				: int(_loopCache->frames.size());
+		}();
+		_loopCacheReserved = 0;
+		if (recorded < 0
+			|| !ResizeLoopCache(_loopCache.get(), _loopCacheBytes)) {
+			clearLoopCache(LoopCacheState::Waiting);
+		} else if (recorded > 0 && recorded == _loopCacheDecoded) {
+			_loopCacheSkipped = QImage();
+			_loopCacheState = LoopCacheState::Playing;
+		} else {
+			clearLoopCache(LoopCacheState::Disabled);
+		}
+	}
+}
+
+void FFMpegReaderImplementation::clearLoopCache(LoopCacheState state) {
+	ReleaseLoopCache(_loopCache.get());
+	_loopCache->current = LoopCacheFrame();
+	_loopCacheBytes = 0;
+	_loopCacheReserved = 0;
+	_loopCacheIndex = 0;
+	_loopCacheDecoded = 0;
+	_loopCacheInvalid = false;
+	_loopCacheSkipped = QImage();
+	_loopCacheState = state;
+}
+
 FFMpegReaderImplementation::Rotation FFMpegReaderImplementation::rotationFromDegrees(int degrees) const {
 	switch (degrees) {
 	case 90: return Rotation::Degrees90;
@@ -348,6 +686,15 @@ bool FFMpegReaderImplementation::start(Mode mode, crl::time &positionMs) {
 		processPacket(std::move(packet));
 	}
 
+	// The frame size is requested after the first frame is rendered,
+	// so the recording starts from the next loop.
+	const auto duration = durationMs();
+	if (_mode == Mode::Silent
+		&& duration > 0
+		&& duration <= kLoopCacheMaxDuration) {
+		_loopCacheState = LoopCacheState::Waiting;
+	}
+
 	return true;
 }
 
@@ -396,6 +743,7 @@ QString FFMpegReaderImplementation::logData() const {
 }
 
 FFMpegReaderImplementation::~FFMpegReaderImplementation() {
+	clearLoopCache(LoopCacheState::Disabled);
 	if (_codecContext) avcodec_free_context(&_codecContext);
 	if (_swsContext) sws_freeContext(_swsContext);
 	if (_opened) {
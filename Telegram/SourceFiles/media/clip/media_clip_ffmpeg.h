@@ -24,6 +24,8 @@ namespace internal {
 
 constexpr auto kMaxInMemory = 10 * 1024 * 1024;
 
+struct LoopCache;
+
 class FFMpegReaderImplementation : public ReaderImplementation {
 public:
 	FFMpegReaderImplementation(Core::FileLocation *location, QByteArray *data);
@@ -47,8 +49,30 @@ public:
 	~FFMpegReaderImplementation();
 
 private:
+	// Short looped clips keep their rendered frames compressed in memory,
+	// so that the following loops don't decode the video again.
+	enum class LoopCacheState {
+		Disabled,
+		Waiting, // Recording will start with the next loop.
+		Recording,
+		Playing,
+	};
+
 	ReadResult readNextFrame();
 	void processReadFrame();
+	bool renderDecodedFrame(QImage &to, bool &hasAlpha, const QSize &size);
+	bool renderCachedFrame(QImage &to, bool &hasAlpha, const QSize &size);
+
+	bool readCachedFrame();
+	[[nodiscard]] int estimatedFramesCount() const;
+	[[nodiscard]] bool reserveLoopCache(const QImage &frame);
+	void recordLoopFrame(
+		const QImage &frame,
+		bool alpha,
+		const QSize &request);
+	void recordSkippedFrame();
+	void finishLoopCacheRecording();
+	void clearLoopCache(LoopCacheState state);
 
 	enum class PacketResult {
 		Ok,
@@ -107,6 +131,16 @@ private:
 	crl::time _frameTime = 0;
 	crl::time _frameTimeCorrection = 0;
 
+	LoopCacheState _loopCacheState = LoopCacheState::Disabled;
+	const std::unique_ptr<LoopCache> _loopCache;
+	int64 _loopCacheBytes = 0;
+	int64 _loopCacheReserved = 0;
+	int _loopCacheIndex = 0;
+	int _loopCacheDecoded = 0;
+	bool _loopCacheInvalid = false;
+	QSize _loopCacheRequest;
+	QImage _loopCacheSkipped;
+
 };
 
 } // namespace internal
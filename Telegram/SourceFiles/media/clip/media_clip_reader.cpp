@@ -10,13 +10,9 @@ https://github.com/telegramdesktop/tdesktop/blob/master/LEGAL
 #include "media/clip/media_clip_ffmpeg.h"
 #include "media/clip/media_clip_check_streaming.h"
 #include "core/file_location.h"
-#include "base/openssl_help.h"
-#include "base/invoke_queued.h"
 #include "logs.h"
 
 #include <QtCore/QBuffer>
-#include <QtCore/QAbstractEventDispatcher>
-#include <QtCore/QCoreApplication>
 #include <QtCore/QThread>
 #include <QtCore/QFileInfo>
 
@@ -31,12 +27,21 @@ namespace Media {
 namespace Clip {
 namespace {
 
-constexpr auto kClipThreadsCount = 8;
-constexpr auto kAverageGifSize = 320 * 240;
+constexpr auto kClipMaxThreadsCount = 8;
 constexpr auto kWaitBeforeGifPause = crl::time(200);
+constexpr auto kNeverProcess = crl::time(86400 * 1000);
+constexpr auto kFrameDeadlineMissDelay = crl::time(20);
+constexpr auto kLogDeadlinesEach = 1000;
+
+[[nodiscard]] int ClipThreadsCount() {
+	static const auto result = std::clamp(
+		QThread::idealThreadCount() - 1,
+		1,
+		kClipMaxThreadsCount);
+	return result;
+}
 
-QVector<QThread*> threads;
-QVector<Manager*> managers;
+Manager *manager = nullptr;
 
 QImage PrepareFrameImage(const FrameRequest &request, const QImage &original, bool hasAlpha, QImage &cache) {
 	auto needResize = (original.width() != request.framew) || (original.height() != request.frameh);
@@ -109,23 +114,10 @@ Reader::Reader(const QByteArray &data, Callback &&callback)
 }
 
 void Reader::init(const Core::FileLocation &location, const QByteArray &data) {
-	if (threads.size() < kClipThreadsCount) {
-		_threadIndex = threads.size();
-		threads.push_back(new QThread());
-		managers.push_back(new Manager(threads.back()));
-		threads.back()->start();
-	} else {
-		_threadIndex = int32(openssl::RandomValue<uint32>() % threads.size());
-		int32 loadLevel = 0x7FFFFFFF;
-		for (int32 i = 0, l = threads.size(); i < l; ++i) {
-			int32 level = managers.at(i)->loadLevel();
-			if (level < loadLevel) {
-				_threadIndex = i;
-				loadLevel = level;
-			}
-		}
+	if (!manager) {
+		manager = new Manager(ClipThreadsCount());
 	}
-	managers.at(_threadIndex)->append(this, location, data);
+	manager->append(this, location, data);
 }
 
 Reader::Frame *Reader::frameToShow(int32 *index) const { // 0 means not ready
@@ -197,15 +189,15 @@ void Reader::moveToNextWrite() const {
 	}
 }
 
-void Reader::callback(Reader *reader, qint32 threadIndex, qint32 notification) {
+void Reader::callback(Reader *reader, qint32 notification) {
 	// Check if reader is not deleted already
-	if (managers.size() > threadIndex && managers.at(threadIndex)->carries(reader) && reader->_callback) {
+	if (manager && manager->carries(reader) && reader->_callback) {
 		reader->_callback(Notification(notification));
 	}
 }
 
 void Reader::start(int32 framew, int32 frameh, int32 outerw, int32 outerh, ImageRoundRadius radius, RectParts corners) {
-	if (managers.size() <= _threadIndex) error();
+	if (!manager) error();
 	if (_state == State::Error) return;
 
 	if (_step.loadAcquire() == WaitingForRequestStep) {
@@ -220,7 +212,7 @@ void Reader::start(int32 framew, int32 frameh, int32 outerw, int32 outerh, Image
 		request.corners = corners;
 		_frames[0].request = _frames[1].request = _frames[2].request = request;
 		moveToNextShow();
-		managers.at(_threadIndex)->start(this);
+		manager->start(this);
 	}
 }
 
@@ -236,9 +228,9 @@ QPixmap Reader::current(int32 framew, int32 frameh, int32 outerw, int32 outerh,
 		frame->displayed.storeRelease(1);
 		if (_autoPausedGif.loadAcquire()) {
 			_autoPausedGif.storeRelease(0);
-			if (managers.size() <= _threadIndex) error();
+			if (!manager) error();
 			if (_state != State::Error) {
-				managers.at(_threadIndex)->update(this);
+				manager->update(this);
 			}
 		}
 	} else {
@@ -269,9 +261,9 @@ QPixmap Reader::current(int32 framew, int32 frameh, int32 outerw, int32 outerh,
 
 	moveToNextShow();
 
-	if (managers.size() <= _threadIndex) error();
+	if (!manager) error();
 	if (_state != State::Error) {
-		managers.at(_threadIndex)->update(this);
+		manager->update(this);
 	}
 
 	return frame->pix;
@@ -301,11 +293,11 @@ crl::time Reader::getDurationMs() const {
 }
 
 void Reader::pauseResumeVideo() {
-	if (managers.size() <= _threadIndex) error();
+	if (!manager) error();
 	if (_state == State::Error) return;
 
 	_videoPauseRequest.storeRelease(1 - _videoPauseRequest.loadAcquire());
-	managers.at(_threadIndex)->start(this);
+	manager->start(this);
 }
 
 bool Reader::videoPaused() const {
@@ -325,9 +317,9 @@ State Reader::state() const {
 }
 
 void Reader::stop() {
-	if (managers.size() <= _threadIndex) error();
+	if (!manager) error();
 	if (_state != State::Error) {
-		managers.at(_threadIndex)->stop(this);
+		manager->stop(this);
 		_width = _height = 0;
 	}
 }
@@ -566,19 +558,17 @@ private:
 
 };
 
-Manager::Manager(QThread *thread) {
-	moveToThread(thread);
-	connect(thread, &QThread::started, this, [=] { process(); });
-	connect(thread, &QThread::finished, this, [=] { finish(); });
+Manager::Manager(int threadsCount) {
+	Expects(threadsCount > 0);
 
-	_timer.setSingleShot(true);
-	_timer.moveToThread(thread);
-	connect(&_timer, &QTimer::timeout, this, [=] { process(); });
+	_threads.reserve(threadsCount);
+	for (auto i = 0; i != threadsCount; ++i) {
+		_threads.emplace_back([=] { work(); });
+	}
 }
 
 void Manager::append(Reader *reader, const Core::FileLocation &location, const QByteArray &data) {
 	reader->_private = new ReaderPrivate(reader, location, data);
-	_loadLevel.fetchAndAddRelaxed(kAverageGifSize);
 	update(reader);
 }
 
@@ -587,22 +577,34 @@ void Manager::start(Reader *reader) {
 }
 
 void Manager::update(Reader *reader) {
-	QMutexLocker lock(&_readerPointersMutex);
-	auto i = _readerPointers.find(reader);
-	if (i == _readerPointers.cend()) {
-		_readerPointers.insert(reader, QAtomicInt(1));
-	} else {
-		i->storeRelease(1);
+	{
+		QMutexLocker lock(&_readerPointersMutex);
+		auto i = _readerPointers.find(reader);
+		if (i == _readerPointers.cend()) {
+			_readerPointers.insert(reader, QAtomicInt(1));
+		} else {
+			i->storeRelease(1);
+		}
 	}
-	InvokeQueued(this, [=] { process(); });
+	wake();
 }
 
 void Manager::stop(Reader *reader) {
 	if (!carries(reader)) return;
 
-	QMutexLocker lock(&_readerPointersMutex);
-	_readerPointers.remove(reader);
-	InvokeQueued(this, [=] { process(); });
+	{
+		QMutexLocker lock(&_readerPointersMutex);
+		_readerPointers.remove(reader);
+	}
+	wake();
+}
+
+void Manager::wake() {
+	// Workers check the reader pointers under _mutex before waiting.
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+	}
+	_wake.notify_one();
 }
 
 bool Manager::carries(Reader *reader) const {
@@ -625,8 +627,8 @@ Manager::ReaderPointers::const_iterator Manager::constUnsafeFindReaderPointer(Re
 }
 
 void Manager::callback(Reader *reader, Notification notification) {
-	crl::on_main([=, threadIndex = reader->threadIndex()] {
-		Reader::callback(reader, threadIndex, notification);
+	crl::on_main([=] {
+		Reader::callback(reader, notification);
 	});
 }
 
@@ -652,7 +654,6 @@ bool Manager::handleProcessResult(ReaderPrivate *reader, ProcessResult result, c
 	}
 
 	if (result == ProcessResult::Started) {
-		_loadLevel.fetchAndAddRelaxed(reader->_width * reader->_height - kAverageGifSize);
 		it.key()->_durationMs = reader->_durationMs;
 	}
 	// See if we need to pause GIF because it is not displayed right now.
@@ -693,13 +694,8 @@ bool Manager::handleProcessResult(ReaderPrivate *reader, ProcessResult result, c
 
 Manager::ResultHandleState Manager::handleResult(ReaderPrivate *reader, ProcessResult result, crl::time ms) {
 	if (!handleProcessResult(reader, result, ms)) {
-		_loadLevel.fetchAndAddRelaxed(-1 * (reader->_width > 0 ? reader->_width * reader->_height : kAverageGifSize));
-		delete reader;
 		return ResultHandleRemove;
-	}
-
-	_processingInThread->eventDispatcher()->processEvents(QEventLoop::AllEvents);
-	if (_processingInThread->isInterruptionRequested()) {
+	} else if (_stopping) {
 		return ResultHandleStop;
 	}
 
@@ -709,7 +705,6 @@ Manager::ResultHandleState Manager::handleResult(ReaderPrivate *reader, ProcessR
 			auto it = constUnsafeFindReaderPointer(reader);
 			if (it != _readerPointers.cend()) {
 				int32 index = 0;
-				Reader *r = it.key();
 				Reader::Frame *frame = it.key()->frameToWrite(&index);
 				if (frame) {
 					frame->clear();
@@ -725,92 +720,133 @@ Manager::ResultHandleState Manager::handleResult(ReaderPrivate *reader, ProcessR
 	return ResultHandleContinue;
 }
 
-void Manager::process() {
-	if (_processingInThread) {
-		_needReProcess = true;
-		return;
-	}
+void Manager::work() {
+	auto lock = std::unique_lock<std::mutex>(_mutex);
+	while (!_stopping) {
+		auto ms = crl::now();
+		refresh(ms);
+
+		// The earliest deadline of the shown readers is processed first,
+		// the auto-paused ones wait until they are shown again.
+		auto chosen = _readers.end();
+		auto due = 0;
+		for (auto i = _readers.begin(), e = _readers.end(); i != e; ++i) {
+			if (i->busy || i.key()->_autoPausedGif) {
+				continue;
+			} else if (i->when <= ms) {
+				++due;
+			}
+			if (chosen == _readers.end() || i->when < chosen->when) {
+				chosen = i;
+			}
+		}
+		if (chosen == _readers.end() || chosen->when > ms) {
+			if (chosen == _readers.end()) {
+				_wake.wait(lock);
+			} else {
+				_wake.wait_for(
+					lock,
+					std::chrono::milliseconds(chosen->when - ms));
+			}
+			continue;
+		}
+		const auto reader = chosen.key();
+		if (chosen->when > 0 && reader->_started) {
+			countDeadline(ms - chosen->when);
+		}
+		chosen->busy = true;
+		if (due > 1) {
+			_wake.notify_one();
+		}
 
-	_timer.stop();
-	_processingInThread = thread();
+		lock.unlock();
+		const auto state = handleResult(reader, reader->process(ms), ms);
+		lock.lock();
+
+		const auto i = _readers.find(reader);
+		Assert(i != _readers.end());
+		if (state == ResultHandleRemove) {
+			_readers.erase(i);
+			delete reader;
+			continue;
+		} else if (state == ResultHandleStop) {
+			break;
+		}
+		ms = crl::now();
+		i->busy = false;
+		if (reader->_videoPausedAtMs) {
+			i->when = ms + kNeverProcess;
+		} else if (reader->_nextFrameWhen && reader->_started) {
+			i->when = reader->_nextFrameWhen;
+		} else {
+			i->when = ms + kNeverProcess;
+		}
+	}
+}
 
-	bool checkAllReaders = false;
-	auto ms = crl::now(), minms = ms + 86400 * crl::time(1000);
+void Manager::refresh(crl::time ms) {
+	auto checkAllReaders = false;
 	{
 		QMutexLocker lock(&_readerPointersMutex);
 		for (auto it = _readerPointers.begin(), e = _readerPointers.end(); it != e; ++it) {
-			if (it->loadAcquire() && it.key()->_private != nullptr) {
-				auto i = _readers.find(it.key()->_private);
-				if (i == _readers.cend()) {
-					_readers.insert(it.key()->_private, 0);
+			const auto reader = it.key()->_private;
+			if (!it->loadAcquire() || !reader) {
+				continue;
+			}
+			auto i = _readers.find(reader);
+			if (i == _readers.end()) {
+				_readers.insert(reader, Scheduled());
+			} else if (i->busy) {
+				// Applied after the other worker finishes processing it.
+				continue;
+			} else {
+				i->when = ms;
+				if (reader->_autoPausedGif && !it.key()->_autoPausedGif.loadAcquire()) {
+					reader->_autoPausedGif = false;
+				}
+				if (it.key()->_videoPauseRequest.loadAcquire()) {
+					reader->pauseVideo(ms);
 				} else {
-					i.value() = ms;
-					if (i.key()->_autoPausedGif && !it.key()->_autoPausedGif.loadAcquire()) {
-						i.key()->_autoPausedGif = false;
-					}
-					if (it.key()->_videoPauseRequest.loadAcquire()) {
-						i.key()->pauseVideo(ms);
-					} else {
-						i.key()->resumeVideo(ms);
-					}
+					reader->resumeVideo(ms);
 				}
-				auto frame = it.key()->frameToWrite();
-				if (frame) it.key()->_private->_request = frame->request;
-				it->storeRelease(0);
 			}
+			auto frame = it.key()->frameToWrite();
+			if (frame) reader->_request = frame->request;
+			it->storeRelease(0);
 		}
 		checkAllReaders = (_readers.size() > _readerPointers.size());
 	}
-
-	for (auto i = _readers.begin(), e = _readers.end(); i != e;) {
-		ReaderPrivate *reader = i.key();
-		if (i.value() <= ms) {
-			ResultHandleState state = handleResult(reader, reader->process(ms), ms);
-			if (state == ResultHandleRemove) {
-				i = _readers.erase(i);
-				continue;
-			} else if (state == ResultHandleStop) {
-				_processingInThread = nullptr;
-				return;
-			}
-			ms = crl::now();
-			if (reader->_videoPausedAtMs) {
-				i.value() = ms + 86400 * 1000ULL;
-			} else if (reader->_nextFrameWhen && reader->_started) {
-				i.value() = reader->_nextFrameWhen;
-			} else {
-				i.value() = (ms + 86400 * 1000ULL);
-			}
-		} else if (checkAllReaders) {
+	if (!checkAllReaders) {
+		return;
+	}
+	for (auto i = _readers.begin(); i != _readers.end();) {
+		const auto reader = i.key();
+		if (!i->busy) {
 			QMutexLocker lock(&_readerPointersMutex);
 			auto it = constUnsafeFindReaderPointer(reader);
 			if (it == _readerPointers.cend()) {
-				_loadLevel.fetchAndAddRelaxed(-1 * (reader->_width > 0 ? reader->_width * reader->_height : kAverageGifSize));
 				delete reader;
 				i = _readers.erase(i);
 				continue;
 			}
 		}
-		if (!reader->_autoPausedGif && i.value() < minms) {
-			minms = i.value();
-		}
 		++i;
 	}
-
-	ms = crl::now();
-	if (_needReProcess || minms <= ms) {
-		_needReProcess = false;
-		_timer.start(1);
-	} else {
-		_timer.start(minms - ms);
-	}
-
-	_processingInThread = nullptr;
 }
 
-void Manager::finish() {
-	_timer.stop();
-	clear();
+void Manager::countDeadline(crl::time late) {
+	++_deadlinesChecked;
+	if (late > kFrameDeadlineMissDelay) {
+		++_deadlinesMissed;
+		accumulate_max(_deadlinesWorstMiss, late);
+	}
+	if (!(_deadlinesChecked % kLogDeadlinesEach)) {
+		DEBUG_LOG(("Clip Info: Frame deadlines missed %1 of %2, "
+			"the worst by %3ms."
+			).arg(_deadlinesMissed
+			).arg(_deadlinesChecked
+			).arg(base::take(_deadlinesWorstMiss)));
+	}
 }
 
 void Manager::clear() {
@@ -829,6 +865,14 @@ void Manager::clear() {
 }
 
 Manager::~Manager() {
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		_stopping = true;
+	}
+	_wake.notify_all();
+	for (auto &thread : _threads) {
+		thread.join();
+	}
 	clear();
 }
 
@@ -875,16 +919,9 @@ Ui::PreparedFileInformation::Video PrepareForSending(const QString &fname, const
 }
 
 void Finish() {
-	if (!threads.isEmpty()) {
-		for (int32 i = 0, l = threads.size(); i < l; ++i) {
-			threads.at(i)->quit();
-			DEBUG_LOG(("Waiting for clipThread to finish: %1").arg(i));
-			threads.at(i)->wait();
-			delete managers.at(i);
-			delete threads.at(i);
-		}
-		threads.clear();
-		managers.clear();
+	if (manager) {
+		DEBUG_LOG(("Waiting for clip threads to finish."));
+		delete base::take(manager);
 	}
 }
 
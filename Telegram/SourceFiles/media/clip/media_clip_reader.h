@@ -13,6 +13,10 @@ https://github.com/telegramdesktop/tdesktop/blob/master/LEGAL
 #include <QtCore/QTimer>
 #include <QtCore/QMutex>
 
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
 namespace Core {
 class FileLocation;
 } // namespace Core
@@ -64,7 +68,7 @@ public:
 	Reader(const QByteArray &data, Callback &&callback);
 
 	// Reader can be already deleted.
-	static void callback(Reader *reader, qint32 threadIndex, qint32 notification);
+	static void callback(Reader *reader, qint32 notification);
 
 	void start(int framew, int frameh, int outerw, int outerh, ImageRoundRadius radius, RectParts corners);
 	QPixmap current(int framew, int frameh, int outerw, int outerh, ImageRoundRadius radius, RectParts corners, crl::time ms);
@@ -84,9 +88,6 @@ public:
 		return _autoPausedGif.loadAcquire();
 	}
 	bool videoPaused() const;
-	int threadIndex() const {
-		return _threadIndex;
-	}
 
 	int width() const;
 	int height() const;
@@ -144,7 +145,6 @@ private:
 
 	QAtomicInt _autoPausedGif = 0;
 	QAtomicInt _videoPauseRequest = 0;
-	int32 _threadIndex;
 
 	friend class Manager;
 
@@ -220,14 +220,13 @@ enum class ProcessResult {
 	Wait,
 };
 
-class Manager : public QObject {
+// All the readers share a pool of worker threads, which process
+// the shown readers by their frame deadlines, the earliest first.
+class Manager final {
 public:
-	explicit Manager(QThread *thread);
+	explicit Manager(int threadsCount);
 	~Manager();
 
-	int loadLevel() const {
-		return _loadLevel;
-	}
 	void append(Reader *reader, const Core::FileLocation &location, const QByteArray &data);
 	void start(Reader *reader);
 	void update(Reader *reader);
@@ -235,12 +234,18 @@ public:
 	bool carries(Reader *reader) const;
 
 private:
-	void process();
-	void finish();
+	struct Scheduled {
+		crl::time when = 0;
+		bool busy = false;
+	};
+
+	void work();
+	void refresh(crl::time ms);
+	void wake();
 	void callback(Reader *reader, Notification notification);
 	void clear();
+	void countDeadline(crl::time late);
 
-	QAtomicInt _loadLevel;
 	using ReaderPointers = QMap<Reader*, QAtomicInt>;
 	ReaderPointers _readerPointers;
 	mutable QMutex _readerPointersMutex;
@@ -257,12 +262,17 @@ private:
 	};
 	ResultHandleState handleResult(ReaderPrivate *reader, ProcessResult result, crl::time ms);
 
-	using Readers = QMap<ReaderPrivate*, crl::time>;
+	// Guarded by _mutex, a busy reader is accessed only by its worker.
+	using Readers = QMap<ReaderPrivate*, Scheduled>;
 	Readers _readers;
-
-	QTimer _timer;
-	QThread *_processingInThread = nullptr;
-	bool _needReProcess = false;
+	int64 _deadlinesChecked = 0;
+	int64 _deadlinesMissed = 0;
+	crl::time _deadlinesWorstMiss = 0;
+
+	std::vector<std::thread> _threads;
+	std::mutex _mutex;
+	std::condition_variable _wake;
+	std::atomic<bool> _stopping = false;
 
 };
 
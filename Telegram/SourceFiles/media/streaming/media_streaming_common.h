@@ -45,6 +45,7 @@ struct PlaybackOptions {
 	bool syncVideoByAudio = true;
 	bool waitForMarkAsShown = false;
 	bool loop = false;
+	int64 framesMemoryLimit = 128 * 1024 * 1024; // Video frames queue.
 };
 
 struct TrackState {
@@ -70,6 +71,12 @@ struct Information {
 	int headerSize = 0;
 };
 
+struct FrameStats {
+	int shown = 0;
+	int dropped = 0; // Skipped as stale, without being presented.
+	int late = 0; // Displayed noticeably later than planned.
+};
+
 template <typename Track>
 struct PreloadedUpdate {
 	crl::time till = kTimeUnknown;
@@ -18,6 +18,28 @@ namespace {
 constexpr auto kMaxSingleReadAmount = 8 * 1024 * 1024;
 constexpr auto kMaxQueuedPackets = 1024;
 
+[[nodiscard]] std::vector<Reader::Keyframe> ReadKeyframes(
+		not_null<AVStream*> stream,
+		int size) {
+	auto result = std::vector<Reader::Keyframe>();
+	result.reserve(std::max(stream->nb_index_entries, 0));
+	for (auto i = 0; i < stream->nb_index_entries; ++i) {
+		const auto &entry = stream->index_entries[i];
+		if (!(entry.flags & AVINDEX_KEYFRAME)
+			|| entry.timestamp == AV_NOPTS_VALUE
+			|| entry.pos < 0
+			|| entry.pos >= size) {
+			continue;
+		}
+		result.push_back({
+			FFmpeg::PtsToTime(entry.timestamp, stream->time_base),
+			int(entry.pos)
+		});
+	}
+	ranges::sort(result, ranges::less(), &Reader::Keyframe::position);
+	return result;
+}
+
 } // namespace
 
 File::Context::Context(
@@ -277,7 +299,12 @@ void File::Context::start(crl::time position) {
 		sendFullInCache(true);
 	}
 	if (video.codec || audio.codec) {
-		seekToPosition(format.get(), video.codec ? video : audio, position);
+		const auto &stream = video.codec ? video : audio;
+		seekToPosition(format.get(), stream, position);
+
+		// Some demuxers (matroska) read the index only on the first seek.
+		_reader->setKeyframes(
+			ReadKeyframes(format->streams[stream.index], _size));
 	}
 	if (unroll()) {
 		return;
@@ -446,6 +473,10 @@ void File::setLoaderPriority(int priority) {
 	_reader->setLoaderPriority(priority);
 }
 
+void File::prefetchForSeek(crl::time position) {
+	_reader->prefetchForSeek(position);
+}
+
 File::~File() {
 	stop();
 }
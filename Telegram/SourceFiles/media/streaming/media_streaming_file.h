@@ -34,6 +34,7 @@ public:
 
 	[[nodiscard]] bool isRemoteLoader() const;
 	void setLoaderPriority(int priority);
+	void prefetchForSeek(crl::time position);
 
 	~File();
 
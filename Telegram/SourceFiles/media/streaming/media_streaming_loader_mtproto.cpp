@@ -59,7 +59,8 @@ void LoaderMtproto::load(int offset) {
 }
 
 void LoaderMtproto::addToQueueWithPriority() {
-	addToQueue(_priority);
+	// Playback goes after the media that is shown on screen.
+	addToQueue(std::min(_priority, Storage::kViewportDownloadPriority - 1));
 }
 
 void LoaderMtproto::stop() {
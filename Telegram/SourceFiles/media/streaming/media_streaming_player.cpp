@@ -145,6 +145,10 @@ void Player::setLoaderPriority(int priority) {
 	_file->setLoaderPriority(priority);
 }
 
+void Player::prefetchForSeek(crl::time position) {
+	_file->prefetchForSeek(position);
+}
+
 template <typename Track>
 void Player::trackReceivedTill(
 		const Track &track,
@@ -873,6 +877,10 @@ QSize Player::videoSize() const {
 	return _information.video.size;
 }
 
+FrameStats Player::videoFrameStats() const {
+	return _video ? _video->frameStats() : FrameStats();
+}
+
 QImage Player::frame(
 		const FrameRequest &request,
 		const Instance *instance) const {
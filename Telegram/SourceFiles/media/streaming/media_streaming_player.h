@@ -61,6 +61,7 @@ public:
 	[[nodiscard]] rpl::producer<bool> fullInCache() const;
 
 	[[nodiscard]] QSize videoSize() const;
+	[[nodiscard]] FrameStats videoFrameStats() const;
 	[[nodiscard]] QImage frame(
 		const FrameRequest &request,
 		const Instance *instance = nullptr) const;
@@ -69,6 +70,9 @@ public:
 
 	void setLoaderPriority(int priority);
 
+	// Loads the data around the keyframe while the seek bar is dragged.
+	void prefetchForSeek(crl::time position);
+
 	[[nodiscard]] Media::Player::TrackState prepareLegacyState() const;
 
 	void lock();
@@ -10,6 +10,7 @@ https://github.com/telegramdesktop/tdesktop/blob/master/LEGAL
 #include "media/streaming/media_streaming_common.h"
 #include "media/streaming/media_streaming_loader.h"
 #include "storage/cache/storage_cache_database.h"
+#include "storage/download_manager_mtproto.h"
 
 namespace Media {
 namespace Streaming {
@@ -27,6 +28,10 @@ constexpr auto kSlicesInMemory = 2;
 constexpr auto kPreloadPartsAhead = 8;
 constexpr auto kDownloaderRequestsLimit = 4;
 
+// While the user drags the seek bar we load the bytes after the keyframe
+// preceding the position, so the seek finishes without a cold request.
+constexpr auto kSeekPrefetchSize = 4 * kPartSize;
+
 using PartsMap = base::flat_map<int, QByteArray>;
 
 struct ParsedCacheEntry {
@@ -630,6 +635,43 @@ auto Reader::Slices::fill(int offset, bytes::span buffer) -> FillResult {
 	return result;
 }
 
+auto Reader::Slices::prefetch(int from, int till) -> FillResult {
+	Expects(from >= 0 && from < till && till <= _size);
+
+	using Flag = Slice::Flag;
+
+	auto result = FillResult();
+	if (_headerMode == HeaderMode::Unknown || isFullInHeader()) {
+		return result;
+	}
+	const auto fromSlice = from / kInSlice;
+	const auto tillSlice = (till + kInSlice - 1) / kInSlice;
+	Assert(tillSlice <= _data.size());
+	for (auto index = fromSlice; index != tillSlice; ++index) {
+		auto &slice = _data[index];
+		if (_headerMode != HeaderMode::NoCache
+			&& !(slice.flags & Flag::LoadedFromCache)) {
+			if (!(slice.flags & Flag::LoadingFromCache)) {
+				slice.flags |= Flag::LoadingFromCache;
+				result.sliceNumbersFromCache.add(index + 1);
+			}
+			continue;
+		}
+		const auto sliceFrom = std::max(from - index * kInSlice, 0);
+		const auto sliceTill = std::min(till - index * kInSlice, kInSlice);
+		const auto offsets = slice.offsetsFromLoader(
+			(sliceFrom / kPartSize) * kPartSize,
+			((sliceTill + kPartSize - 1) / kPartSize) * kPartSize);
+		for (const auto offset : offsets.values()) {
+			const auto full = offset + index * kInSlice;
+			if (full < _size) {
+				result.offsetsFromLoader.add(full);
+			}
+		}
+	}
+	return result;
+}
+
 auto Reader::Slices::fillFromHeader(int offset, bytes::span buffer)
 -> FillResult {
 	auto result = FillResult();
@@ -873,6 +915,7 @@ Reader::Reader(
 
 void Reader::startSleep(not_null<crl::semaphore*> wake) {
 	_sleeping.store(wake, std::memory_order_release);
+	processSeekPrefetch();
 	processDownloaderRequests();
 }
 
@@ -887,6 +930,64 @@ void Reader::stopSleep() {
 	_sleeping.store(nullptr, std::memory_order_release);
 }
 
+void Reader::prefetchForSeek(crl::time position) {
+	_seekPrefetchRequests.emplace(position);
+	if (_streamingActive) {
+		wakeFromSleep();
+	}
+}
+
+void Reader::setKeyframes(std::vector<Keyframe> &&keyframes) {
+	_keyframes = std::move(keyframes);
+}
+
+void Reader::processSeekPrefetch() {
+	auto positions = _seekPrefetchRequests.take();
+	if (positions.empty()
+		|| _keyframes.empty()
+		|| _streamingError
+		|| _slices.headerModeUnknown()
+		|| _slices.isFullInHeader()) {
+		return;
+	}
+
+	// Only the last dragged position matters.
+	const auto i = ranges::upper_bound(
+		_keyframes,
+		positions.back(),
+		ranges::less(),
+		&Keyframe::position);
+	if (i == begin(_keyframes)) {
+		return;
+	}
+	const auto from = (std::prev(i)->offset / kPartSize) * kPartSize;
+	const auto till = std::min(from + kSeekPrefetchSize, size());
+	if (from >= till
+		|| (from == _seekPrefetchFrom && till == _seekPrefetchTill)) {
+		return;
+	} else if (_seekPrefetchTill <= from || till <= _seekPrefetchFrom) {
+		if (_seekPrefetchFrom < _seekPrefetchTill) {
+			cancelLoadInRange(_seekPrefetchFrom, _seekPrefetchTill);
+		}
+	}
+	_seekPrefetchFrom = from;
+	_seekPrefetchTill = till;
+
+	// Only request the missing parts, the bytes are read by the seek.
+	const auto result = _slices.prefetch(from, till);
+	for (const auto sliceNumber : result.sliceNumbersFromCache.values()) {
+		readFromCache(sliceNumber);
+	}
+	auto checkPriority = true;
+	for (const auto offset : result.offsetsFromLoader.values()) {
+		if (checkPriority) {
+			checkLoadWillBeFirst(offset);
+			checkPriority = false;
+		}
+		loadAtOffset(offset);
+	}
+}
+
 void Reader::stopStreamingAsync() {
 	_stopStreamingAsync = true;
 	crl::on_main(this, [=] {
@@ -1106,7 +1207,9 @@ void Reader::setLoaderPriority(int priority) {
 }
 
 void Reader::refreshLoaderPriority() {
-	_loader->setPriority(_streamingActive ? _realPriority : 0);
+	_loader->setPriority(_streamingActive
+		? _realPriority
+		: Storage::kSaveDownloadPriority);
 }
 
 bool Reader::isRemoteLoader() const {
@@ -1243,6 +1346,7 @@ Reader::FillState Reader::fill(
 	if (_streamingError) {
 		return FillState::Failed;
 	}
+	processSeekPrefetch();
 
 	auto lastResult = FillState();
 	do {
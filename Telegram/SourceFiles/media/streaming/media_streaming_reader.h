@@ -38,6 +38,10 @@ public:
 		WaitingRemote,
 		Failed,
 	};
+	struct Keyframe {
+		crl::time position = 0;
+		int offset = 0;
+	};
 
 	// Main thread.
 	explicit Reader(
@@ -67,9 +71,14 @@ public:
 	void stopStreamingAsync();
 	void tryRemoveLoaderAsync();
 
+	// Streaming thread.
+	// Taken from the container index, sorted by position.
+	void setKeyframes(std::vector<Keyframe> &&keyframes);
+
 	// Main thread.
 	void startStreaming();
 	void stopStreaming(bool stillActive = false);
+	void prefetchForSeek(crl::time position);
 	[[nodiscard]] rpl::producer<LoadedPart> partsForDownloader() const;
 	void loadForDownloader(
 		not_null<Storage::StreamedFileDownloader*> downloader,
@@ -161,6 +170,9 @@ private:
 		void processPart(int offset, QByteArray &&bytes);
 
 		[[nodiscard]] FillResult fill(int offset, bytes::span buffer);
+
+		// Finds the parts to read from cache or to load, copies nothing.
+		[[nodiscard]] FillResult prefetch(int from, int till);
 		[[nodiscard]] SerializedSlice unloadToCache();
 
 		[[nodiscard]] QByteArray partForDownloader(int offset) const;
@@ -230,6 +242,7 @@ private:
 	void checkForDownloaderReadyOffsets();
 
 	void refreshLoaderPriority();
+	void processSeekPrefetch();
 
 	static std::shared_ptr<CacheHelper> InitCacheHelper(
 		Storage::Cache::Key baseKey);
@@ -261,6 +274,9 @@ private:
 	bool _streamingActive = false;
 
 	// Streaming thread.
+	std::vector<Keyframe> _keyframes;
+	int _seekPrefetchFrom = 0;
+	int _seekPrefetchTill = 0;
 	std::deque<int> _offsetsForDownloader;
 	base::flat_set<int> _downloaderOffsetsRequested;
 	base::flat_map<int, std::optional<PartsMap>> _downloaderReadCache;
@@ -269,6 +285,7 @@ private:
 	// Streaming thread to main thread communicates using crl::on_main.
 	base::thread_safe_queue<int> _downloaderOffsetRequests;
 	base::thread_safe_queue<int> _downloaderOffsetAcks;
+	base::thread_safe_queue<crl::time> _seekPrefetchRequests;
 
 	rpl::lifetime _lifetime;
 
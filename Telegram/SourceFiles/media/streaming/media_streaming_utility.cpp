@@ -17,6 +17,26 @@ namespace {
 
 constexpr auto kSkipInvalidDataPackets = 10;
 
+void CopyFrameData(QImage &to, const QImage &from) {
+	Expects(to.size() == from.size());
+	Expects(to.format() == from.format());
+
+	const auto fromPerLine = from.bytesPerLine();
+	const auto toPerLine = to.bytesPerLine();
+	const auto lineSize = from.width() * FFmpeg::kPixelBytesSize;
+	auto fromBytes = from.constBits();
+	auto toBytes = to.bits();
+	if (fromPerLine == toPerLine) {
+		memcpy(toBytes, fromBytes, toPerLine * to.height());
+		return;
+	}
+	for (auto i = 0, height = from.height(); i != height; ++i) {
+		memcpy(toBytes, fromBytes, lineSize);
+		fromBytes += fromPerLine;
+		toBytes += toPerLine;
+	}
+}
+
 } // namespace
 
 crl::time FramePosition(const Stream &stream) {
@@ -286,9 +306,19 @@ QImage PrepareByRequest(
 		storage = FFmpeg::CreateFrameStorage(outer);
 	}
 
-	QPainter p(&storage);
-	PaintFrameContent(p, original, alpha, rotation, request);
-	p.end();
+	// The frame was already converted by swscale right to the requested
+	// size, so there is nothing to scale, just copy it before rounding.
+	const auto exact = !alpha
+		&& !rotation
+		&& (original.size() == outer)
+		&& (request.resize.isEmpty() || request.resize == outer)
+		&& (original.format() == storage.format());
+	if (exact) {
+		CopyFrameData(storage, original);
+	} else {
+		QPainter p(&storage);
+		PaintFrameContent(p, original, alpha, rotation, request);
+	}
 
 	ApplyFrameRounding(storage, request);
 	return storage;
@@ -16,7 +16,11 @@ namespace {
 
 constexpr auto kMaxFrameArea = 3840 * 2160; // usual 4K
 constexpr auto kDisplaySkipped = crl::time(-1);
+constexpr auto kLateFrameThreshold = crl::time(40);
 constexpr auto kFinishedPosition = std::numeric_limits<crl::time>::max();
+constexpr auto kStoragesPoolSize = 2;
+constexpr auto kFrameWorkSmoothing = 0.1;
+constexpr auto kFrameWorkDeviations = 2.;
 static_assert(kDisplaySkipped != kTimeUnknown);
 
 } // namespace
@@ -77,6 +81,10 @@ private:
 	[[nodiscard]] ReadEnoughState readEnoughFrames(crl::time trackTime);
 	[[nodiscard]] FrameResult readFrame(not_null<Frame*> frame);
 	void fillRequests(not_null<Frame*> frame) const;
+	void updateQueueDepth(
+		not_null<const AVFrame*> frame,
+		crl::time position,
+		crl::time work);
 	[[nodiscard]] QSize chooseOriginalResize() const;
 	void presentFrameIfNeeded();
 	void callReady();
@@ -116,6 +124,13 @@ private:
 	// For initial frame skipping for an exact seek.
 	FFmpeg::FramePointer _initialSkippingFrame;
 
+	// Queue depth follows the variance of decode and rasterize time.
+	crl::time _lastDecodedPosition = kTimeUnknown;
+	crl::time _lastRasterizeTime = 0;
+	float64 _frameDuration = 0.;
+	float64 _frameWork = 0.;
+	float64 _frameWorkVariance = 0.;
+
 };
 
 VideoTrackObject::VideoTrackObject(
@@ -293,6 +308,7 @@ crl::time VideoTrackObject::computeDuration() const {
 }
 
 auto VideoTrackObject::readFrame(not_null<Frame*> frame) -> FrameResult {
+	const auto started = crl::now();
 	if (const auto error = ReadNextFrame(_stream)) {
 		if (error.code() == AVERROR_EOF) {
 			if (!_options.loop) {
@@ -321,9 +337,54 @@ auto VideoTrackObject::readFrame(not_null<Frame*> frame) -> FrameResult {
 	std::swap(frame->decoded, _stream.frame);
 	frame->position = position;
 	frame->displayed = kTimeUnknown;
+	updateQueueDepth(frame->decoded.get(), position, crl::now() - started);
 	return FrameResult::Done;
 }
 
+void VideoTrackObject::updateQueueDepth(
+		not_null<const AVFrame*> frame,
+		crl::time position,
+		crl::time work) {
+	if (_lastDecodedPosition != kTimeUnknown
+		&& position > _lastDecodedPosition) {
+		const auto duration = float64(position - _lastDecodedPosition);
+		_frameDuration = _frameDuration
+			? (_frameDuration + kFrameWorkSmoothing
+				* (duration - _frameDuration))
+			: duration;
+	}
+	_lastDecodedPosition = position;
+
+	const auto delta = (work + _lastRasterizeTime) - _frameWork;
+	_frameWork += kFrameWorkSmoothing * delta;
+	_frameWorkVariance = (1. - kFrameWorkSmoothing)
+		* (_frameWorkVariance + kFrameWorkSmoothing * delta * delta);
+	if (!_frameDuration) {
+		return;
+	}
+
+	// Enough frames ahead to keep showing them while the slowest usual
+	// frame is being prepared, as long as they fit in the memory limit.
+	// Queued frames are counted by their rasterized size, it is larger.
+	const auto slowest = _frameWork
+		+ kFrameWorkDeviations * std::sqrt(_frameWorkVariance);
+	const auto interval = _frameDuration / _options.speed;
+	const auto wanted = int(std::ceil(slowest / interval)) + 1;
+	const auto frameBytes = int64(frame->width)
+		* frame->height
+		* FFmpeg::kPixelBytesSize;
+	const auto rasterized = 2 + kStoragesPoolSize;
+	const auto fits = frameBytes
+		? int(std::min(
+			_options.framesMemoryLimit / frameBytes - rasterized,
+			int64(Shared::kMaxQueueDepth)))
+		: Shared::kMaxQueueDepth;
+	_shared->setQueueDepth(std::clamp(
+		std::min(wanted, fits),
+		Shared::kMinQueueDepth,
+		Shared::kMaxQueueDepth));
+}
+
 void VideoTrackObject::fillRequests(not_null<Frame*> frame) const {
 	auto i = frame->prepared.begin();
 	for (const auto &[instance, request] : _requests) {
@@ -360,13 +421,16 @@ QSize VideoTrackObject::chooseOriginalResize() const {
 void VideoTrackObject::rasterizeFrame(not_null<Frame*> frame) {
 	Expects(frame->position != kFinishedPosition);
 
+	const auto started = crl::now();
 	fillRequests(frame);
 	frame->alpha = (frame->decoded->format == AV_PIX_FMT_BGRA);
 	frame->original = ConvertFrame(
 		_stream,
 		frame->decoded.get(),
 		chooseOriginalResize(),
-		std::move(frame->original));
+		(frame->original.isNull()
+			? _shared->takeStorage()
+			: std::move(frame->original)));
 	if (frame->original.isNull()) {
 		frame->prepared.clear();
 		fail(Error::InvalidData);
@@ -374,6 +438,7 @@ void VideoTrackObject::rasterizeFrame(not_null<Frame*> frame) {
 	}
 
 	VideoTrack::PrepareFrameByRequests(frame, _stream.rotation);
+	_lastRasterizeTime = crl::now() - started;
 
 	Ensures(VideoTrack::IsRasterized(frame));
 }
@@ -643,26 +708,89 @@ not_null<const VideoTrack::Frame*> VideoTrack::Shared::getFrame(
 	return &_frames[index];
 }
 
+void VideoTrack::Shared::setQueueDepth(int depth) {
+	Expects(depth >= kMinQueueDepth && depth <= kMaxQueueDepth);
+
+	_depth = depth;
+}
+
+QImage VideoTrack::Shared::takeStorage() {
+	for (auto i = _storages.size(); i != 0;) {
+		// The main thread may still hold some of the images.
+		if (_storages[--i].isDetached()) {
+			auto result = std::move(_storages[i]);
+			_storages.erase(_storages.begin() + i);
+			return result;
+		}
+	}
+	return QImage();
+}
+
+// Decoded frames go in order, the finished frame is the last one of them.
+int VideoTrack::Shared::decodedCount(int index, int limit) const {
+	for (auto i = 0; i != limit; ++i) {
+		const auto frame = getFrame((index + i) % kFramesCount);
+		if (!IsDecoded(frame)) {
+			return i;
+		} else if (frame->position == kFinishedPosition) {
+			return i + 1;
+		}
+	}
+	return limit;
+}
+
+void VideoTrack::Shared::releaseStorages(int index, int count) {
+	for (auto i = 0; i != count; ++i) {
+		const auto frame = getFrame((index + i) % kFramesCount);
+		if (!frame->original.isNull()) {
+			_storages.push_back(base::take(frame->original));
+		}
+	}
+	if (_storages.size() > size_t(kStoragesPoolSize)) {
+		_storages.erase(
+			_storages.begin(),
+			_storages.end() - kStoragesPoolSize);
+	}
+}
+
 auto VideoTrack::Shared::prepareState(
 	crl::time trackTime,
 	bool dropStaleFrames)
 -> PrepareState {
-	const auto prepareNext = [&](int index) -> PrepareState {
+	const auto prepareNext = [&](
+			int index,
+			int available,
+			int depth) -> PrepareState {
+		const auto count = decodedCount(index, available);
+		const auto finished = (count > 0)
+			&& (getFrame((index + count - 1) % kFramesCount)->position
+				== kFinishedPosition);
+
+		// Frames after the decoded ones won't be painted before decoding,
+		// their images go to the pool instead of being kept in the queue.
+		releaseStorages(index + count, available - count);
+		if (count < depth && !finished) {
+			return getFrame((index + count) % kFramesCount);
+		}
 		const auto frame = getFrame(index);
 		const auto next = getFrame((index + 1) % kFramesCount);
-		if (!IsDecoded(frame)) {
-			return frame;
-		} else if (!IsDecoded(next)) {
-			return next;
-		} else if (next->position < frame->position) {
+		if (count > 1 && next->position < frame->position) {
 			std::swap(*frame, *next);
 		}
-		if (next->position == kFinishedPosition || !dropStaleFrames) {
+		const auto ready = finished ? (count - 1) : count;
+		if (ready < 2 || !dropStaleFrames) {
 			return PrepareNextCheck(kTimeUnknown);
 		} else if (IsStale(frame, trackTime)) {
-			std::swap(*frame, *next);
-			next->displayed = kDisplaySkipped;
-			return next;
+			// Shift the queue, so that the stale frame is decoded again.
+			for (auto i = 1; i != ready; ++i) {
+				std::swap(
+					*getFrame((index + i - 1) % kFramesCount),
+					*getFrame((index + i) % kFramesCount));
+			}
+			const auto skipped = getFrame((index + ready - 1) % kFramesCount);
+			skipped->displayed = kDisplaySkipped;
+			_dropped.fetch_add(1, std::memory_order_relaxed);
+			return skipped;
 		} else {
 			return PrepareNextCheck(frame->position - trackTime + 1);
 		}
@@ -670,21 +798,25 @@ auto VideoTrack::Shared::prepareState(
 	const auto finishPrepare = [&](int index) -> PrepareState {
 		// If player already awaits next frame - we ignore if it's stale.
 		dropStaleFrames = false;
-		const auto result = prepareNext(index);
+		const auto result = prepareNext(
+			index,
+			kFramesCount - 1,
+			kMinQueueDepth);
 		return v::is<PrepareNextCheck>(result) ? PrepareState() : result;
 	};
 
-	switch (counter()) {
-	case 0: return finishPrepare(1);
-	case 1: return prepareNext(2);
-	case 2: return finishPrepare(2);
-	case 3: return prepareNext(3);
-	case 4: return finishPrepare(3);
-	case 5: return prepareNext(0);
-	case 6: return finishPrepare(0);
-	case 7: return prepareNext(1);
-	}
-	Unexpected("Counter value in VideoTrack::Shared::prepareState.");
+	const auto value = counter();
+	Assert(value >= 0 && value < 2 * kFramesCount);
+
+	// Even value: frame (value / 2) is painted, the next one is prepared.
+	// Odd value: the next one is presented, more frames are prepared.
+	const auto painted = value / 2;
+	return (value % 2)
+		? prepareNext(
+			(painted + 2) % kFramesCount,
+			kFramesCount - 2,
+			_depth)
+		: finishPrepare((painted + 1) % kFramesCount);
 }
 
 // Sometimes main thread subscribes to check frame requests before
@@ -731,10 +863,15 @@ auto VideoTrack::Shared::presentFrame(
 		if (frame->position == kFinishedPosition) {
 			return { kFinishedPosition, kTimeUnknown };
 		}
-		const auto next = getFrame((index + 1) % kFramesCount);
-		if (!IsDecoded(frame) || !IsDecoded(next)) {
+		const auto count = decodedCount(index, _depth);
+		const auto finished = (count > 0)
+			&& (getFrame((index + count - 1) % kFramesCount)->position
+				== kFinishedPosition);
+		if (count < _depth && !finished) {
 			return { kTimeUnknown, crl::time(0) };
-		} else if (next->position == kFinishedPosition
+		}
+		const auto next = getFrame((index + 1) % kFramesCount);
+		if (next->position == kFinishedPosition
 			|| !dropStaleFrames
 			|| IsStale(frame, time.trackTime)) {
 			return { kTimeUnknown, kTimeUnknown };
@@ -742,128 +879,87 @@ auto VideoTrack::Shared::presentFrame(
 		return { kTimeUnknown, (frame->position - time.trackTime + 1) };
 	};
 
-	switch (counter()) {
-	case 0: return present(0, 1);
-	case 1: return nextCheckDelay(2);
-	case 2: return present(2, 2);
-	case 3: return nextCheckDelay(3);
-	case 4: return present(4, 3);
-	case 5: return nextCheckDelay(0);
-	case 6: return present(6, 0);
-	case 7: return nextCheckDelay(1);
-	}
-	Unexpected("Counter value in VideoTrack::Shared::prepareState.");
+	const auto value = counter();
+	Assert(value >= 0 && value < 2 * kFramesCount);
+
+	const auto painted = value / 2;
+	return (value % 2)
+		? nextCheckDelay((painted + 2) % kFramesCount)
+		: present(value, (painted + 1) % kFramesCount);
 }
 
 crl::time VideoTrack::Shared::nextFrameDisplayTime() const {
-	const auto frameDisplayTime = [&](int counter) {
-		const auto next = (counter + 1) % (2 * kFramesCount);
-		const auto index = next / 2;
-		const auto frame = getFrame(index);
-		if (frame->displayed != kTimeUnknown) {
-			// Frame already displayed, but not yet shown.
-			return kFrameDisplayTimeAlreadyDone;
-		}
-		Assert(IsRasterized(frame));
-		Assert(frame->display != kTimeUnknown);
+	const auto value = counter();
+	Assert(value >= 0 && value < 2 * kFramesCount);
 
-		return frame->display;
-	};
-
-	switch (counter()) {
-	case 0: return kTimeUnknown;
-	case 1: return frameDisplayTime(1);
-	case 2: return kTimeUnknown;
-	case 3: return frameDisplayTime(3);
-	case 4: return kTimeUnknown;
-	case 5: return frameDisplayTime(5);
-	case 6: return kTimeUnknown;
-	case 7: return frameDisplayTime(7);
+	if (!(value % 2)) {
+		return kTimeUnknown;
+	}
+	const auto next = (value + 1) % (2 * kFramesCount);
+	const auto index = next / 2;
+	const auto frame = getFrame(index);
+	if (frame->displayed != kTimeUnknown) {
+		// Frame already displayed, but not yet shown.
+		return kFrameDisplayTimeAlreadyDone;
 	}
-	Unexpected("Counter value in VideoTrack::Shared::nextFrameDisplayTime.");
+	Assert(IsRasterized(frame));
+	Assert(frame->display != kTimeUnknown);
+
+	return frame->display;
 }
 
 crl::time VideoTrack::Shared::markFrameDisplayed(crl::time now) {
-	const auto mark = [&](int counter) {
-		const auto next = (counter + 1) % (2 * kFramesCount);
-		const auto index = next / 2;
-		const auto frame = getFrame(index);
-		Assert(frame->position != kTimeUnknown);
-		if (frame->displayed == kTimeUnknown) {
-			frame->displayed = now;
-		}
-		return frame->position;
-	};
+	const auto value = counter();
+	Assert(value >= 0 && value < 2 * kFramesCount);
 
-	switch (counter()) {
-	case 0: Unexpected("Value 0 in VideoTrack::Shared::markFrameDisplayed.");
-	case 1: return mark(1);
-	case 2: Unexpected("Value 2 in VideoTrack::Shared::markFrameDisplayed.");
-	case 3: return mark(3);
-	case 4: Unexpected("Value 4 in VideoTrack::Shared::markFrameDisplayed.");
-	case 5: return mark(5);
-	case 6: Unexpected("Value 6 in VideoTrack::Shared::markFrameDisplayed.");
-	case 7: return mark(7);
+	if (!(value % 2)) {
+		Unexpected("Even counter in VideoTrack::Shared::markFrameDisplayed.");
 	}
-	Unexpected("Counter value in VideoTrack::Shared::markFrameDisplayed.");
+	const auto next = (value + 1) % (2 * kFramesCount);
+	const auto index = next / 2;
+	const auto frame = getFrame(index);
+	Assert(frame->position != kTimeUnknown);
+	if (frame->displayed == kTimeUnknown) {
+		frame->displayed = now;
+		++_shown;
+		if (frame->display != kTimeUnknown
+			&& now - frame->display > kLateFrameThreshold) {
+			++_late;
+		}
+	}
+	return frame->position;
 }
 
 void VideoTrack::Shared::addTimelineDelay(crl::time delayed) {
 	if (!delayed) {
 		return;
 	}
-	const auto recountCurrentFrame = [&](int counter) {
-		_delay += delayed;
-		//const auto next = (counter + 1) % (2 * kFramesCount);
-		//const auto index = next / 2;
-		//const auto frame = getFrame(index);
-		//if (frame->displayed != kTimeUnknown) {
-		//	// Frame already displayed.
-		//	return;
-		//}
-		//Assert(IsRasterized(frame));
-		//Assert(frame->display != kTimeUnknown);
-		//frame->display = countFrameDisplayTime(frame->index);
-	};
+	const auto value = counter();
+	Assert(value >= 0 && value < 2 * kFramesCount);
 
-	switch (counter()) {
-	case 0: Unexpected("Value 0 in VideoTrack::Shared::addTimelineDelay.");
-	case 1: return recountCurrentFrame(1);
-	case 2: Unexpected("Value 2 in VideoTrack::Shared::addTimelineDelay.");
-	case 3: return recountCurrentFrame(3);
-	case 4: Unexpected("Value 4 in VideoTrack::Shared::addTimelineDelay.");
-	case 5: return recountCurrentFrame(5);
-	case 6: Unexpected("Value 6 in VideoTrack::Shared::addTimelineDelay.");
-	case 7: return recountCurrentFrame(7);
+	if (!(value % 2)) {
+		Unexpected("Even counter in VideoTrack::Shared::addTimelineDelay.");
 	}
-	Unexpected("Counter value in VideoTrack::Shared::addTimelineDelay.");
+	_delay += delayed;
 }
 
 bool VideoTrack::Shared::markFrameShown() {
-	const auto jump = [&](int counter) {
-		const auto next = (counter + 1) % (2 * kFramesCount);
-		const auto index = next / 2;
-		const auto frame = getFrame(index);
-		if (frame->displayed == kTimeUnknown) {
-			return false;
-		}
-		_counter.store(
-			next,
-			std::memory_order_release);
-		return true;
-	};
+	const auto value = counter();
+	Assert(value >= 0 && value < 2 * kFramesCount);
 
-	switch (counter()) {
-	case 0: return false;
-	case 1: return jump(1);
-	case 2: return false;
-	case 3: return jump(3);
-	case 4: return false;
-	case 5: return jump(5);
-	case 6: return false;
-	case 7: return jump(7);
+	if (!(value % 2)) {
+		return false;
+	}
+	const auto next = (value + 1) % (2 * kFramesCount);
+	const auto index = next / 2;
+	const auto frame = getFrame(index);
+	if (frame->displayed == kTimeUnknown) {
+		return false;
 	}
-	Unexpected("Counter value in VideoTrack::Shared::markFrameShown.");
+	_counter.store(
+		next,
+		std::memory_order_release);
+	return true;
 }
 
 not_null<VideoTrack::Frame*> VideoTrack::Shared::frameForPaint() {
@@ -875,6 +971,14 @@ not_null<VideoTrack::Frame*> VideoTrack::Shared::frameForPaint() {
 	return result;
 }
 
+FrameStats VideoTrack::Shared::frameStats() const {
+	return {
+		.shown = _shown,
+		.dropped = _dropped.load(std::memory_order_relaxed),
+		.late = _late,
+	};
+}
+
 VideoTrack::VideoTrack(
 	const PlaybackOptions &options,
 	Stream &&stream,
@@ -1084,6 +1188,10 @@ rpl::producer<> VideoTrack::waitingForData() const {
 	});
 }
 
+FrameStats VideoTrack::frameStats() const {
+	return _shared->frameStats();
+}
+
 VideoTrack::~VideoTrack() {
 	_wrapped.with([shared = std::move(_shared)](Implementation &unwrapped) {
 		unwrapped.interrupt();
@@ -55,6 +55,7 @@ public:
 	void addTimelineDelay(crl::time delayed);
 	bool markFrameShown();
 	[[nodiscard]] crl::time nextFrameDisplayTime() const;
+	[[nodiscard]] FrameStats frameStats() const;
 	[[nodiscard]] QImage frame(
 		const FrameRequest &request,
 		const Instance *instance);
@@ -101,9 +102,15 @@ private:
 			crl::time addedWorldTimeDelay = 0;
 		};
 
+		// Frames decoded ahead of the presented one.
+		static constexpr auto kMinQueueDepth = 2;
+		static constexpr auto kMaxQueueDepth = 10;
+
 		// Called from the wrapped object queue.
 		void init(QImage &&cover, crl::time position);
 		[[nodiscard]] bool initialized() const;
+		void setQueueDepth(int depth);
+		[[nodiscard]] QImage takeStorage();
 
 		[[nodiscard]] PrepareState prepareState(
 			crl::time trackTime,
@@ -123,22 +130,37 @@ private:
 		bool markFrameShown();
 		[[nodiscard]] crl::time nextFrameDisplayTime() const;
 		[[nodiscard]] not_null<Frame*> frameForPaint();
+		[[nodiscard]] FrameStats frameStats() const;
 
 	private:
 		[[nodiscard]] not_null<Frame*> getFrame(int index);
 		[[nodiscard]] not_null<const Frame*> getFrame(int index) const;
 		[[nodiscard]] int counter() const;
+		[[nodiscard]] int decodedCount(int index, int limit) const;
+		void releaseStorages(int index, int count);
 
 		static constexpr auto kCounterUninitialized = -1;
 		std::atomic<int> _counter = kCounterUninitialized;
 
-		static constexpr auto kFramesCount = 4;
+		// One frame is painted and one is presented to the main thread.
+		static constexpr auto kFramesCount = kMaxQueueDepth + 2;
 		std::array<Frame, kFramesCount> _frames;
 
+		// crl::queue only.
+		int _depth = kMinQueueDepth;
+		std::vector<QImage> _storages;
+
 		// (_counter % 2) == 1 main thread can write _delay.
 		// (_counter % 2) == 0 crl::queue can read _delay.
 		crl::time _delay = kTimeUnknown;
 
+		// Written by crl::queue, read by the main thread.
+		std::atomic<int> _dropped = 0;
+
+		// Main thread.
+		int _shown = 0;
+		int _late = 0;
+
 	};
 
 	static void PrepareFrameByRequests(not_null<Frame*> frame, int rotation);
@@ -598,6 +598,17 @@ void OverlayWidget::clearStreaming(bool savePosition) {
 			_document,
 			_streamed->instance.player().prepareLegacyState());
 	}
+	if (_streamed && _document) {
+		const auto stats = _streamed->instance.player().videoFrameStats();
+		if (stats.dropped || stats.late) {
+			DEBUG_LOG(("Streaming Info: Document %1 video frames shown %2, "
+				"dropped %3, late %4."
+				).arg(_document->id
+				).arg(stats.shown
+				).arg(stats.dropped
+				).arg(stats.late));
+		}
+	}
 	_fullScreenVideo = false;
 	_streamed = nullptr;
 }
@@ -2921,6 +2932,7 @@ void OverlayWidget::playbackControlsSeekProgress(crl::time position) {
 		_streamed->pausedBySeek = true;
 		playbackControlsPause();
 	}
+	_streamed->instance.player().prefetchForSeek(position);
 }
 
 void OverlayWidget::playbackControlsSeekFinished(crl::time position) {
@@ -1080,6 +1080,7 @@ void Pip::seekProgress(float64 value) {
 			_pausedBySeek = true;
 			playbackPauseResume();
 		}
+		_instance.player().prefetchForSeek(_seekPositionMs);
 		updatePlaybackTexts(_seekPositionMs, _lastDurationMs, kMsInSecond);
 	}
 }
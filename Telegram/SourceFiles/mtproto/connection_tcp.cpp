@@ -8,13 +8,12 @@ https://github.com/telegramdesktop/tdesktop/blob/master/LEGAL
 #include "mtproto/connection_tcp.h"
 
 #include "mtproto/details/mtproto_abstract_socket.h"
+#include "mtproto/details/mtproto_network_conditions.h"
 #include "base/bytes.h"
 #include "base/openssl_help.h"
 #include "base/qthelp_url.h"
 
-extern "C" {
-#include <openssl/aes.h>
-} // extern "C"
+#include <QtCore/QMutex>
 
 namespace MTP {
 namespace details {
@@ -25,6 +24,124 @@ constexpr auto kFullConnectionTimeout = 8 * crl::time(1000);
 constexpr auto kSmallBufferSize = 256 * 1024;
 constexpr auto kMinPacketBuffer = 256;
 constexpr auto kConnectionStartPrefixSize = 64;
+constexpr auto kLargeBufferStep = 128 * 1024;
+constexpr auto kLargeBufferBuckets = 32;
+constexpr auto kLargeBufferPercentile = 90;
+constexpr auto kMaxPooledLargeBuffers = 8;
+constexpr auto kLargeBufferSizesDecay = 1024;
+constexpr auto kLogLargeBuffersEach = 256;
+
+// Large read buffers are needed for every file part, so instead of
+// allocating (and zero-filling) a fresh one for each packet we keep a
+// few released buffers, sized by the observed large packets distribution.
+class LargeBuffersPool final {
+public:
+	[[nodiscard]] bytes::vector acquire(int amount);
+	void release(bytes::vector &&buffer);
+
+private:
+	[[nodiscard]] int recommendedSize(int amount) const;
+
+	QMutex _mutex;
+	std::vector<bytes::vector> _buffers;
+	std::array<uint32, kLargeBufferBuckets> _sizes = { { 0 } };
+	uint32 _sizesCount = 0;
+	uint64 _hits = 0;
+	uint64 _misses = 0;
+
+};
+
+bytes::vector LargeBuffersPool::acquire(int amount) {
+	QMutexLocker lock(&_mutex);
+	const auto bucket = std::min(
+		(amount - 1) / kLargeBufferStep,
+		kLargeBufferBuckets - 1);
+	++_sizes[bucket];
+	if (++_sizesCount >= kLargeBufferSizesDecay) {
+		// Let the distribution follow the recent traffic.
+		_sizesCount = 0;
+		for (auto &count : _sizes) {
+			count /= 2;
+			_sizesCount += count;
+		}
+	}
+
+	const auto logStats = [&] {
+		if (!((_hits + _misses) % kLogLargeBuffersEach)) {
+			DEBUG_LOG(("TCP Info: large buffers pool hits %1, misses %2, "
+				"pooled %3, recommended size %4"
+				).arg(_hits
+				).arg(_misses
+				).arg(_buffers.size()
+				).arg(recommendedSize(0)));
+		}
+	};
+
+	// Take the smallest pooled buffer that fits.
+	auto best = end(_buffers);
+	for (auto i = begin(_buffers); i != end(_buffers); ++i) {
+		if (i->size() >= amount
+			&& (best == end(_buffers) || i->size() < best->size())) {
+			best = i;
+		}
+	}
+	if (best != end(_buffers)) {
+		auto result = std::move(*best);
+		_buffers.erase(best);
+		++_hits;
+		logStats();
+		return result;
+	}
+	++_misses;
+	logStats();
+	const auto size = recommendedSize(amount);
+	lock.unlock();
+
+	return bytes::vector(size);
+}
+
+void LargeBuffersPool::release(bytes::vector &&buffer) {
+	if (buffer.empty()) {
+		return;
+	}
+	QMutexLocker lock(&_mutex);
+	if (buffer.size() > kLargeBufferStep * kLargeBufferBuckets) {
+		return;
+	} else if (_buffers.size() < kMaxPooledLargeBuffers) {
+		_buffers.push_back(std::move(buffer));
+		return;
+	}
+	// Replace the smallest pooled buffer if this one is larger.
+	const auto smallest = ranges::min_element(
+		_buffers,
+		ranges::less(),
+		[](const bytes::vector &buffer) { return buffer.size(); });
+	if (smallest->size() < buffer.size()) {
+		*smallest = std::move(buffer);
+	}
+}
+
+int LargeBuffersPool::recommendedSize(int amount) const {
+	auto result = kSmallBufferSize + kLargeBufferStep;
+	if (_sizesCount > 0) {
+		const auto threshold = (uint64(_sizesCount) * kLargeBufferPercentile
+			+ 99) / 100;
+		auto accumulated = uint64(0);
+		for (auto i = 0; i != kLargeBufferBuckets; ++i) {
+			accumulated += _sizes[i];
+			if (accumulated >= threshold) {
+				result = (i + 1) * kLargeBufferStep;
+				break;
+			}
+		}
+	}
+	return std::max(result, amount);
+}
+
+LargeBuffersPool &LargeBuffers() {
+	static auto result = LargeBuffersPool();
+	return result;
+}
 
 } // namespace
 
@@ -244,7 +361,8 @@ TcpConnection::TcpConnection(
 	const ProxyData &proxy)
 : AbstractConnection(thread, proxy)
 , _instance(instance)
-, _checkNonce(openssl::RandomValue<MTPint128>()) {
+, _checkNonce(openssl::RandomValue<MTPint128>())
+, _delayedTimer([=] { deliverDelayedPackets(); }) {
 }
 
 ConnectionPointer TcpConnection::clone(const ProxyData &proxy) {
@@ -263,7 +381,7 @@ void TcpConnection::ensureAvailableInBuffer(int amount) {
 		if (_usingLargeBuffer) {
 			bytes::copy(_smallBuffer, read);
 			_usingLargeBuffer = false;
-			_largeBuffer.clear();
+			LargeBuffers().release(base::take(_largeBuffer));
 		} else {
 			bytes::move(_smallBuffer, read);
 		}
@@ -271,9 +389,10 @@ void TcpConnection::ensureAvailableInBuffer(int amount) {
 		Assert(_usingLargeBuffer);
 		bytes::move(_largeBuffer, read);
 	} else {
-		auto enough = bytes::vector(amount);
+		auto enough = LargeBuffers().acquire(amount);
 		bytes::copy(enough, read);
-		_largeBuffer = std::move(enough);
+		LargeBuffers().release(
+			std::exchange(_largeBuffer, std::move(enough)));
 		_usingLargeBuffer = true;
 	}
 	_offsetBytes = 0;
@@ -303,7 +422,7 @@ void TcpConnection::socketRead() {
 		const auto readCount = _socket->read(free.subspan(0, readLimit));
 		if (readCount > 0) {
 			const auto read = free.subspan(0, readCount);
-			aesCtrEncrypt(read, _receiveKey, &_receiveState);
+			_receiveCipher.apply(read);
 			TCP_LOG(("TCP Info: read %1 bytes").arg(readCount));
 
 			_readBytes += readCount;
@@ -317,7 +436,7 @@ void TcpConnection::socketRead() {
 					}
 
 					_usingLargeBuffer = false;
-					_largeBuffer.clear();
+					LargeBuffers().release(base::take(_largeBuffer));
 					_offsetBytes = _readBytes = 0;
 				} else {
 					TCP_LOG(("TCP Info: not enough %1 for packet! read %2"
@@ -444,7 +563,7 @@ void TcpConnection::sendData(mtpBuffer &&buffer) {
 	// buffer: 2 available int-s + data + available int.
 	const auto bytes = _protocol->finalizePacket(buffer);
 	TCP_LOG(("TCP Info: write packet %1 bytes").arg(bytes.size()));
-	aesCtrEncrypt(bytes, _sendKey, &_sendState);
+	_sendCipher.apply(bytes);
 	_socket->write(connectionStartPrefix, bytes);
 }
 
@@ -466,11 +585,10 @@ bytes::const_span TcpConnection::prepareConnectionStartPrefix(
 	} while (!_socket->isGoodStartNonce(nonce));
 
 	// prepare encryption key/iv
-	_protocol->prepareKey(
-		bytes::make_span(_sendKey),
-		nonce.subspan(8, CTRState::KeySize));
-	bytes::copy(
-		bytes::make_span(_sendState.ivec),
+	auto key = bytes::array<CTRState::KeySize>();
+	_protocol->prepareKey(key, nonce.subspan(8, CTRState::KeySize));
+	_sendCipher.init(
+		key,
 		nonce.subspan(8 + CTRState::KeySize, CTRState::IvecSize));
 
 	// prepare decryption key/iv
@@ -478,11 +596,9 @@ bytes::const_span TcpConnection::prepareConnectionStartPrefix(
 	const auto reversed = bytes::make_span(reversedBytes);
 	bytes::copy(reversed, nonce.subspan(8, reversed.size()));
 	std::reverse(reversed.begin(), reversed.end());
-	_protocol->prepareKey(
-		bytes::make_span(_receiveKey),
-		reversed.subspan(0, CTRState::KeySize));
-	bytes::copy(
-		bytes::make_span(_receiveState.ivec),
+	_protocol->prepareKey(key, reversed.subspan(0, CTRState::KeySize));
+	_receiveCipher.init(
+		key,
 		reversed.subspan(CTRState::KeySize, CTRState::IvecSize));
 
 	// write protocol and dc ids
@@ -492,7 +608,7 @@ bytes::const_span TcpConnection::prepareConnectionStartPrefix(
 	*dcId = _protocolDcId;
 
 	bytes::copy(buffer, nonce.subspan(0, 56));
-	aesCtrEncrypt(nonce, _sendKey, &_sendState);
+	_sendCipher.apply(nonce);
 	bytes::copy(buffer.subspan(56), nonce.subspan(56));
 
 	return buffer;
@@ -506,6 +622,8 @@ void TcpConnection::disconnectFromServer() {
 	_connectedLifetime.destroy();
 	_lifetime.destroy();
 	_socket = nullptr;
+	_delayedTimer.cancel();
+	_delayedPackets.clear();
 }
 
 void TcpConnection::connectToServer(
@@ -545,6 +663,10 @@ void TcpConnection::connectToServer(
 		secret,
 		ToNetworkProxy(_proxy));
 	_protocolDcId = protocolDcId;
+	if (const auto conditions = CurrentNetworkConditions()
+		; !conditions.empty()) {
+		_conditioner = std::make_unique<NetworkConditioner>(conditions);
+	}
 
 	_socket->connected(
 	) | rpl::start_with_next([=] {
@@ -582,11 +704,50 @@ crl::time TcpConnection::fullConnectTimeout() const {
 	return kFullConnectionTimeout;
 }
 
+void TcpConnection::receivedPacket(mtpBuffer &&data) {
+	if (!_conditioner) {
+		// Move, so that the packet can be decrypted in place.
+		_receivedQueue.push_back(std::move(data));
+		emit receivedData();
+		return;
+	}
+	const auto now = crl::now();
+	const auto size = int(data.size() * sizeof(mtpPrime));
+	const auto deliverAt = _conditioner->deliverAt(size, now);
+
+	// Keep the packets order, so delivery times never decrease.
+	const auto when = _delayedPackets.empty()
+		? deliverAt
+		: std::max(deliverAt, _delayedPackets.back().first);
+	_delayedPackets.emplace_back(when, std::move(data));
+	if (!_delayedTimer.isActive()) {
+		_delayedTimer.callOnce(
+			std::max(_delayedPackets.front().first - now, crl::time(0)));
+	}
+}
+
+void TcpConnection::deliverDelayedPackets() {
+	const auto now = crl::now();
+	auto delivered = false;
+	while (!_delayedPackets.empty()
+		&& _delayedPackets.front().first <= now) {
+		_receivedQueue.push_back(std::move(_delayedPackets.front().second));
+		_delayedPackets.pop_front();
+		delivered = true;
+	}
+	if (!_delayedPackets.empty()) {
+		_delayedTimer.callOnce(_delayedPackets.front().first - now);
+	}
+	if (delivered) {
+		emit receivedData();
+	}
+}
+
 void TcpConnection::socketPacket(bytes::const_span bytes) {
 	Expects(_socket != nullptr);
 
 	// old quickack?..
-	const auto data = parsePacket(bytes);
+	auto data = parsePacket(bytes);
 	if (data.size() == 1) {
 		if (data[0] != 0) {
 			emit error(data[0]);
@@ -596,8 +757,7 @@ void TcpConnection::socketPacket(bytes::const_span bytes) {
 	//} else if (data.size() == 2) {
 		// new quickack?..
 	} else if (_status == Status::Ready) {
-		_receivedQueue.push_back(data);
-		emit receivedData();
+		receivedPacket(std::move(data));
 	} else if (_status == Status::Waiting) {
 		if (const auto res_pq = readPQFakeReply(data)) {
 			const auto &data = res_pq->c_resPQ();
@@ -663,7 +823,9 @@ void TcpConnection::socketError() {
 	emit error(kErrorCodeOther);
 }
 
-TcpConnection::~TcpConnection() = default;
+TcpConnection::~TcpConnection() {
+	LargeBuffers().release(base::take(_largeBuffer));
+}
 
 } // namespace details
 } // namespace MTP
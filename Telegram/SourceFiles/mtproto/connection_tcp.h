@@ -9,11 +9,13 @@ https://github.com/telegramdesktop/tdesktop/blob/master/LEGAL
 
 #include "mtproto/connection_abstract.h"
 #include "mtproto/mtproto_auth_key.h"
+#include "base/timer.h"
 
 namespace MTP {
 namespace details {
 
 class AbstractSocket;
+class NetworkConditioner;
 
 class TcpConnection : public AbstractConnection {
 public:
@@ -55,6 +57,8 @@ private:
 	bytes::const_span prepareConnectionStartPrefix(bytes::span buffer);
 
 	void socketPacket(bytes::const_span bytes);
+	void receivedPacket(mtpBuffer &&data);
+	void deliverDelayedPackets();
 
 	void socketConnected();
 	void socketDisconnected();
@@ -78,10 +82,8 @@ private:
 	bytes::vector _largeBuffer;
 	bool _usingLargeBuffer = false;
 
-	uchar _sendKey[CTRState::KeySize];
-	CTRState _sendState;
-	uchar _receiveKey[CTRState::KeySize];
-	CTRState _receiveState;
+	AesCtrCipher _sendCipher;
+	AesCtrCipher _receiveCipher;
 	class Protocol;
 	std::unique_ptr<Protocol> _protocol;
 	int16 _protocolDcId = 0;
@@ -93,6 +95,10 @@ private:
 	int32 _port = 0;
 	crl::time _pingTime = 0;
 
+	std::unique_ptr<NetworkConditioner> _conditioner;
+	std::deque<std::pair<crl::time, mtpBuffer>> _delayedPackets;
+	base::Timer _delayedTimer;
+
 	rpl::lifetime _connectedLifetime;
 	rpl::lifetime _lifetime;
 
@@ -65,10 +65,11 @@ SerializedRequest BoundKeyCreator::prepareBindRequest(
 }
 
 DcKeyBindState BoundKeyCreator::handleBindResponse(
-		const mtpBuffer &response) {
+		const mtpPrime *from,
+		const mtpPrime *end) {
 	Expects(_binder.has_value());
 
-	return _binder->handleResponse(response);
+	return _binder->handleResponse(from, end);
 }
 
 AuthKeyPtr BoundKeyCreator::bindPersistentKey() const {
@@ -77,11 +78,11 @@ AuthKeyPtr BoundKeyCreator::bindPersistentKey() const {
 	return _binder->persistentKey();
 }
 
-bool IsDestroyedTemporaryKeyError(const mtpBuffer &buffer) {
-	auto from = buffer.data();
-	const auto end = from + buffer.size();
+bool IsDestroyedTemporaryKeyError(
+		const mtpPrime *from,
+		const mtpPrime *end) {
 	auto error = MTPRpcError();
-	if (!error.read(from, from + buffer.size())) {
+	if (!error.read(from, end)) {
 		return false;
 	}
 	return error.match([&](const MTPDrpc_error &data) {
@@ -38,7 +38,8 @@ public:
 		const AuthKeyPtr &temporaryKey,
 		uint64 sessionId);
 	[[nodiscard]] DcKeyBindState handleBindResponse(
-		const mtpBuffer &response);
+		const mtpPrime *from,
+		const mtpPrime *end);
 	[[nodiscard]] AuthKeyPtr bindPersistentKey() const;
 
 private:
@@ -51,6 +52,8 @@ private:
 };
 
 
-[[nodiscard]] bool IsDestroyedTemporaryKeyError(const mtpBuffer &buffer);
+[[nodiscard]] bool IsDestroyedTemporaryKeyError(
+	const mtpPrime *from,
+	const mtpPrime *end);
 
 } // namespace MTP::details
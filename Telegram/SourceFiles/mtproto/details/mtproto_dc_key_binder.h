@@ -31,7 +31,9 @@ public:
 	[[nodiscard]] SerializedRequest prepareRequest(
 		const AuthKeyPtr &temporaryKey,
 		uint64 sessionId);
-	[[nodiscard]] DcKeyBindState handleResponse(const mtpBuffer &response);
+	[[nodiscard]] DcKeyBindState handleResponse(
+		const mtpPrime *from,
+		const mtpPrime *end);
 	[[nodiscard]] AuthKeyPtr persistentKey() const;
 
 private:
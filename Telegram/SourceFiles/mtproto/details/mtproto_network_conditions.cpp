@@ -0,0 +1,93 @@
+/*
+This file is part of Telegram Desktop,
+the official desktop application for the Telegram messaging service.
+
+For license and copyright information please follow this link:
+https://github.com/telegramdesktop/tdesktop/blob/master/LEGAL
+*/
+#include "mtproto/details/mtproto_network_conditions.h"
+
+#include "base/qt_adapters.h"
+
+#include <QtCore/QMutex>
+#include <QtCore/QFile>
+
+namespace MTP::details {
+namespace {
+
+constexpr auto kMaxLatency = 60 * crl::time(1000);
+
+QMutex ConditionsMutex;
+NetworkConditions Conditions;
+
+} // namespace
+
+void SetNetworkConditions(const NetworkConditions &conditions) {
+	QMutexLocker lock(&ConditionsMutex);
+	Conditions = conditions;
+}
+
+NetworkConditions CurrentNetworkConditions() {
+	QMutexLocker lock(&ConditionsMutex);
+	return Conditions;
+}
+
+bool LoadNetworkConditions(const QString &path) {
+	QFile f(path);
+	if (!f.open(QIODevice::ReadOnly)) {
+		LOG(("MTP Error: could not read '%1'").arg(path));
+		return false;
+	}
+	auto result = NetworkConditions();
+	const auto lines = QString::fromUtf8(f.readAll()).split('\n');
+	for (const auto &line : lines) {
+		const auto trimmed = line.trimmed();
+		if (trimmed.isEmpty() || trimmed.startsWith('#')) {
+			continue;
+		}
+		const auto parts = trimmed.split(' ', base::QStringSkipEmptyParts);
+		auto ok = (parts.size() == 2);
+		const auto value = ok ? parts[1].toLongLong(&ok) : 0LL;
+		if (!ok || value < 0) {
+			LOG(("MTP Error: in .tdesktop-network expected "
+				"'latency|bandwidth value', got '%1'").arg(line));
+			return false;
+		}
+		const auto &key = parts[0];
+		if (key == qstr("latency")) {
+			result.latency = std::min(crl::time(value), kMaxLatency);
+		} else if (key == qstr("bandwidth")) {
+			result.bandwidth = value;
+		} else {
+			LOG(("MTP Error: unknown key in .tdesktop-network: '%1'"
+				).arg(key));
+			return false;
+		}
+	}
+	LOG(("MTP Info: network conditions, latency %1, bandwidth %2."
+		).arg(result.latency
+		).arg(result.bandwidth));
+	SetNetworkConditions(result);
+	return true;
+}
+
+NetworkConditioner::NetworkConditioner(const NetworkConditions &conditions)
+: _conditions(conditions) {
+}
+
+bool NetworkConditioner::empty() const {
+	return _conditions.empty();
+}
+
+crl::time NetworkConditioner::deliverAt(int size, crl::time now) {
+	auto result = now + _conditions.latency;
+	if (_conditions.bandwidth > 0) {
+		// Packets share the link, each one waits for the previous one.
+		_busyTill = std::max(_busyTill, now)
+			+ int64(size) * 1000 / _conditions.bandwidth;
+		accumulate_max(result, _busyTill + _conditions.latency);
+	}
+	return result;
+}
+
+} // namespace MTP::details
@@ -0,0 +1,47 @@
+/*
+This file is part of Telegram Desktop,
+the official desktop application for the Telegram messaging service.
+
+For license and copyright information please follow this link:
+https://github.com/telegramdesktop/tdesktop/blob/master/LEGAL
+*/
+#pragma once
+
+namespace MTP::details {
+
+// Debug-only delays applied to the packets received by TCP connections.
+// Packets are never dropped: TCP itself never loses them, so a dropped
+// packet would only break the MTProto stream of the connection.
+struct NetworkConditions {
+	crl::time latency = 0; // Added to every received packet.
+	int64 bandwidth = 0; // Received bytes per second, zero for no limit.
+
+	[[nodiscard]] bool empty() const {
+		return !latency && !bandwidth;
+	}
+};
+
+// May be called from any thread, applied to the new connections.
+void SetNetworkConditions(const NetworkConditions &conditions);
+[[nodiscard]] NetworkConditions CurrentNetworkConditions();
+
+// Reads "latency <ms>" and "bandwidth <bytes per second>" lines,
+// an empty file clears the conditions.
+[[nodiscard]] bool LoadNetworkConditions(const QString &path);
+
+// Decides when each received packet is delivered.
+class NetworkConditioner final {
+public:
+	explicit NetworkConditioner(const NetworkConditions &conditions);
+
+	[[nodiscard]] bool empty() const;
+
+	[[nodiscard]] crl::time deliverAt(int size, crl::time now);
+
+private:
+	const NetworkConditions _conditions;
+	crl::time _busyTill = 0;
+
+};
+
+} // namespace MTP::details
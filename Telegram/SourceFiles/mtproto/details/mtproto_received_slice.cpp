@@ -0,0 +1,51 @@
+/*
+This file is part of Telegram Desktop,
+the official desktop application for the Telegram messaging service.
+
+For license and copyright information please follow this link:
+https://github.com/telegramdesktop/tdesktop/blob/master/LEGAL
+*/
+#include "mtproto/details/mtproto_received_slice.h"
+
+namespace MTP::details {
+
+ReceivedSlice::ReceivedSlice(mtpBuffer &&buffer)
+: _buffer(std::move(buffer))
+, _size(_buffer.size()) {
+}
+
+ReceivedSlice::ReceivedSlice(
+	const mtpBuffer &buffer,
+	const mtpPrime *from,
+	const mtpPrime *till)
+: _buffer(buffer)
+, _offset(from - buffer.constData())
+, _size(till - from) {
+	Expects(from >= buffer.constData());
+	Expects(till >= from);
+	Expects(till <= buffer.constData() + buffer.size());
+}
+
+const mtpPrime *ReceivedSlice::from() const {
+	return _buffer.constData() + _offset;
+}
+
+const mtpPrime *ReceivedSlice::till() const {
+	return from() + _size;
+}
+
+int ReceivedSlice::size() const {
+	return _size;
+}
+
+bool ReceivedSlice::empty() const {
+	return !_size;
+}
+
+mtpPrime ReceivedSlice::operator[](int index) const {
+	Expects(index >= 0 && index < _size);
+
+	return from()[index];
+}
+
+} // namespace MTP::details
@@ -0,0 +1,39 @@
+/*
+This file is part of Telegram Desktop,
+the official desktop application for the Telegram messaging service.
+
+For license and copyright information please follow this link:
+https://github.com/telegramdesktop/tdesktop/blob/master/LEGAL
+*/
+#pragma once
+
+#include "mtproto/core_types.h"
+
+namespace MTP::details {
+
+// Part of a received packet. mtpBuffer is implicitly shared, so all the
+// slices of one decrypted packet (for example the messages inside
+// a msg_container) point to the same data without copying it.
+class ReceivedSlice final {
+public:
+	ReceivedSlice() = default;
+	explicit ReceivedSlice(mtpBuffer &&buffer);
+	ReceivedSlice(
+		const mtpBuffer &buffer,
+		const mtpPrime *from,
+		const mtpPrime *till);
+
+	[[nodiscard]] const mtpPrime *from() const;
+	[[nodiscard]] const mtpPrime *till() const;
+	[[nodiscard]] int size() const;
+	[[nodiscard]] bool empty() const;
+	[[nodiscard]] mtpPrime operator[](int index) const;
+
+private:
+	mtpBuffer _buffer;
+	int _offset = 0;
+	int _size = 0;
+
+};
+
+} // namespace MTP::details
@@ -0,0 +1,150 @@
+/*
+This file is part of Telegram Desktop,
+the official desktop application for the Telegram messaging service.
+
+For license and copyright information please follow this link:
+https://github.com/telegramdesktop/tdesktop/blob/master/LEGAL
+*/
+#include "mtproto/details/mtproto_requests_table.h"
+
+namespace MTP::details {
+namespace {
+
+[[nodiscard]] bool HasCallbacks(const RPCResponseHandler &callbacks) {
+	return (callbacks.onDone != nullptr) || (callbacks.onFail != nullptr);
+}
+
+} // namespace
+
+void RequestsTable::store(
+		mtpRequestId requestId,
+		const SerializedRequest &request,
+		RPCResponseHandler &&callbacks) {
+	auto &shard = this->shard(requestId);
+	QMutexLocker lock(&shard.mutex);
+	auto &entry = shard.entries[requestId];
+	if (!entry.request) {
+		entry.request = request;
+	}
+	if (HasCallbacks(callbacks) && !HasCallbacks(entry.callbacks)) {
+		entry.callbacks = std::move(callbacks);
+	}
+}
+
+SerializedRequest RequestsTable::request(mtpRequestId requestId) const {
+	const auto &shard = this->shard(requestId);
+	QMutexLocker lock(&shard.mutex);
+	const auto i = shard.entries.find(requestId);
+	return (i != end(shard.entries)) ? i->second.request : SerializedRequest();
+}
+
+void RequestsTable::unregister(mtpRequestId requestId) {
+	auto &shard = this->shard(requestId);
+
+	// Destroy the request data after the mutex is unlocked.
+	auto request = SerializedRequest();
+	QMutexLocker lock(&shard.mutex);
+	const auto i = shard.entries.find(requestId);
+	if (i != end(shard.entries)) {
+		request = base::take(i->second.request);
+		i->second.dcId = std::nullopt;
+		EraseIfEmpty(shard, i);
+	}
+}
+
+SerializedRequest RequestsTable::cancel(mtpRequestId requestId) {
+	auto &shard = this->shard(requestId);
+
+	// Destroy the handlers after the mutex is unlocked.
+	auto callbacks = RPCResponseHandler();
+	QMutexLocker lock(&shard.mutex);
+	const auto i = shard.entries.find(requestId);
+	if (i == end(shard.entries)) {
+		return SerializedRequest();
+	}
+	auto result = base::take(i->second.request);
+	callbacks = base::take(i->second.callbacks);
+	shard.entries.erase(i);
+	return result;
+}
+
+void RequestsTable::setDcId(
+		mtpRequestId requestId,
+		ShiftedDcId shiftedDcId) {
+	auto &shard = this->shard(requestId);
+	QMutexLocker lock(&shard.mutex);
+	shard.entries[requestId].dcId = shiftedDcId;
+}
+
+std::optional<ShiftedDcId> RequestsTable::dcId(
+		mtpRequestId requestId) const {
+	const auto &shard = this->shard(requestId);
+	QMutexLocker lock(&shard.mutex);
+	const auto i = shard.entries.find(requestId);
+	return (i != end(shard.entries)) ? i->second.dcId : std::nullopt;
+}
+
+std::optional<ShiftedDcId> RequestsTable::changeDcId(
+		mtpRequestId requestId,
+		DcId newdc) {
+	auto &shard = this->shard(requestId);
+	QMutexLocker lock(&shard.mutex);
+	const auto i = shard.entries.find(requestId);
+	if (i == end(shard.entries) || !i->second.dcId) {
+		return std::nullopt;
+	}
+	auto &dcId = *i->second.dcId;
+	if (dcId < 0) {
+		dcId = -newdc;
+	} else {
+		dcId = ShiftDcId(newdc, GetDcIdShift(dcId));
+	}
+	return dcId;
+}
+
+void RequestsTable::setCallbacks(
+		mtpRequestId requestId,
+		RPCResponseHandler &&callbacks) {
+	auto &shard = this->shard(requestId);
+	QMutexLocker lock(&shard.mutex);
+	auto &entry = shard.entries[requestId];
+	if (!HasCallbacks(entry.callbacks)) {
+		entry.callbacks = std::move(callbacks);
+	}
+}
+
+RPCResponseHandler RequestsTable::takeCallbacks(mtpRequestId requestId) {
+	auto &shard = this->shard(requestId);
+	QMutexLocker lock(&shard.mutex);
+	const auto i = shard.entries.find(requestId);
+	if (i == end(shard.entries)) {
+		return RPCResponseHandler();
+	}
+	auto result = base::take(i->second.callbacks);
+	EraseIfEmpty(shard, i);
+	return result;
+}
+
+bool RequestsTable::hasCallbacks(mtpRequestId requestId) const {
+	const auto &shard = this->shard(requestId);
+	QMutexLocker lock(&shard.mutex);
+	const auto i = shard.entries.find(requestId);
+	return (i != end(shard.entries)) && HasCallbacks(i->second.callbacks);
+}
+
+auto RequestsTable::shard(mtpRequestId requestId) -> Shard & {
+	return _shards[uint32(requestId) % kShardsCount];
+}
+
+auto RequestsTable::shard(mtpRequestId requestId) const -> const Shard & {
+	return _shards[uint32(requestId) % kShardsCount];
+}
+
+void RequestsTable::EraseIfEmpty(Shard &shard, Iterator i) {
+	const auto &entry = i->second;
+	if (!entry.request && !entry.dcId && !HasCallbacks(entry.callbacks)) {
+		shard.entries.erase(i);
+	}
+}
+
+} // namespace MTP::details
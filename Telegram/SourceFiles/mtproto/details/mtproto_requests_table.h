@@ -0,0 +1,72 @@
+/*
+This file is part of Telegram Desktop,
+the official desktop application for the Telegram messaging service.
+
+For license and copyright information please follow this link:
+https://github.com/telegramdesktop/tdesktop/blob/master/LEGAL
+*/
+#pragma once
+
+#include "mtproto/details/mtproto_serialized_request.h"
+#include "mtproto/mtproto_rpc_sender.h"
+
+#include <QtCore/QMutex>
+
+namespace MTP::details {
+
+// Thread safe map of requests in flight, sharded by request id so that
+// the main thread and the session threads rarely wait for each other.
+//
+// Each entry holds the serialized request, the dc it was sent to
+// (dcWithShift, or -dcWithShift for requests to the main dc)
+// and the response handlers.
+class RequestsTable final {
+public:
+	void store(
+		mtpRequestId requestId,
+		const SerializedRequest &request,
+		RPCResponseHandler &&callbacks);
+	[[nodiscard]] SerializedRequest request(mtpRequestId requestId) const;
+
+	// Removes the request data, leaving only the response handlers.
+	void unregister(mtpRequestId requestId);
+
+	// Removes everything, returns the request that was stored.
+	SerializedRequest cancel(mtpRequestId requestId);
+
+	void setDcId(mtpRequestId requestId, ShiftedDcId shiftedDcId);
+	[[nodiscard]] std::optional<ShiftedDcId> dcId(
+		mtpRequestId requestId) const;
+	std::optional<ShiftedDcId> changeDcId(
+		mtpRequestId requestId,
+		DcId newdc);
+
+	void setCallbacks(
+		mtpRequestId requestId,
+		RPCResponseHandler &&callbacks);
+	[[nodiscard]] RPCResponseHandler takeCallbacks(mtpRequestId requestId);
+	[[nodiscard]] bool hasCallbacks(mtpRequestId requestId) const;
+
+private:
+	static constexpr auto kShardsCount = 16;
+
+	struct Entry {
+		SerializedRequest request;
+		std::optional<ShiftedDcId> dcId;
+		RPCResponseHandler callbacks;
+	};
+	struct Shard {
+		base::flat_map<mtpRequestId, Entry> entries;
+		mutable QMutex mutex;
+	};
+	using Iterator = base::flat_map<mtpRequestId, Entry>::iterator;
+
+	[[nodiscard]] Shard &shard(mtpRequestId requestId);
+	[[nodiscard]] const Shard &shard(mtpRequestId requestId) const;
+	static void EraseIfEmpty(Shard &shard, Iterator i);
+
+	std::array<Shard, kShardsCount> _shards;
+
+};
+
+} // namespace MTP::details
@@ -0,0 +1,232 @@
+/*
+This file is part of Telegram Desktop,
+the official desktop application for the Telegram messaging service.
+
+For license and copyright information please follow this link:
+https://github.com/telegramdesktop/tdesktop/blob/master/LEGAL
+*/
+#include "mtproto/details/mtproto_ungzip.h"
+
+#include "zlib.h"
+
+#include <QtCore/QMutex>
+
+#include <atomic>
+
+namespace MTP::details {
+namespace {
+
+constexpr auto kIntSize = int(sizeof(mtpPrime));
+constexpr auto kBackgroundPackedSize = 64 * 1024;
+constexpr auto kMaxInitialUnpackedSize = 16 * 1024 * 1024;
+constexpr auto kRatioBuckets = 32;
+constexpr auto kRatioPercentile = 90;
+constexpr auto kMinRatioSamples = 16;
+constexpr auto kDefaultRatio = 4;
+constexpr auto kStreamsPoolSize = 4;
+constexpr auto kLogStatsEach = 100;
+
+struct StreamDeleter {
+	void operator()(z_stream *stream) const {
+		inflateEnd(stream);
+		delete stream;
+	}
+};
+using StreamPointer = std::unique_ptr<z_stream, StreamDeleter>;
+
+// Histogram of unpacked / packed ratios, used to size the result once.
+class RatioHistogram final {
+public:
+	void add(int packed, int unpacked);
+	[[nodiscard]] int estimate() const;
+
+private:
+	std::array<std::atomic<uint32>, kRatioBuckets> _counts = {};
+
+};
+
+struct Stats {
+	std::atomic<uint64> bytesIn = { 0 };
+	std::atomic<uint64> bytesOut = { 0 };
+	std::atomic<uint64> microseconds = { 0 };
+	std::atomic<uint64> reallocations = { 0 };
+	std::atomic<uint64> count = { 0 };
+};
+
+RatioHistogram GlobalRatios;
+Stats GlobalStats;
+
+QMutex StreamsMutex;
+std::vector<StreamPointer> Streams;
+
+void RatioHistogram::add(int packed, int unpacked) {
+	if (packed <= 0) {
+		return;
+	}
+	const auto ratio = (unpacked + packed - 1) / packed;
+	const auto bucket = std::clamp(ratio, 1, kRatioBuckets) - 1;
+	_counts[bucket].fetch_add(1, std::memory_order_relaxed);
+}
+
+int RatioHistogram::estimate() const {
+	auto counts = std::array<uint32, kRatioBuckets>();
+	auto total = uint64(0);
+	for (auto i = 0; i != kRatioBuckets; ++i) {
+		counts[i] = _counts[i].load(std::memory_order_relaxed);
+		total += counts[i];
+	}
+	if (total < kMinRatioSamples) {
+		return kDefaultRatio;
+	}
+	const auto enough = (total * kRatioPercentile + 99) / 100;
+	auto accumulated = uint64(0);
+	for (auto i = 0; i != kRatioBuckets; ++i) {
+		accumulated += counts[i];
+		if (accumulated >= enough) {
+			return i + 1;
+		}
+	}
+	return kRatioBuckets;
+}
+
+[[nodiscard]] StreamPointer AcquireStream() {
+	{
+		QMutexLocker lock(&StreamsMutex);
+		if (!Streams.empty()) {
+			auto result = std::move(Streams.back());
+			Streams.pop_back();
+			return result;
+		}
+	}
+	auto result = std::make_unique<z_stream>();
+	result->zalloc = Z_NULL;
+	result->zfree = Z_NULL;
+	result->opaque = Z_NULL;
+	result->avail_in = 0;
+	result->next_in = Z_NULL;
+	const auto code = inflateInit2(result.get(), 16 + MAX_WBITS);
+	if (code != Z_OK) {
+		LOG(("RPC Error: could not init zlib stream, code: %1").arg(code));
+		return nullptr;
+	}
+	return StreamPointer(result.release());
+}
+
+void ReleaseStream(StreamPointer stream) {
+	if (inflateReset(stream.get()) != Z_OK) {
+		return;
+	}
+	QMutexLocker lock(&StreamsMutex);
+	if (Streams.size() < kStreamsPoolSize) {
+		Streams.push_back(std::move(stream));
+	}
+}
+
+void AccumulateStats(
+		int packed,
+		int unpacked,
+		int64 time,
+		int reallocations,
+		bool forceLog) {
+	GlobalRatios.add(packed, unpacked);
+
+	const auto bytesIn = (GlobalStats.bytesIn += packed);
+	const auto bytesOut = (GlobalStats.bytesOut += unpacked);
+	const auto microseconds = (GlobalStats.microseconds += time);
+	const auto allReallocations = (GlobalStats.reallocations
+		+= reallocations);
+	const auto count = ++GlobalStats.count;
+	if (forceLog || !(count % kLogStatsEach)) {
+		DEBUG_LOG(("MTP Info: ungzip %1 -> %2 bytes, %3 mcs, "
+			"%4 reallocations. Total: %5 calls, %6 -> %7 bytes, %8 mcs, "
+			"%9 reallocations."
+			).arg(packed
+			).arg(unpacked
+			).arg(time
+			).arg(reallocations
+			).arg(count
+			).arg(bytesIn
+			).arg(bytesOut
+			).arg(microseconds
+			).arg(allReallocations));
+	}
+}
+
+} // namespace
+
+mtpBuffer Ungzip(const mtpPrime *from, const mtpPrime *end) {
+	MTPstring packed;
+	if (!packed.read(from, end)) { // read packed string as serialized mtp string type
+		LOG(("RPC Error: could not read gziped bytes."));
+		return mtpBuffer();
+	}
+	const auto started = crl::profile();
+	auto stream = AcquireStream();
+	if (!stream) {
+		return mtpBuffer();
+	}
+	const auto packedLen = int(packed.v.size());
+	stream->avail_in = packedLen;
+	stream->next_in = reinterpret_cast<Bytef*>(packed.v.data());
+
+	const auto ratio = GlobalRatios.estimate();
+	const auto initial = std::clamp(
+		int64(packedLen) * ratio,
+		int64(packedLen) + 1,
+		int64(std::max(kMaxInitialUnpackedSize, packedLen + 1)));
+
+	auto result = mtpBuffer();
+	result.resize(int((initial + kIntSize - 1) / kIntSize));
+	auto unpacked = 0;
+	auto reallocations = 0;
+	auto code = Z_OK;
+	do {
+		auto capacity = result.size() * kIntSize;
+		if (unpacked == capacity) {
+			const auto more = std::max(
+				int64(stream->avail_in) * ratio,
+				int64(capacity / 2));
+			result.resize(result.size() + int((more + kIntSize - 1) / kIntSize));
+			capacity = result.size() * kIntSize;
+			++reallocations;
+		}
+		stream->next_out = reinterpret_cast<Bytef*>(result.data())
+			+ unpacked;
+		stream->avail_out = capacity - unpacked;
+		code = inflate(stream.get(), Z_NO_FLUSH);
+		if (code != Z_OK && code != Z_STREAM_END) {
+			LOG(("RPC Error: could not unpack gziped data, code: %1"
+				).arg(code));
+			DEBUG_LOG(("RPC Error: bad gzip: %1"
+				).arg(Logs::mb(packed.v.constData(), packedLen).str()));
+			ReleaseStream(std::move(stream));
+			return mtpBuffer();
+		}
+		unpacked = capacity - int(stream->avail_out);
+	} while (code != Z_STREAM_END && !stream->avail_out);
+	ReleaseStream(std::move(stream));
+
+	if (unpacked & 0x03) {
+		LOG(("RPC Error: bad length of unpacked data %1").arg(unpacked));
+		DEBUG_LOG(("RPC Error: bad unpacked data %1"
+			).arg(Logs::mb(result.data(), unpacked).str()));
+		return mtpBuffer();
+	}
+	result.resize(unpacked / kIntSize);
+	if (!unpacked) {
+		LOG(("RPC Error: bad length of unpacked data 0"));
+	}
+	AccumulateStats(
+		packedLen,
+		unpacked,
+		crl::profile() - started,
+		reallocations,
+		(packedLen >= kBackgroundPackedSize));
+	return result;
+}
+
+bool UngzipInBackground(const mtpPrime *from, const mtpPrime *end) {
+	return (end - from) * kIntSize >= kBackgroundPackedSize;
+}
+
+} // namespace MTP::details
@@ -0,0 +1,23 @@
+/*
+This file is part of Telegram Desktop,
+the official desktop application for the Telegram messaging service.
+
+For license and copyright information please follow this link:
+https://github.com/telegramdesktop/tdesktop/blob/master/LEGAL
+*/
+#pragma once
+
+#include "mtproto/core_types.h"
+
+namespace MTP::details {
+
+// Unpacks gzip_packed contents, [from, end) starts right after the type id.
+// Returns an empty buffer on failure. May be called from any thread.
+[[nodiscard]] mtpBuffer Ungzip(const mtpPrime *from, const mtpPrime *end);
+
+// Large payloads are better unpacked outside of the session thread.
+[[nodiscard]] bool UngzipInBackground(
+	const mtpPrime *from,
+	const mtpPrime *end);
+
+} // namespace MTP::details
@@ -8,6 +8,7 @@ https://github.com/telegramdesktop/tdesktop/blob/master/LEGAL
 #include "mtproto/mtp_instance.h"
 
 #include "mtproto/details/mtproto_dcenter.h"
+#include "mtproto/details/mtproto_requests_table.h"
 #include "mtproto/details/mtproto_rsa_public_key.h"
 #include "mtproto/special_config_request.h"
 #include "mtproto/session.h"
@@ -238,19 +239,11 @@ private:
 	rpl::event_stream<> _writeKeysRequests;
 	rpl::event_stream<> _allKeysDestroyed;
 
-	// holds dcWithShift for request to this dc or -dc for request to main dc
-	std::map<mtpRequestId, ShiftedDcId> _requestsByDc;
-	mutable QMutex _requestByDcLock;
+	RequestsTable _requests;
 
 	// holds target dcWithShift for auth export request
 	std::map<mtpRequestId, ShiftedDcId> _authExportRequests;
 
-	std::map<mtpRequestId, RPCResponseHandler> _parserMap;
-	QMutex _parserMapLock;
-
-	std::map<mtpRequestId, SerializedRequest> _requestMap;
-	QReadWriteLock _requestMapLock;
-
 	std::deque<std::pair<mtpRequestId, crl::time>> _delayedRequests;
 
 	std::map<mtpRequestId, int> _requestsDelays;
@@ -582,23 +575,15 @@ void Instance::Private::cancel(mtpRequestId requestId) {
 
 	DEBUG_LOG(("MTP Info: Cancel request %1.").arg(requestId));
 	const auto shiftedDcId = queryRequestByDc(requestId);
-	auto msgId = mtpMsgId(0);
-	{
-		QWriteLocker locker(&_requestMapLock);
-		auto it = _requestMap.find(requestId);
-		if (it != _requestMap.end()) {
-			msgId = *(mtpMsgId*)(it->second->constData() + 4);
-			_requestMap.erase(it);
-		}
-	}
-	unregisterRequest(requestId);
+	const auto request = _requests.cancel(requestId);
+	const auto msgId = request
+		? *(mtpMsgId*)(request->constData() + 4)
+		: mtpMsgId(0);
+	_requestsDelays.erase(requestId);
 	if (shiftedDcId) {
 		const auto session = getSession(qAbs(*shiftedDcId));
 		session->cancel(requestId, msgId);
 	}
-
-	QMutexLocker locker(&_parserMapLock);
-	_parserMap.erase(requestId);
 }
 
 // result < 0 means waiting for such count of ms.
@@ -872,28 +857,13 @@ bool Instance::Private::configLoadFail(const RPCError &error) {
 
 std::optional<ShiftedDcId> Instance::Private::queryRequestByDc(
 		mtpRequestId requestId) const {
-	QMutexLocker locker(&_requestByDcLock);
-	auto it = _requestsByDc.find(requestId);
-	if (it != _requestsByDc.cend()) {
-		return it->second;
-	}
-	return std::nullopt;
+	return _requests.dcId(requestId);
 }
 
 std::optional<ShiftedDcId> Instance::Private::changeRequestByDc(
 		mtpRequestId requestId,
 		DcId newdc) {
-	QMutexLocker locker(&_requestByDcLock);
-	auto it = _requestsByDc.find(requestId);
-	if (it != _requestsByDc.cend()) {
-		if (it->second < 0) {
-			it->second = -newdc;
-		} else {
-			it->second = ShiftDcId(newdc, GetDcIdShift(it->second));
-		}
-		return it->second;
-	}
-	return std::nullopt;
+	return _requests.changeDcId(requestId, newdc);
 }
 
 void Instance::Private::checkDelayedRequests() {
@@ -910,15 +880,10 @@ void Instance::Private::checkDelayedRequests() {
 			continue;
 		}
 
-		auto request = SerializedRequest();
-		{
-			QReadLocker locker(&_requestMapLock);
-			auto it = _requestMap.find(requestId);
-			if (it == _requestMap.cend()) {
-				DEBUG_LOG(("MTP Error: could not find request %1").arg(requestId));
-				continue;
-			}
-			request = it->second;
+		const auto request = _requests.request(requestId);
+		if (!request) {
+			DEBUG_LOG(("MTP Error: could not find request %1").arg(requestId));
+			continue;
 		}
 		const auto session = getSession(qAbs(dcWithShift));
 		session->sendPrepared(request);
@@ -959,48 +924,25 @@ void Instance::Private::sendRequest(
 void Instance::Private::registerRequest(
 		mtpRequestId requestId,
 		ShiftedDcId shiftedDcId) {
-	QMutexLocker locker(&_requestByDcLock);
-	_requestsByDc[requestId] = shiftedDcId;
+	_requests.setDcId(requestId, shiftedDcId);
 }
 
 void Instance::Private::unregisterRequest(mtpRequestId requestId) {
 	DEBUG_LOG(("MTP Info: unregistering request %1.").arg(requestId));
 
 	_requestsDelays.erase(requestId);
-
-	{
-		QWriteLocker locker(&_requestMapLock);
-		_requestMap.erase(requestId);
-	}
-
-	QMutexLocker locker(&_requestByDcLock);
-	_requestsByDc.erase(requestId);
+	_requests.unregister(requestId);
 }
 
 void Instance::Private::storeRequest(
 		mtpRequestId requestId,
 		const SerializedRequest &request,
 		RPCResponseHandler &&callbacks) {
-	if (callbacks.onDone || callbacks.onFail) {
-		QMutexLocker locker(&_parserMapLock);
-		_parserMap.emplace(requestId, std::move(callbacks));
-	}
-	{
-		QWriteLocker locker(&_requestMapLock);
-		_requestMap.emplace(requestId, request);
-	}
+	_requests.store(requestId, request, std::move(callbacks));
 }
 
 SerializedRequest Instance::Private::getRequest(mtpRequestId requestId) {
-	auto result = SerializedRequest();
-	{
-		QReadLocker locker(&_requestMapLock);
-		auto it = _requestMap.find(requestId);
-		if (it != _requestMap.cend()) {
-			result = it->second;
-		}
-	}
-	return result;
+	return _requests.request(requestId);
 }
 
 
@@ -1008,18 +950,10 @@ void Instance::Private::execCallback(
 		mtpRequestId requestId,
 		const mtpPrime *from,
 		const mtpPrime *end) {
-	RPCResponseHandler h;
-	{
-		QMutexLocker locker(&_parserMapLock);
-		auto it = _parserMap.find(requestId);
-		if (it != _parserMap.cend()) {
-			h = it->second;
-			_parserMap.erase(it);
-
-			DEBUG_LOG(("RPC Info: found parser for request %1, trying to parse response...").arg(requestId));
-		}
-	}
+	const auto h = _requests.takeCallbacks(requestId);
 	if (h.onDone || h.onFail) {
+		DEBUG_LOG(("RPC Info: found parser for request %1, trying to parse response...").arg(requestId));
+
 		const auto handleError = [&](const RPCError &error) {
 			DEBUG_LOG(("RPC Info: "
 				"error received, code %1, type %2, description: %3"
@@ -1029,8 +963,7 @@ void Instance::Private::execCallback(
 			if (rpcErrorOccured(requestId, h, error)) {
 				unregisterRequest(requestId);
 			} else {
-				QMutexLocker locker(&_parserMapLock);
-				_parserMap.emplace(requestId, h);
+				_requests.setCallbacks(requestId, base::duplicate(h));
 			}
 		};
 
@@ -1060,9 +993,7 @@ void Instance::Private::execCallback(
 }
 
 bool Instance::Private::hasCallbacks(mtpRequestId requestId) {
-	QMutexLocker locker(&_parserMapLock);
-	auto it = _parserMap.find(requestId);
-	return (it != _parserMap.cend());
+	return _requests.hasCallbacks(requestId);
 }
 
 void Instance::Private::globalCallback(const mtpPrime *from, const mtpPrime *end) {
@@ -1122,10 +1053,9 @@ void Instance::Private::importDone(const MTPauth_Authorization &result, mtpReque
 
 	auto &waiters = _authWaiters[newdc];
 	if (waiters.size()) {
-		QReadLocker locker(&_requestMapLock);
 		for (auto waitedRequestId : waiters) {
-			auto it = _requestMap.find(waitedRequestId);
-			if (it == _requestMap.cend()) {
+			const auto request = _requests.request(waitedRequestId);
+			if (!request) {
 				LOG(("MTP Error: could not find request %1 for resending").arg(waitedRequestId));
 				continue;
 			}
@@ -1138,7 +1068,7 @@ void Instance::Private::importDone(const MTPauth_Authorization &result, mtpReque
 			}
 			DEBUG_LOG(("MTP Info: resending request %1 to dc %2 after import auth").arg(waitedRequestId).arg(*shiftedDcId));
 			const auto session = getSession(*shiftedDcId);
-			session->sendPrepared(it->second);
+			session->sendPrepared(request);
 		}
 		waiters.clear();
 	}
@@ -1244,15 +1174,10 @@ bool Instance::Private::onErrorDefault(mtpRequestId requestId, const RPCError &e
 			newdcWithShift = ShiftDcId(newdcWithShift, GetDcIdShift(dcWithShift));
 		}
 
-		auto request = SerializedRequest();
-		{
-			QReadLocker locker(&_requestMapLock);
-			auto it = _requestMap.find(requestId);
-			if (it == _requestMap.cend()) {
-				LOG(("MTP Error: could not find request %1").arg(requestId));
-				return false;
-			}
-			request = it->second;
+		const auto request = _requests.request(requestId);
+		if (!request) {
+			LOG(("MTP Error: could not find request %1").arg(requestId));
+			return false;
 		}
 		const auto session = getSession(newdcWithShift);
 		registerRequest(
@@ -1316,15 +1241,10 @@ bool Instance::Private::onErrorDefault(mtpRequestId requestId, const RPCError &e
 		if (badGuestDc) _badGuestDcRequests.insert(requestId);
 		return true;
 	} else if (err == qstr("CONNECTION_NOT_INITED") || err == qstr("CONNECTION_LAYER_INVALID")) {
-		SerializedRequest request;
-		{
-			QReadLocker locker(&_requestMapLock);
-			auto it = _requestMap.find(requestId);
-			if (it == _requestMap.cend()) {
-				LOG(("MTP Error: could not find request %1").arg(requestId));
-				return false;
-			}
-			request = it->second;
+		const auto request = _requests.request(requestId);
+		if (!request) {
+			LOG(("MTP Error: could not find request %1").arg(requestId));
+			return false;
 		}
 		auto dcWithShift = ShiftedDcId(0);
 		if (const auto shiftedDcId = queryRequestByDc(requestId)) {
@@ -1341,15 +1261,10 @@ bool Instance::Private::onErrorDefault(mtpRequestId requestId, const RPCError &e
 	} else if (err == qstr("CONNECTION_LANG_CODE_INVALID")) {
 		Lang::CurrentCloudManager().resetToDefault();
 	} else if (err == qstr("MSG_WAIT_FAILED")) {
-		SerializedRequest request;
-		{
-			QReadLocker locker(&_requestMapLock);
-			auto it = _requestMap.find(requestId);
-			if (it == _requestMap.cend()) {
-				LOG(("MTP Error: could not find request %1").arg(requestId));
-				return false;
-			}
-			request = it->second;
+		const auto request = _requests.request(requestId);
+		if (!request) {
+			LOG(("MTP Error: could not find request %1").arg(requestId));
+			return false;
 		}
 		if (!request->after) {
 			LOG(("MTP Error: wait failed for not dependent request %1").arg(requestId));
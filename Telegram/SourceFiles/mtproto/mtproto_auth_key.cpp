@@ -11,7 +11,17 @@ https://github.com/telegramdesktop/tdesktop/blob/master/LEGAL
 
 #include <QtCore/QDataStream>
 
+extern "C" {
+#include <openssl/evp.h>
+} // extern "C"
+
 namespace MTP {
+namespace {
+
+// Multiple of AES_BLOCK_SIZE, small enough to stay in L1 cache.
+constexpr auto kFusedChunkSize = 16 * 1024;
+
+} // namespace
 
 AuthKey::AuthKey(Type type, DcId dcId, const Data &data)
 : _type(type)
@@ -168,6 +178,38 @@ void aesIgeDecryptRaw(const void *src, void *dst, uint32 len, const void *key, c
 	AES_ige_encrypt(static_cast<const uchar*>(src), static_cast<uchar*>(dst), len, &aes, aes_iv, AES_DECRYPT);
 }
 
+void aesIgeDecryptInPlaceWithHash(
+		bytes::span data,
+		const AuthKeyPtr &authKey,
+		const MTPint128 &msgKey,
+		bytes::span sha256) {
+	Expects(data.size() % AES_BLOCK_SIZE == 0);
+	Expects(sha256.size() == SHA256_DIGEST_LENGTH);
+
+	MTPint256 aesKey, aesIV;
+	authKey->prepareAES(msgKey, aesKey, aesIV, false);
+
+	uchar aes_iv[32];
+	memcpy(aes_iv, &aesIV, 32);
+
+	AES_KEY aes;
+	AES_set_decrypt_key(reinterpret_cast<const uchar*>(&aesKey), 256, &aes);
+
+	SHA256_CTX context;
+	SHA256_Init(&context);
+	SHA256_Update(&context, authKey->partForMsgKey(false), 32);
+
+	// AES_ige_encrypt() updates aes_iv, so the chunks chain correctly.
+	while (!data.empty()) {
+		const auto size = std::min(int(data.size()), kFusedChunkSize);
+		const auto inout = reinterpret_cast<uchar*>(data.data());
+		AES_ige_encrypt(inout, inout, size, &aes, aes_iv, AES_DECRYPT);
+		SHA256_Update(&context, inout, size);
+		data = data.subspan(size);
+	}
+	SHA256_Final(reinterpret_cast<uchar*>(sha256.data()), &context);
+}
+
 void aesCtrEncrypt(bytes::span data, const void *key, CTRState *state) {
 	AES_KEY aes;
 	AES_set_encrypt_key(static_cast<const uchar*>(key), 256, &aes);
@@ -186,4 +228,49 @@ void aesCtrEncrypt(bytes::span data, const void *key, CTRState *state) {
 		(block128_f)AES_encrypt);
 }
 
+AesCtrCipher::AesCtrCipher() : _context(EVP_CIPHER_CTX_new()) {
+	Expects(_context != nullptr);
+}
+
+AesCtrCipher::~AesCtrCipher() {
+	EVP_CIPHER_CTX_free(_context);
+}
+
+void AesCtrCipher::init(bytes::const_span key, bytes::const_span iv) {
+	Expects(key.size() == CTRState::KeySize);
+	Expects(iv.size() == CTRState::IvecSize);
+
+	_valid = (EVP_EncryptInit_ex(
+		_context,
+		EVP_aes_256_ctr(),
+		nullptr,
+		reinterpret_cast<const uchar*>(key.data()),
+		reinterpret_cast<const uchar*>(iv.data())) == 1);
+	if (!_valid) {
+		LOG(("MTP Error: Could not initialize AES-CTR context."));
+	}
+}
+
+bool AesCtrCipher::valid() const {
+	return _valid;
+}
+
+void AesCtrCipher::apply(bytes::span data) {
+	Expects(_valid);
+	Expects(data.size() <= std::numeric_limits<int>::max());
+
+	if (data.empty()) {
+		return;
+	}
+	const auto inout = reinterpret_cast<uchar*>(data.data());
+	auto written = 0;
+	const auto result = EVP_EncryptUpdate(
+		_context,
+		inout,
+		&written,
+		inout,
+		int(data.size()));
+	Assert(result == 1 && written == int(data.size()));
+}
+
 } // namespace MTP
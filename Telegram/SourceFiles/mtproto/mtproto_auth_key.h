@@ -11,6 +11,8 @@ https://github.com/telegramdesktop/tdesktop/blob/master/LEGAL
 #include <array>
 #include <memory>
 
+struct evp_cipher_ctx_st;
+
 namespace MTP {
 
 class AuthKey {
@@ -103,6 +105,14 @@ inline void aesIgeDecrypt(const void *src, void *dst, uint32 len, const AuthKeyP
 	return aesIgeDecryptRaw(src, dst, len, static_cast<const void*>(&aesKey), static_cast<const void*>(&aesIV));
 }
 
+// Decrypts the message in place and computes the msg_key SHA256 over
+// the decrypted bytes in the same pass, while each chunk is in cache.
+void aesIgeDecryptInPlaceWithHash(
+	bytes::span data,
+	const AuthKeyPtr &authKey,
+	const MTPint128 &msgKey,
+	bytes::span sha256);
+
 inline void aesDecryptLocal(const void *src, void *dst, uint32 len, const AuthKeyPtr &authKey, const void *key128) {
 	MTPint256 aesKey, aesIV;
 	authKey->prepareAES_oldmtp(*(const MTPint128*)key128, aesKey, aesIV, false);
@@ -122,4 +132,24 @@ struct CTRState {
 };
 void aesCtrEncrypt(bytes::span data, const void *key, CTRState *state);
 
+// Persistent AES-256-CTR context, key schedule is expanded only once.
+class AesCtrCipher final {
+public:
+	AesCtrCipher();
+	AesCtrCipher(const AesCtrCipher &other) = delete;
+	AesCtrCipher &operator=(const AesCtrCipher &other) = delete;
+	~AesCtrCipher();
+
+	void init(bytes::const_span key, bytes::const_span iv);
+	[[nodiscard]] bool valid() const;
+
+	// Encrypts / decrypts in place, keeping the counter between calls.
+	void apply(bytes::span data);
+
+private:
+	evp_cipher_ctx_st *_context = nullptr;
+	bool _valid = false;
+
+};
+
 } // namespace MTP
@@ -21,6 +21,10 @@ namespace {
 
 using namespace details;
 
+constexpr auto kMaxEndpointsHistory = 256;
+constexpr auto kMaxEndpointFailures = 100;
+constexpr auto kEndpointLatencyChangeNotify = 5; // Notify on 20% change.
+
 struct BuiltInDc {
 	int id;
 	const char *ip;
@@ -152,6 +156,8 @@ DcOptions::DcOptions(const DcOptions &other)
 , _publicKeys(other._publicKeys)
 , _cdnPublicKeys(other._cdnPublicKeys)
 , _immutable(other._immutable) {
+	QMutexLocker lock(&other._endpointsHistoryMutex);
+	_endpointsHistory = other._endpointsHistory;
 }
 
 DcOptions::~DcOptions() = default;
@@ -460,7 +466,38 @@ QByteArray DcOptions::serialize() const {
 		}
 	}
 
-	constexpr auto kVersion = 1;
+	// Endpoints history, only for the endpoints we still know about.
+	struct SerializedHistory {
+		EndpointKey key;
+		EndpointHistory history;
+	};
+	auto history = std::vector<SerializedHistory>();
+	size += sizeof(qint32);
+	{
+		QMutexLocker lock(&_endpointsHistoryMutex);
+		history.reserve(_endpointsHistory.size());
+		for (const auto &[key, value] : _endpointsHistory) {
+			const auto i = _data.find(key.dcId);
+			if (i == end(_data)) {
+				continue;
+			}
+			const auto known = ranges::find(
+				i->second,
+				std::make_pair(key.ip, key.port),
+				[](const Endpoint &endpoint) {
+					return std::make_pair(endpoint.ip, endpoint.port);
+				}) != end(i->second);
+			if (!known) {
+				continue;
+			}
+			history.push_back({ key, value });
+			// dcId + protocol + port + latency + firstByte + failures
+			size += 6 * sizeof(qint32);
+			size += sizeof(qint32) + key.ip.size();
+		}
+	}
+
+	constexpr auto kVersion = 3;
 
 	auto result = QByteArray();
 	result.reserve(size);
@@ -495,6 +532,19 @@ QByteArray DcOptions::serialize() const {
 				<< Serialize::bytes(key.n)
 				<< Serialize::bytes(key.e);
 		}
+
+		// Endpoints history.
+		stream << qint32(history.size());
+		for (const auto &[key, value] : history) {
+			stream << qint32(key.dcId)
+				<< qint32(key.protocol)
+				<< qint32(key.port)
+				<< qint32(value.latency)
+				<< qint32(value.firstByte)
+				<< qint32(value.failures)
+				<< qint32(key.ip.size());
+			stream.writeRawData(key.ip.data(), key.ip.size());
+		}
 	}
 	return result;
 }
@@ -590,6 +640,64 @@ bool DcOptions::constructFromSerialized(const QByteArray &serialized) {
 			}
 		}
 	}
+
+	// Read endpoints history
+	if (version > 1 && !stream.atEnd()) {
+		auto count = qint32(0);
+		stream >> count;
+		if (stream.status() != QDataStream::Ok
+			|| count < 0
+			|| count > kMaxEndpointsHistory) {
+			LOG(("MTP Error: Bad data for endpoints history in DcOptions::constructFromSerialized()"));
+			return false;
+		}
+
+		QMutexLocker historyLock(&_endpointsHistoryMutex);
+		_endpointsHistory.clear();
+		for (auto i = 0; i != count; ++i) {
+			qint32 dcId = 0, protocol = 0, port = 0, latency = 0;
+			qint32 firstByte = 0, failures = 0, ipSize = 0;
+			stream
+				>> dcId
+				>> protocol
+				>> port
+				>> latency;
+			if (version > 2) {
+				stream >> firstByte;
+			}
+			stream
+				>> failures
+				>> ipSize;
+
+			constexpr auto kMaxIpSize = 45;
+			if (stream.status() != QDataStream::Ok
+				|| protocol < 0
+				|| protocol >= Variants::ProtocolCount
+				|| ipSize <= 0
+				|| ipSize > kMaxIpSize) {
+				LOG(("MTP Error: Bad data inside endpoints history in DcOptions::constructFromSerialized()"));
+				return false;
+			}
+			auto ip = std::string(ipSize, ' ');
+			stream.readRawData(ip.data(), ipSize);
+			if (stream.status() != QDataStream::Ok) {
+				LOG(("MTP Error: Bad data inside endpoints history in DcOptions::constructFromSerialized()"));
+				return false;
+			}
+			_endpointsHistory.emplace(
+				EndpointKey{
+					DcId(dcId),
+					static_cast<Variants::Protocol>(protocol),
+					std::move(ip),
+					port,
+				},
+				EndpointHistory{
+					std::max(crl::time(latency), crl::time(0)),
+					std::max(crl::time(firstByte), crl::time(0)),
+					std::clamp(int(failures), 0, kMaxEndpointFailures),
+				});
+		}
+	}
 	return true;
 }
 
@@ -601,6 +709,101 @@ rpl::producer<> DcOptions::cdnConfigChanged() const {
 	return _cdnConfigChanged.events();
 }
 
+auto DcOptions::endpointHistory(
+	DcId dcId,
+	Variants::Protocol protocol,
+	const std::string &ip,
+	int port) const -> std::optional<EndpointHistory> {
+	QMutexLocker lock(&_endpointsHistoryMutex);
+	const auto i = _endpointsHistory.find(
+		EndpointKey{ dcId, protocol, ip, port });
+	return (i != end(_endpointsHistory))
+		? std::make_optional(i->second)
+		: std::nullopt;
+}
+
+void DcOptions::recordEndpointConnected(
+		DcId dcId,
+		Variants::Protocol protocol,
+		const std::string &ip,
+		int port,
+		crl::time latency) {
+	updateEndpointHistory(
+		EndpointKey{ dcId, protocol, ip, port },
+		[&](EndpointHistory &history) {
+			history.latency = history.latency
+				? ((history.latency * 3 + latency) / 4)
+				: std::max(latency, crl::time(1));
+			history.failures = 0;
+		});
+}
+
+void DcOptions::recordEndpointFirstByte(
+		DcId dcId,
+		Variants::Protocol protocol,
+		const std::string &ip,
+		int port,
+		crl::time latency) {
+	updateEndpointHistory(
+		EndpointKey{ dcId, protocol, ip, port },
+		[&](EndpointHistory &history) {
+			history.firstByte = history.firstByte
+				? ((history.firstByte * 3 + latency) / 4)
+				: std::max(latency, crl::time(1));
+		});
+}
+
+void DcOptions::recordEndpointFailed(
+		DcId dcId,
+		Variants::Protocol protocol,
+		const std::string &ip,
+		int port) {
+	updateEndpointHistory(
+		EndpointKey{ dcId, protocol, ip, port },
+		[&](EndpointHistory &history) {
+			history.failures = std::min(
+				history.failures + 1,
+				kMaxEndpointFailures);
+		});
+}
+
+void DcOptions::updateEndpointHistory(
+		EndpointKey &&key,
+		Fn<void(EndpointHistory&)> update) {
+	if (_immutable) {
+		return;
+	}
+	auto notify = false;
+	{
+		QMutexLocker lock(&_endpointsHistoryMutex);
+		auto i = _endpointsHistory.find(key);
+		if (i == end(_endpointsHistory)) {
+			if (_endpointsHistory.size() >= kMaxEndpointsHistory) {
+				return;
+			}
+			i = _endpointsHistory.emplace(std::move(key)).first;
+			notify = true;
+		}
+		const auto was = i->second;
+		update(i->second);
+		const auto &now = i->second;
+		const auto latencyDelta = std::abs(now.latency - was.latency);
+		const auto firstByteDelta = std::abs(now.firstByte - was.firstByte);
+		if (now.failures != was.failures
+			|| latencyDelta * kEndpointLatencyChangeNotify > was.latency
+			|| firstByteDelta * kEndpointLatencyChangeNotify > was.firstByte) {
+			notify = true;
+		}
+	}
+	if (notify) {
+		_endpointsHistoryChanged.fire({});
+	}
+}
+
+rpl::producer<> DcOptions::endpointsHistoryChanged() const {
+	return _endpointsHistoryChanged.events();
+}
+
 std::vector<DcId> DcOptions::configEnumDcIds() const {
 	auto result = std::vector<DcId>();
 	{
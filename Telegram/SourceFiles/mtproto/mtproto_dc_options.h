@@ -11,6 +11,7 @@ https://github.com/telegramdesktop/tdesktop/blob/master/LEGAL
 #include "base/bytes.h"
 
 #include <QtCore/QReadWriteLock>
+#include <QtCore/QMutex>
 #include <string>
 #include <vector>
 #include <map>
@@ -106,6 +107,36 @@ public:
 		bool throughProxy) const;
 	[[nodiscard]] DcType dcType(ShiftedDcId shiftedDcId) const;
 
+	// Connection results of the endpoints, persisted with the options.
+	struct EndpointHistory {
+		crl::time latency = 0; // Smoothed connect latency, zero if unknown.
+		crl::time firstByte = 0; // Smoothed connect to first byte latency.
+		int failures = 0; // Failed attempts since the last success.
+	};
+	[[nodiscard]] std::optional<EndpointHistory> endpointHistory(
+		DcId dcId,
+		Variants::Protocol protocol,
+		const std::string &ip,
+		int port) const;
+	void recordEndpointConnected(
+		DcId dcId,
+		Variants::Protocol protocol,
+		const std::string &ip,
+		int port,
+		crl::time latency);
+	void recordEndpointFirstByte(
+		DcId dcId,
+		Variants::Protocol protocol,
+		const std::string &ip,
+		int port,
+		crl::time latency);
+	void recordEndpointFailed(
+		DcId dcId,
+		Variants::Protocol protocol,
+		const std::string &ip,
+		int port);
+	[[nodiscard]] rpl::producer<> endpointsHistoryChanged() const;
+
 	void setCDNConfig(const MTPDcdnConfig &config);
 	[[nodiscard]] bool hasCDNKeysForDc(DcId dcId) const;
 	[[nodiscard]] details::RSAPublicKey getDcRSAKey(
@@ -117,6 +148,20 @@ public:
 	bool writeToFile(const QString &path) const;
 
 private:
+	struct EndpointKey {
+		DcId dcId = 0;
+		Variants::Protocol protocol = Variants::Tcp;
+		std::string ip;
+		int port = 0;
+
+		friend inline bool operator<(
+				const EndpointKey &a,
+				const EndpointKey &b) {
+			return std::tie(a.dcId, a.protocol, a.ip, a.port)
+				< std::tie(b.dcId, b.protocol, b.ip, b.port);
+		}
+	};
+
 	bool applyOneGuarded(
 		DcId dcId,
 		Flags flags,
@@ -139,6 +184,9 @@ private:
 
 	void processFromList(const QVector<MTPDcOption> &options, bool overwrite);
 	void computeCdnDcIds();
+	void updateEndpointHistory(
+		EndpointKey &&key,
+		Fn<void(EndpointHistory&)> update);
 
 	void readBuiltInPublicKeys();
 
@@ -157,8 +205,12 @@ private:
 		base::flat_map<uint64, details::RSAPublicKey>> _cdnPublicKeys;
 	mutable QReadWriteLock _useThroughLockers;
 
+	base::flat_map<EndpointKey, EndpointHistory> _endpointsHistory;
+	mutable QMutex _endpointsHistoryMutex;
+
 	rpl::event_stream<DcId> _changed;
 	rpl::event_stream<> _cdnConfigChanged;
+	rpl::event_stream<> _endpointsHistoryChanged;
 
 	// True when we have overriden options from a .tdesktop-endpoints file.
 	bool _immutable = false;
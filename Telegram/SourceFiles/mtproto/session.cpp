@@ -63,7 +63,85 @@ void SessionData::notifyConnectionInited(const SessionOptions &options) {
 	}
 }
 
+void SessionData::addReceivedResponse(
+		mtpRequestId requestId,
+		ReceivedSlice &&response) {
+	Expects(requestId != 0);
+
+	QMutexLocker lock(&_receivedMutex);
+	_received.push_back({ requestId, std::move(response) });
+}
+
+void SessionData::addReceivedUpdate(ReceivedSlice &&update) {
+	QMutexLocker lock(&_receivedMutex);
+	_received.push_back({ 0, std::move(update) });
+}
+
+uint64 SessionData::reserveReceivedSlot() {
+	QMutexLocker lock(&_receivedMutex);
+	const auto slot = ++_receivedSlotAutoIncrement;
+	_received.push_back({ 0, ReceivedSlice(), slot });
+	return slot;
+}
+
+void SessionData::fillReceivedSlot(
+		uint64 slot,
+		mtpRequestId requestId,
+		ReceivedSlice &&response) {
+	Expects(requestId != 0);
+
+	QMutexLocker lock(&_receivedMutex);
+	const auto i = ranges::find(_received, slot, &Received::slot);
+	if (i != end(_received)) {
+		i->requestId = requestId;
+		i->data = std::move(response);
+		i->slot = 0;
+	}
+}
+
+void SessionData::dropReceivedSlot(uint64 slot) {
+	QMutexLocker lock(&_receivedMutex);
+	const auto i = ranges::find(_received, slot, &Received::slot);
+	if (i != end(_received)) {
+		_received.erase(i);
+	}
+}
+
+bool SessionData::hasReadyReceived() const {
+	return !_received.empty() && !_received.front().slot;
+}
+
+ReceivedBatch SessionData::takeReceived() {
+	QMutexLocker lock(&_receivedMutex);
+	_tryToReceiveQueued = false;
+
+	// Stop at the first response that is still being unpacked.
+	auto result = ReceivedBatch();
+	while (hasReadyReceived()) {
+		auto &received = _received.front();
+		if (received.requestId) {
+			result.responses.emplace(
+				received.requestId,
+				std::move(received.data));
+		} else {
+			result.updates.push_back(std::move(received.data));
+		}
+		_received.pop_front();
+	}
+	return result;
+}
+
 void SessionData::queueTryToReceive() {
+	// Wake up the main thread only once until it takes the received data.
+	{
+		QMutexLocker lock(&_receivedMutex);
+		if (_tryToReceiveQueued || !hasReadyReceived()) {
+			return;
+		}
+		_tryToReceiveQueued = true;
+		DEBUG_LOG(("MTP Info: queueTryToReceive() - need to parse in another thread, %1 received."
+			).arg(_received.size()));
+	}
 	withSession([](not_null<Session*> session) {
 		session->tryToReceive();
 	});
@@ -357,13 +435,22 @@ void Session::resetDone() {
 }
 
 void Session::cancel(mtpRequestId requestId, mtpMsgId msgId) {
-	if (requestId) {
+	if (!requestId) {
+		return;
+	}
+	{
 		QWriteLocker locker(_data->toSendMutex());
 		_data->toSendMap().remove(requestId);
+		if (!msgId) {
+			return;
+		}
+		// Without a connection the next one will drop it before sending.
+		_data->cancelledSentSet().emplace(requestId);
 	}
-	if (msgId) {
-		QWriteLocker locker(_data->haveSentMutex());
-		_data->haveSentMap().remove(msgId);
+	if (const auto captured = _private) {
+		InvokeQueued(captured, [=] {
+			captured->cancelSent();
+		});
 	}
 }
 
@@ -559,26 +646,21 @@ void Session::tryToReceive() {
 		return;
 	}
 	while (true) {
-		auto lock = QWriteLocker(_data->haveReceivedMutex());
-		const auto responses = base::take(_data->haveReceivedResponses());
-		const auto updates = base::take(_data->haveReceivedUpdates());
-		lock.unlock();
+		const auto [responses, updates] = _data->takeReceived();
 		if (responses.empty() && updates.empty()) {
 			break;
 		}
 		for (const auto &[requestId, response] : responses) {
 			_instance->execCallback(
 				requestId,
-				response.constData(),
-				response.constData() + response.size());
+				response.from(),
+				response.till());
 		}
 
 		// Call globalCallback only in main session.
 		if (_shiftedDcId == BareDcId(_shiftedDcId)) {
 			for (const auto &update : updates) {
-				_instance->globalCallback(
-					update.constData(),
-					update.constData() + update.size());
+				_instance->globalCallback(update.from(), update.till());
 			}
 		}
 	}
@@ -10,6 +10,7 @@ https://github.com/telegramdesktop/tdesktop/blob/master/LEGAL
 #include "base/timer.h"
 #include "mtproto/mtproto_rpc_sender.h"
 #include "mtproto/mtproto_proxy_data.h"
+#include "mtproto/details/mtproto_received_slice.h"
 #include "mtproto/details/mtproto_serialized_request.h"
 
 #include <QtCore/QTimer>
@@ -52,6 +53,11 @@ struct SessionOptions {
 
 };
 
+struct ReceivedBatch {
+	base::flat_map<mtpRequestId, ReceivedSlice> responses;
+	std::vector<ReceivedSlice> updates;
+};
+
 class Session;
 class SessionData final {
 public:
@@ -71,25 +77,36 @@ public:
 	not_null<QReadWriteLock*> toSendMutex() {
 		return &_toSendLock;
 	}
-	not_null<QReadWriteLock*> haveSentMutex() {
-		return &_haveSentLock;
-	}
-	not_null<QReadWriteLock*> haveReceivedMutex() {
-		return &_haveReceivedLock;
-	}
-
 	base::flat_map<mtpRequestId, SerializedRequest> &toSendMap() {
 		return _toSend;
 	}
+
+	// Requests cancelled after they were taken for sending, guarded by
+	// toSendMutex(). SessionPrivate drops them from all its maps.
+	base::flat_set<mtpRequestId> &cancelledSentSet() {
+		return _cancelledSent;
+	}
+
+	// SessionPrivate thread only, no locking required.
 	base::flat_map<mtpMsgId, SerializedRequest> &haveSentMap() {
 		return _haveSent;
 	}
-	base::flat_map<mtpRequestId, mtpBuffer> &haveReceivedResponses() {
-		return _receivedResponses;
-	}
-	std::vector<mtpBuffer> &haveReceivedUpdates() {
-		return _receivedUpdates;
-	}
+
+	// SessionPrivate -> Session received data hand-off.
+	void addReceivedResponse(
+		mtpRequestId requestId,
+		ReceivedSlice &&response);
+	void addReceivedUpdate(ReceivedSlice &&update);
+	[[nodiscard]] ReceivedBatch takeReceived();
+
+	// Keeps the place of a response that is unpacked in the background,
+	// the data received after it waits until the slot is filled or dropped.
+	[[nodiscard]] uint64 reserveReceivedSlot();
+	void fillReceivedSlot(
+		uint64 slot,
+		mtpRequestId requestId,
+		ReceivedSlice &&response);
+	void dropReceivedSlot(uint64 slot);
 
 	// SessionPrivate -> Session interface.
 	void queueTryToReceive();
@@ -113,8 +130,15 @@ public:
 	void detach();
 
 private:
+	struct Received {
+		mtpRequestId requestId = 0; // Zero for updates.
+		ReceivedSlice data;
+		uint64 slot = 0; // Non-zero while the data is not ready.
+	};
+
 	template <typename Callback>
 	void withSession(Callback &&callback);
+	[[nodiscard]] bool hasReadyReceived() const;
 
 	Session *_owner = nullptr;
 	mutable QMutex _ownerMutex;
@@ -123,14 +147,19 @@ private:
 	mutable QReadWriteLock _optionsLock;
 
 	base::flat_map<mtpRequestId, SerializedRequest> _toSend; // map of request_id -> request, that is waiting to be sent
+	base::flat_set<mtpRequestId> _cancelledSent;
 	QReadWriteLock _toSendLock;
 
 	base::flat_map<mtpMsgId, SerializedRequest> _haveSent; // map of msg_id -> request, that was sent
-	QReadWriteLock _haveSentLock;
 
-	base::flat_map<mtpRequestId, mtpBuffer> _receivedResponses; // map of request_id -> response that should be processed in the main thread
-	std::vector<mtpBuffer> _receivedUpdates; // list of updates that should be processed in the main thread
-	QReadWriteLock _haveReceivedLock;
+	// Responses and updates that should be processed in the main thread,
+	// in the order they were received. Not a ring queue: the reserved
+	// slots are filled in the middle of it when unpacked, and a worker
+	// drops its slot itself if the SessionPrivate is already destroyed.
+	std::deque<Received> _received;
+	uint64 _receivedSlotAutoIncrement = 0;
+	bool _tryToReceiveQueued = false;
+	QMutex _receivedMutex;
 
 };
 
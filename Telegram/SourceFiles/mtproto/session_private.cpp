@@ -11,6 +11,7 @@ https://github.com/telegramdesktop/tdesktop/blob/master/LEGAL
 #include "mtproto/details/mtproto_dcenter.h"
 #include "mtproto/details/mtproto_dump_to_text.h"
 #include "mtproto/details/mtproto_rsa_public_key.h"
+#include "mtproto/details/mtproto_ungzip.h"
 #include "mtproto/session.h"
 #include "mtproto/mtproto_rpc_sender.h"
 #include "mtproto/mtproto_dc_options.h"
@@ -19,7 +20,6 @@ https://github.com/telegramdesktop/tdesktop/blob/master/LEGAL
 #include "base/openssl_help.h"
 #include "base/qthelp_url.h"
 #include "base/unixtime.h"
-#include "zlib.h"
 
 namespace MTP {
 namespace details {
@@ -27,6 +27,10 @@ namespace {
 
 constexpr auto kIntSize = static_cast<int>(sizeof(mtpPrime));
 constexpr auto kWaitForBetterTimeout = crl::time(2000);
+constexpr auto kRaceEndpointsFirst = 2;
+constexpr auto kRaceStaggerDelay = crl::time(300);
+constexpr auto kUnknownEndpointLatency = crl::time(1000);
+constexpr auto kEndpointFailurePenalty = crl::time(2000);
 constexpr auto kMinConnectedTimeout = crl::time(1000);
 constexpr auto kMaxConnectedTimeout = crl::time(8000);
 constexpr auto kMinReceiveTimeout = crl::time(4000);
@@ -121,6 +125,20 @@ void WrapInvokeAfter(
 	return different;
 }
 
+[[nodiscard]] crl::time ExpectedLatency(
+		const std::optional<DcOptions::EndpointHistory> &history) {
+	if (!history) {
+		return kUnknownEndpointLatency;
+	}
+	// The first byte latency includes the connect one, when it is known.
+	const auto latency = history->firstByte
+		? history->firstByte
+		: history->latency
+		? history->latency
+		: kUnknownEndpointLatency;
+	return latency + history->failures * kEndpointFailurePenalty;
+}
+
 } // namespace
 
 SessionPrivate::SessionPrivate(
@@ -139,11 +157,13 @@ SessionPrivate::SessionPrivate(
 , _waitForConnectedTimer(thread, [=] { waitConnectedFailed(); })
 , _waitForReceivedTimer(thread, [=] { waitReceivedFailed(); })
 , _waitForBetterTimer(thread, [=] { waitBetterFailed(); })
+, _raceTimer(thread, [=] { startNextTestConnection(); })
 , _waitForReceived(kMinReceiveTimeout)
 , _waitForConnected(kMinConnectedTimeout)
 , _pingSender(thread, [=] { sendPingByTimer(); })
 , _checkSentRequestsTimer(thread, [=] { checkSentRequests(); })
-, _sessionData(std::move(data)) {
+, _sessionData(std::move(data))
+, _backgroundGuard(std::make_shared<BackgroundGuard>(this, _sessionData)) {
 	Expects(_shiftedDcId != 0);
 
 	moveToThread(thread);
@@ -155,6 +175,17 @@ SessionPrivate::SessionPrivate(
 }
 
 SessionPrivate::~SessionPrivate() {
+	{
+		QMutexLocker lock(&_backgroundGuard->mutex);
+		_backgroundGuard->that = nullptr;
+	}
+	// Results posted to us but not delivered yet are lost with this object.
+	if (!_ungzipSlots.empty()) {
+		for (const auto slot : base::take(_ungzipSlots)) {
+			_sessionData->dropReceivedSlot(slot);
+		}
+		_sessionData->queueTryToReceive();
+	}
 	releaseKeyCreationOnFail();
 	doDisconnect();
 
@@ -172,6 +203,10 @@ void SessionPrivate::appendTestConnection(
 	const auto priority = (qthelp::is_ipv6(ip) ? 0 : 1)
 		+ (protocol == DcOptions::Variants::Tcp ? 1 : 0)
 		+ (protocolSecret.empty() ? 0 : 1);
+
+	// Latency through a proxy tells nothing about the endpoint itself.
+	const auto trackHistory = !ip.isEmpty()
+		&& (_options->proxy.type == ProxyData::Type::None);
 	_testConnections.push_back({
 		AbstractConnection::Create(
 			_instance,
@@ -179,7 +214,19 @@ void SessionPrivate::appendTestConnection(
 			thread(),
 			protocolSecret,
 			_options->proxy),
-		priority
+		priority,
+		protocol,
+		ip,
+		port,
+		protocolSecret,
+		(trackHistory
+			? _instance->dcOptions().endpointHistory(
+				BareDcId(_shiftedDcId),
+				protocol,
+				ip.toStdString(),
+				port)
+			: std::nullopt),
+		trackHistory,
 	});
 	const auto weak = _testConnections.back().data.get();
 	connect(weak, &AbstractConnection::error, [=](int errorCode) {
@@ -205,13 +252,88 @@ void SessionPrivate::appendTestConnection(
 			instance->syncHttpUnixtime();
 		});
 	});
+}
+
+void SessionPrivate::startTestConnections() {
+	const auto known = ranges::any_of(
+		_testConnections,
+		[](const TestConnection &test) { return test.history.has_value(); });
+	if (!known) {
+		// Nothing to choose from, try everything at once.
+		for (auto &test : _testConnections) {
+			startTestConnection(test);
+		}
+		return;
+	}
+
+	// Race the endpoints that worked best before, start others staggered.
+	ranges::stable_sort(
+		_testConnections,
+		ranges::less(),
+		[](const TestConnection &test) {
+			return ExpectedLatency(test.history);
+		});
+	const auto count = int(_testConnections.size());
+	for (auto i = 0; i != std::min(count, kRaceEndpointsFirst); ++i) {
+		startTestConnection(_testConnections[i]);
+	}
+	if (count > kRaceEndpointsFirst) {
+		_raceTimer.callOnce(raceStaggerDelay());
+	}
+}
+
+crl::time SessionPrivate::raceStaggerDelay() const {
+	// Start every endpoint before the connect timeout restarts the race.
+	const auto notStarted = ranges::count_if(
+		_testConnections,
+		[](const TestConnection &test) { return !test.startedAt; });
+	return std::min(
+		kRaceStaggerDelay,
+		_waitForConnected / (int(notStarted) + 1));
+}
+
+void SessionPrivate::startTestConnection(TestConnection &test) {
+	Expects(!test.startedAt);
+
+	DEBUG_LOG(("MTP Info: starting connection %1, expected latency %2."
+		).arg(test.data->tag()
+		).arg(ExpectedLatency(test.history)));
 
+	test.startedAt = crl::now();
+	const auto weak = test.data.get();
+	const auto ip = test.ip;
+	const auto port = test.port;
+	const auto protocolSecret = test.protocolSecret;
 	const auto protocolDcId = getProtocolDcId();
-	InvokeQueued(_testConnections.back().data, [=] {
+	InvokeQueued(test.data, [=] {
 		weak->connectToServer(ip, port, protocolSecret, protocolDcId);
 	});
 }
 
+void SessionPrivate::startNextTestConnection() {
+	const auto notStarted = [](const TestConnection &test) {
+		return !test.startedAt;
+	};
+	const auto i = ranges::find_if(_testConnections, notStarted);
+	if (i == end(_testConnections)) {
+		return;
+	}
+	startTestConnection(*i);
+	if (ranges::any_of(_testConnections, notStarted)) {
+		_raceTimer.callOnce(raceStaggerDelay());
+	}
+}
+
+void SessionPrivate::ensureTestConnectionStarted() {
+	const auto started = ranges::any_of(
+		_testConnections,
+		[](const TestConnection &test) { return test.startedAt != 0; });
+	if (!started) {
+		_raceTimer.cancel();
+		startNextTestConnection();
+	}
+}
+
 int16 SessionPrivate::getProtocolDcId() const {
 	const auto dcId = BareDcId(_shiftedDcId);
 	const auto simpleDcId = isTemporaryDcId(dcId)
@@ -237,7 +359,6 @@ void SessionPrivate::checkSentRequests() {
 	}
 	auto requesting = false;
 	{
-		QReadLocker locker(_sessionData->haveSentMutex());
 		auto &haveSent = _sessionData->haveSentMap();
 		const auto haveSentCount = haveSent.size();
 		const auto checkAfter = kCheckSentRequestTimeout;
@@ -289,8 +410,10 @@ void SessionPrivate::destroyAllConnections() {
 	_waitForBetterTimer.cancel();
 	_waitForReceivedTimer.cancel();
 	_waitForConnectedTimer.cancel();
+	_raceTimer.cancel();
 	_testConnections.clear();
 	_connection = nullptr;
+	_chosenEndpoint = std::nullopt;
 }
 
 void SessionPrivate::cdnConfigChanged() {
@@ -436,7 +559,6 @@ mtpMsgId SessionPrivate::replaceMsgId(SerializedRequest &request, mtpMsgId newId
 	if (oldMsgId == newId) {
 		return newId;
 	}
-	// haveSentMutex() was locked in tryToSend()
 	auto &haveSent = _sessionData->haveSentMap();
 
 	while (_resendingIds.contains(newId)
@@ -529,6 +651,7 @@ void SessionPrivate::tryToSend() {
 		DEBUG_LOG(("MTP Info: not yet with auth key in dc %1.").arg(_shiftedDcId));
 		return;
 	}
+	cancelSent();
 
 	const auto needsLayer = !_sessionData->connectionInited();
 	const auto state = getState();
@@ -744,7 +867,6 @@ void SessionPrivate::tryToSend() {
 				if (toSendRequest.needAck()) {
 					toSendRequest->lastSentTime = crl::now();
 
-					QWriteLocker locker2(_sessionData->haveSentMutex());
 					auto &haveSent = _sessionData->haveSentMap();
 					haveSent.emplace(msgId, toSendRequest);
 
@@ -810,8 +932,6 @@ void SessionPrivate::tryToSend() {
 			// check for a valid container
 			auto bigMsgId = base::unixtime::mtproto_msg_id();
 
-			// the fact of this lock is used in replaceMsgId()
-			QWriteLocker locker2(_sessionData->haveSentMutex());
 			auto &haveSent = _sessionData->haveSentMap();
 
 			// prepare sent container
@@ -1026,6 +1146,7 @@ void SessionPrivate::connectToServer(bool afterConfig) {
 	DEBUG_LOG(("Connection Info: Connecting to %1 with %2 test connections."
 		).arg(_shiftedDcId
 		).arg(_testConnections.size()));
+	startTestConnections();
 
 	if (!_startedConnectingAt) {
 		_startedConnectingAt = crl::now();
@@ -1098,6 +1219,20 @@ void SessionPrivate::onReceivedSome() {
 	}
 	_oldConnectionTimer.callOnce(kMarkConnectionOldTimeout);
 	_waitForReceivedTimer.cancel();
+	if (_chosenEndpoint) {
+		const auto chosen = *base::take(_chosenEndpoint);
+		const auto instance = _instance;
+		const auto dcId = BareDcId(_shiftedDcId);
+		const auto latency = crl::now() - chosen.startedAt;
+		InvokeQueued(instance, [=] {
+			instance->dcOptions().recordEndpointFirstByte(
+				dcId,
+				chosen.protocol,
+				chosen.ip,
+				chosen.port,
+				latency);
+		});
+	}
 	if (_firstSentAt > 0) {
 		const auto ms = crl::now() - _firstSentAt;
 		DEBUG_LOG(("MTP Info: response in %1ms, _waitForReceived: %2ms"
@@ -1170,6 +1305,7 @@ void SessionPrivate::waitReceivedFailed() {
 
 void SessionPrivate::waitConnectedFailed() {
 	DEBUG_LOG(("MTP Info: can't connect in %1ms").arg(_waitForConnected));
+	const auto timeout = _waitForConnected;
 	auto maxTimeout = kMaxConnectedTimeout;
 	for (const auto &connection : _testConnections) {
 		accumulate_max(maxTimeout, connection.data->fullConnectTimeout());
@@ -1178,7 +1314,7 @@ void SessionPrivate::waitConnectedFailed() {
 		_waitForConnected = std::min(maxTimeout, 2 * _waitForConnected);
 	}
 
-	connectingTimedOut();
+	connectingTimedOut(timeout);
 
 	DEBUG_LOG(("MTP Info: immediate restart!"));
 	InvokeQueued(this, [=] { connectToServer(); });
@@ -1188,9 +1324,17 @@ void SessionPrivate::waitBetterFailed() {
 	confirmBestConnection();
 }
 
-void SessionPrivate::connectingTimedOut() {
+void SessionPrivate::connectingTimedOut(crl::time timeout) {
+	// The staggered connections share the deadline of the first ones,
+	// count a failure only for those that had the whole timeout.
+	const auto now = crl::now();
 	for (const auto &connection : _testConnections) {
-		connection.data->timedOut();
+		if (connection.startedAt) {
+			connection.data->timedOut();
+			if (now - connection.startedAt >= timeout) {
+				testConnectionFailed(connection.data.get());
+			}
+		}
 	}
 	doDisconnect();
 }
@@ -1234,19 +1378,26 @@ void SessionPrivate::handleReceived() {
 			return restart();
 		}
 
-		auto encryptedInts = ints + kExternalHeaderIntsCount;
 		auto encryptedIntsCount = (intsCount - kExternalHeaderIntsCount) & ~0x03U;
 		auto encryptedBytesCount = encryptedIntsCount * kIntSize;
-		auto decryptedBuffer = QByteArray(encryptedBytesCount, Qt::Uninitialized);
 		auto msgKey = *(MTPint128*)(ints + 2);
 
+		// We own intsBuffer here, so decrypt right in place.
+		const auto decryptedData = intsBuffer.data() + kExternalHeaderIntsCount;
 #ifdef TDESKTOP_MTPROTO_OLD
-		aesIgeDecrypt_oldmtp(encryptedInts, decryptedBuffer.data(), encryptedBytesCount, _encryptionKey, msgKey);
+		aesIgeDecrypt_oldmtp(decryptedData, decryptedData, encryptedBytesCount, _encryptionKey, msgKey);
 #else // TDESKTOP_MTPROTO_OLD
-		aesIgeDecrypt(encryptedInts, decryptedBuffer.data(), encryptedBytesCount, _encryptionKey, msgKey);
+		auto sha256Buffer = bytes::array<32>();
+		aesIgeDecryptInPlaceWithHash(
+			bytes::make_span(
+				reinterpret_cast<bytes::type*>(decryptedData),
+				encryptedBytesCount),
+			_encryptionKey,
+			msgKey,
+			sha256Buffer);
 #endif // TDESKTOP_MTPROTO_OLD
 
-		auto decryptedInts = reinterpret_cast<const mtpPrime*>(decryptedBuffer.constData());
+		auto decryptedInts = static_cast<const mtpPrime*>(decryptedData);
 		auto serverSalt = *(uint64*)&decryptedInts[0];
 		auto session = *(uint64*)&decryptedInts[2];
 		auto msgId = *(uint64*)&decryptedInts[4];
@@ -1256,7 +1407,6 @@ void SessionPrivate::handleReceived() {
 		auto messageLength = *(uint32*)&decryptedInts[7];
 		if (messageLength > kMaxMessageLength) {
 			LOG(("TCP Error: bad messageLength %1").arg(messageLength));
-			TCP_LOG(("TCP Error: bad message %1").arg(Logs::mb(ints, intsCount * kIntSize).str()));
 
 			return restart();
 
@@ -1277,7 +1427,7 @@ void SessionPrivate::handleReceived() {
 		constexpr auto kMsgKeyShift_oldmtp = 4U;
 		if (ConstTimeIsDifferent(&msgKey, sha1ForMsgKeyCheck.data() + kMsgKeyShift_oldmtp, sizeof(msgKey))) {
 			LOG(("TCP Error: bad SHA1 hash after aesDecrypt in message."));
-			TCP_LOG(("TCP Error: bad message %1").arg(Logs::mb(encryptedInts, encryptedBytesCount).str()));
+			TCP_LOG(("TCP Error: bad message, length %1, msg_key %2").arg(encryptedBytesCount).arg(Logs::mb(&msgKey, sizeof(msgKey)).str()));
 
 			return restart();
 		}
@@ -1286,18 +1436,10 @@ void SessionPrivate::handleReceived() {
 		constexpr auto kMaxPaddingSize = 1024U;
 		auto badMessageLength = (paddingSize < kMinPaddingSize || paddingSize > kMaxPaddingSize);
 
-		std::array<uchar, 32> sha256Buffer = { { 0 } };
-
-		SHA256_CTX msgKeyLargeContext;
-		SHA256_Init(&msgKeyLargeContext);
-		SHA256_Update(&msgKeyLargeContext, _encryptionKey->partForMsgKey(false), 32);
-		SHA256_Update(&msgKeyLargeContext, decryptedInts, encryptedBytesCount);
-		SHA256_Final(sha256Buffer.data(), &msgKeyLargeContext);
-
 		constexpr auto kMsgKeyShift = 8U;
 		if (ConstTimeIsDifferent(&msgKey, sha256Buffer.data() + kMsgKeyShift, sizeof(msgKey))) {
 			LOG(("TCP Error: bad SHA256 hash after aesDecrypt in message"));
-			TCP_LOG(("TCP Error: bad message %1").arg(Logs::mb(encryptedInts, encryptedBytesCount).str()));
+			TCP_LOG(("TCP Error: bad message, length %1, msg_key %2").arg(encryptedBytesCount).arg(Logs::mb(&msgKey, sizeof(msgKey)).str()));
 
 			return restart();
 		}
@@ -1305,7 +1447,7 @@ void SessionPrivate::handleReceived() {
 
 		if (badMessageLength || (messageLength & 0x03)) {
 			LOG(("TCP Error: bad msg_len received %1, data size: %2").arg(messageLength).arg(encryptedBytesCount));
-			TCP_LOG(("TCP Error: bad message %1").arg(Logs::mb(encryptedInts, encryptedBytesCount).str()));
+			TCP_LOG(("TCP Error: bad message, length %1, msg_key %2").arg(encryptedBytesCount).arg(Logs::mb(&msgKey, sizeof(msgKey)).str()));
 
 			return restart();
 		}
@@ -1363,7 +1505,7 @@ void SessionPrivate::handleReceived() {
 			).arg(_encryptionKey->keyId()));
 
 		if (_receivedMessageIds.registerMsgId(msgId, needAck)) {
-			res = handleOneReceived(from, end, msgId, serverTime, serverSalt, badTime);
+			res = handleOneReceived(intsBuffer, from, end, msgId, serverTime, serverSalt, badTime);
 		}
 		_receivedMessageIds.shrink();
 
@@ -1373,15 +1515,7 @@ void SessionPrivate::handleReceived() {
 			_sessionData->queueSendAnything(kAckSendWaiting);
 		}
 
-		auto lock = QReadLocker(_sessionData->haveReceivedMutex());
-		const auto tryToReceive = !_sessionData->haveReceivedResponses().empty()
-			|| !_sessionData->haveReceivedUpdates().empty();
-		lock.unlock();
-
-		if (tryToReceive) {
-			DEBUG_LOG(("MTP Info: queueTryToReceive() - need to parse in another thread, %1 responses, %2 updates.").arg(_sessionData->haveReceivedResponses().size()).arg(_sessionData->haveReceivedUpdates().size()));
-			_sessionData->queueTryToReceive();
-		}
+		_sessionData->queueTryToReceive();
 
 		if (res != HandleResult::Success && res != HandleResult::Ignored) {
 			if (res == HandleResult::DestroyTemporaryKey) {
@@ -1407,6 +1541,7 @@ void SessionPrivate::handleReceived() {
 }
 
 SessionPrivate::HandleResult SessionPrivate::handleOneReceived(
+		const mtpBuffer &buffer,
 		const mtpPrime *from,
 		const mtpPrime *end,
 		uint64 msgId,
@@ -1419,11 +1554,11 @@ SessionPrivate::HandleResult SessionPrivate::handleOneReceived(
 
 	case mtpc_gzip_packed: {
 		DEBUG_LOG(("Message Info: gzip container"));
-		mtpBuffer response = ungzip(++from, end);
+		mtpBuffer response = Ungzip(++from, end);
 		if (response.empty()) {
 			return HandleResult::RestartConnection;
 		}
-		return handleOneReceived(response.data(), response.data() + response.size(), msgId, serverTime, serverSalt, badTime);
+		return handleOneReceived(response, response.constData(), response.constData() + response.size(), msgId, serverTime, serverSalt, badTime);
 	}
 
 	case mtpc_msg_container: {
@@ -1475,7 +1610,7 @@ SessionPrivate::HandleResult SessionPrivate::handleOneReceived(
 
 			auto res = HandleResult::Success; // if no need to handle, then succeed
 			if (_receivedMessageIds.registerMsgId(inMsgId.v, needAck)) {
-				res = handleOneReceived(from, otherEnd, inMsgId.v, serverTime, serverSalt, badTime);
+				res = handleOneReceived(buffer, from, otherEnd, inMsgId.v, serverTime, serverSalt, badTime);
 				badTime = false;
 			}
 			if (res != HandleResult::Success) {
@@ -1589,8 +1724,9 @@ SessionPrivate::HandleResult SessionPrivate::handleOneReceived(
 				)).write(response);
 
 				// Save rpc_error for processing in the main thread.
-				QWriteLocker locker(_sessionData->haveReceivedMutex());
-				_sessionData->haveReceivedResponses().emplace(requestId, response);
+				_sessionData->addReceivedResponse(
+					requestId,
+					ReceivedSlice(std::move(response)));
 			} else {
 				DEBUG_LOG(("Message Error: "
 					"such message was not sent recently %1").arg(badMsgId));
@@ -1752,7 +1888,7 @@ SessionPrivate::HandleResult SessionPrivate::handleOneReceived(
 		if (from + 3 > end) {
 			return HandleResult::ParseError;
 		}
-		auto response = mtpBuffer();
+		auto response = ReceivedSlice();
 
 		MTPlong reqMsgId;
 		if (!reqMsgId.read(++from, end)) {
@@ -1772,43 +1908,26 @@ SessionPrivate::HandleResult SessionPrivate::handleOneReceived(
 			}
 		}
 
-		mtpTypeId typeId = from[0];
-		if (typeId == mtpc_gzip_packed) {
+		const auto typeId = mtpTypeId(from[0]);
+		if (typeId == mtpc_gzip_packed
+			&& requestMsgId != _bindMsgId
+			&& UngzipInBackground(from + 1, end)) {
+			DEBUG_LOG(("RPC Info: large gzip container"));
+			ungzipInBackground(
+				requestMsgId,
+				ReceivedSlice(buffer, from + 1, end));
+			return HandleResult::Success;
+		} else if (typeId == mtpc_gzip_packed) {
 			DEBUG_LOG(("RPC Info: gzip container"));
-			response = ungzip(++from, end);
+			response = ReceivedSlice(Ungzip(++from, end));
 			if (response.empty()) {
 				return HandleResult::RestartConnection;
 			}
-			typeId = response[0];
-		} else {
-			response.resize(end - from);
-			memcpy(response.data(), from, (end - from) * sizeof(mtpPrime));
-		}
-		if (typeId == mtpc_rpc_error) {
-			if (IsDestroyedTemporaryKeyError(response)) {
-				return HandleResult::DestroyTemporaryKey;
-			}
-			// An error could be some RPC_CALL_FAIL or other error inside
-			// the initConnection, so we're not sure yet that it was inited.
-			// Wait till a good response is received.
-		} else {
-			_sessionData->notifyConnectionInited(*_options);
-		}
-		requestsAcked(ids, true);
-
-		const auto bindResult = handleBindResponse(requestMsgId, response);
-		if (bindResult != HandleResult::Ignored) {
-			return bindResult;
-		}
-		const auto requestId = wasSent(requestMsgId);
-		if (requestId && requestId != mtpRequestId(0xFFFFFFFF)) {
-			// Save rpc_result for processing in the main thread.
-			QWriteLocker locker(_sessionData->haveReceivedMutex());
-			_sessionData->haveReceivedResponses().emplace(requestId, response);
 		} else {
-			DEBUG_LOG(("RPC Info: requestId not found for msgId %1").arg(requestMsgId));
+			response = ReceivedSlice(buffer, from, end);
 		}
-	} return HandleResult::Success;
+		return handleRpcResult(requestMsgId, std::move(response));
+	}
 
 	case mtpc_new_session_created: {
 		const mtpPrime *start = from;
@@ -1833,7 +1952,6 @@ SessionPrivate::HandleResult SessionPrivate::handleOneReceived(
 		mtpMsgId firstMsgId = data.vfirst_msg_id().v;
 		QVector<quint64> toResend;
 		{
-			QReadLocker locker(_sessionData->haveSentMutex());
 			const auto &haveSent = _sessionData->haveSentMap();
 			toResend.reserve(haveSent.size());
 			for (const auto &[msgId, request] : haveSent) {
@@ -1848,12 +1966,8 @@ SessionPrivate::HandleResult SessionPrivate::handleOneReceived(
 			resend(msgId, 10, true);
 		}
 
-		mtpBuffer update(from - start);
-		if (from > start) memcpy(update.data(), start, (from - start) * sizeof(mtpPrime));
-
 		// Notify main process about new session - need to get difference.
-		QWriteLocker locker(_sessionData->haveReceivedMutex());
-		_sessionData->haveReceivedUpdates().push_back(mtpBuffer(update));
+		_sessionData->addReceivedUpdate(ReceivedSlice(buffer, start, from));
 	} return HandleResult::Success;
 
 	case mtpc_pong: {
@@ -1893,14 +2007,8 @@ SessionPrivate::HandleResult SessionPrivate::handleOneReceived(
 	}
 
 	if (_currentDcType == DcType::Regular) {
-		mtpBuffer update(end - from);
-		if (end > from) {
-			memcpy(update.data(), from, (end - from) * sizeof(mtpPrime));
-		}
-
 		// Notify main process about the new updates.
-		QWriteLocker locker(_sessionData->haveReceivedMutex());
-		_sessionData->haveReceivedUpdates().push_back(mtpBuffer(update));
+		_sessionData->addReceivedUpdate(ReceivedSlice(buffer, from, end));
 	} else {
 		LOG(("Message Error: unexpected updates in dcType: %1"
 			).arg(static_cast<int>(_currentDcType)));
@@ -1909,15 +2017,125 @@ SessionPrivate::HandleResult SessionPrivate::handleOneReceived(
 	return HandleResult::Success;
 }
 
+SessionPrivate::HandleResult SessionPrivate::handleRpcResult(
+		mtpMsgId requestMsgId,
+		ReceivedSlice &&response,
+		uint64 slot) {
+	Expects(!response.empty());
+
+	const auto dropSlot = [&] {
+		if (slot) {
+			_sessionData->dropReceivedSlot(slot);
+		}
+	};
+	if (response[0] == mtpc_rpc_error) {
+		if (IsDestroyedTemporaryKeyError(response.from(), response.till())) {
+			dropSlot();
+			return HandleResult::DestroyTemporaryKey;
+		}
+		// An error could be some RPC_CALL_FAIL or other error inside
+		// the initConnection, so we're not sure yet that it was inited.
+		// Wait till a good response is received.
+	} else {
+		_sessionData->notifyConnectionInited(*_options);
+	}
+	requestsAcked(QVector<MTPlong>(1, MTP_long(requestMsgId)), true);
+
+	const auto bindResult = handleBindResponse(requestMsgId, response);
+	if (bindResult != HandleResult::Ignored) {
+		dropSlot();
+		return bindResult;
+	}
+	const auto requestId = wasSent(requestMsgId);
+	if (requestId && requestId != mtpRequestId(0xFFFFFFFF)) {
+		// Save rpc_result for processing in the main thread.
+		if (slot) {
+			_sessionData->fillReceivedSlot(
+				slot,
+				requestId,
+				std::move(response));
+		} else {
+			_sessionData->addReceivedResponse(requestId, std::move(response));
+		}
+	} else {
+		DEBUG_LOG(("RPC Info: requestId not found for msgId %1").arg(requestMsgId));
+		dropSlot();
+	}
+	return HandleResult::Success;
+}
+
+void SessionPrivate::ungzipInBackground(
+		mtpMsgId requestMsgId,
+		ReceivedSlice packed) {
+	// Keep the place of this response among the received ones,
+	// so that the data received later won't be processed before it.
+	const auto slot = _sessionData->reserveReceivedSlot();
+	_ungzipSlots.emplace(slot);
+	crl::async([
+		=,
+		packed = std::move(packed),
+		guard = _backgroundGuard,
+		keyId = _keyId
+	] {
+		const auto response = ReceivedSlice(
+			Ungzip(packed.from(), packed.till()));
+
+		QMutexLocker lock(&guard->mutex);
+		if (const auto that = guard->that) {
+			InvokeQueued(that, [=] {
+				that->handleUngzipped(requestMsgId, slot, keyId, response);
+			});
+		} else {
+			guard->data->dropReceivedSlot(slot);
+			guard->data->queueTryToReceive();
+		}
+	});
+}
+
+void SessionPrivate::handleUngzipped(
+		mtpMsgId requestMsgId,
+		uint64 slot,
+		uint64 keyId,
+		ReceivedSlice response) {
+	_ungzipSlots.remove(slot);
+	if (keyId != _keyId) {
+		// The request will be resent with the new key.
+		_sessionData->dropReceivedSlot(slot);
+		_sessionData->queueTryToReceive();
+		return;
+	}
+	const auto result = [&] {
+		if (response.empty()) {
+			LOG(("RPC Error: could not unpack response for msgId %1."
+				).arg(requestMsgId));
+			_sessionData->dropReceivedSlot(slot);
+			return HandleResult::RestartConnection;
+		}
+		return handleRpcResult(requestMsgId, std::move(response), slot);
+	}();
+	_sessionData->queueTryToReceive();
+
+	if (result != HandleResult::Success) {
+		if (result == HandleResult::DestroyTemporaryKey) {
+			destroyTemporaryKey();
+		} else if (result == HandleResult::ResetSession) {
+			_needSessionReset = true;
+		}
+		restart();
+	}
+}
+
 SessionPrivate::HandleResult SessionPrivate::handleBindResponse(
 		mtpMsgId requestMsgId,
-		const mtpBuffer &response) {
+		const ReceivedSlice &response) {
 	if (!_keyCreator || !_bindMsgId || _bindMsgId != requestMsgId) {
 		return HandleResult::Ignored;
 	}
 	_bindMsgId = 0;
 
-	const auto result = _keyCreator->handleBindResponse(response);
+	const auto result = _keyCreator->handleBindResponse(
+		response.from(),
+		response.till());
 	switch (result) {
 	case DcKeyBindState::Success:
 		if (!_sessionData->releaseKeyCreationOnDone(
@@ -1939,58 +2157,6 @@ SessionPrivate::HandleResult SessionPrivate::handleBindResponse(
 	Unexpected("Result of BoundKeyCreator::handleBindResponse.");
 }
 
-mtpBuffer SessionPrivate::ungzip(const mtpPrime *from, const mtpPrime *end) const {
-	mtpBuffer result; // * 4 because of mtpPrime type
-	result.resize(0);
-
-	MTPstring packed;
-	if (!packed.read(from, end)) { // read packed string as serialized mtp string type
-		LOG(("RPC Error: could not read gziped bytes."));
-		return result;
-	}
-	uint32 packedLen = packed.v.size(), unpackedChunk = packedLen, unpackedLen = 0;
-
-	z_stream stream;
-	stream.zalloc = 0;
-	stream.zfree = 0;
-	stream.opaque = 0;
-	stream.avail_in = 0;
-	stream.next_in = 0;
-	int res = inflateInit2(&stream, 16 + MAX_WBITS);
-	if (res != Z_OK) {
-		LOG(("RPC Error: could not init zlib stream, code: %1").arg(res));
-		return result;
-	}
-	stream.avail_in = packedLen;
-	stream.next_in = reinterpret_cast<Bytef*>(packed.v.data());
-
-	stream.avail_out = 0;
-	while (!stream.avail_out) {
-		result.resize(result.size() + unpackedChunk);
-		stream.avail_out = unpackedChunk * sizeof(mtpPrime);
-		stream.next_out = (Bytef*)&result[result.size() - unpackedChunk];
-		int res = inflate(&stream, Z_NO_FLUSH);
-		if (res != Z_OK && res != Z_STREAM_END) {
-			inflateEnd(&stream);
-			LOG(("RPC Error: could not unpack gziped data, code: %1").arg(res));
-			DEBUG_LOG(("RPC Error: bad gzip: %1").arg(Logs::mb(packed.v.constData(), packedLen).str()));
-			return mtpBuffer();
-		}
-	}
-	if (stream.avail_out & 0x03) {
-		uint32 badSize = result.size() * sizeof(mtpPrime) - stream.avail_out;
-		LOG(("RPC Error: bad length of unpacked data %1").arg(badSize));
-		DEBUG_LOG(("RPC Error: bad unpacked data %1").arg(Logs::mb(result.data(), badSize).str()));
-		return mtpBuffer();
-	}
-	result.resize(result.size() - (stream.avail_out >> 2));
-	inflateEnd(&stream);
-	if (!result.size()) {
-		LOG(("RPC Error: bad length of unpacked data 0"));
-	}
-	return result;
-}
-
 bool SessionPrivate::requestsFixTimeSalt(const QVector<MTPlong> &ids, int32 serverTime, uint64 serverSalt) {
 	for (const auto &id : ids) {
 		if (wasSent(id.v)) {
@@ -2010,7 +2176,6 @@ void SessionPrivate::correctUnixtimeByFastRequest(
 		TimeId serverTime) {
 	const auto now = crl::now();
 
-	QReadLocker locker(_sessionData->haveSentMutex());
 	const auto &haveSent = _sessionData->haveSentMap();
 	for (const auto &id : ids) {
 		const auto i = haveSent.find(id.v);
@@ -2041,7 +2206,6 @@ void SessionPrivate::requestsAcked(const QVector<MTPlong> &ids, bool byResponse)
 
 	QVector<MTPlong> toAckMore;
 	{
-		QWriteLocker locker2(_sessionData->haveSentMutex());
 		auto &haveSent = _sessionData->haveSentMap();
 
 		for (const auto &wrappedMsgId : ids) {
@@ -2134,7 +2298,6 @@ void SessionPrivate::handleMsgsStates(const QVector<MTPlong> &ids, const QByteAr
 		const auto state = states[i];
 		const auto requestMsgId = ids[i].v;
 		{
-			QReadLocker locker(_sessionData->haveSentMutex());
 			if (!_sessionData->haveSentMap().contains(requestMsgId)) {
 				DEBUG_LOG(("Message Info: state was received for msgId %1, but request is not found, looking in resent requests...").arg(requestMsgId));
 				const auto reqIt = _resendingIds.find(requestMsgId);
@@ -2192,7 +2355,6 @@ void SessionPrivate::resend(
 		}
 		return;
 	}
-	auto lock = QWriteLocker(_sessionData->haveSentMutex());
 	auto &haveSent = _sessionData->haveSentMap();
 	auto i = haveSent.find(msgId);
 	if (i == haveSent.end()) {
@@ -2200,7 +2362,6 @@ void SessionPrivate::resend(
 	}
 	auto request = i->second;
 	haveSent.erase(i);
-	lock.unlock();
 
 	request->lastSentTime = crl::now();
 	request->forceSendInContainer = forceContainer;
@@ -2211,10 +2372,39 @@ void SessionPrivate::resend(
 	}
 }
 
+void SessionPrivate::cancelSent() {
+	auto cancelled = base::flat_set<mtpRequestId>();
+	{
+		// The request could be moved back to toSend by a resend.
+		QWriteLocker locker(_sessionData->toSendMutex());
+		cancelled = base::take(_sessionData->cancelledSentSet());
+		for (const auto requestId : cancelled) {
+			_sessionData->toSendMap().remove(requestId);
+		}
+	}
+	if (cancelled.empty()) {
+		return;
+	}
+	auto &haveSent = _sessionData->haveSentMap();
+	for (auto i = begin(haveSent); i != end(haveSent);) {
+		if (cancelled.contains(i->second->requestId)) {
+			i = haveSent.erase(i);
+		} else {
+			++i;
+		}
+	}
+	for (auto i = begin(_resendingIds); i != end(_resendingIds);) {
+		if (cancelled.contains(i->second)) {
+			i = _resendingIds.erase(i);
+		} else {
+			++i;
+		}
+	}
+}
+
 void SessionPrivate::resendAll() {
-	auto lock = QWriteLocker(_sessionData->haveSentMutex());
+	cancelSent();
 	auto haveSent = base::take(_sessionData->haveSentMap());
-	lock.unlock();
 	{
 		auto lock = QWriteLocker(_sessionData->toSendMutex());
 		auto &toSend = _sessionData->toSendMap();
@@ -2248,10 +2438,28 @@ void SessionPrivate::onConnected(
 		connection.get(),
 		[](const TestConnection &test) { return test.data.get(); });
 	Assert(i != end(_testConnections));
+	if (i->trackHistory) {
+		const auto instance = _instance;
+		const auto dcId = BareDcId(_shiftedDcId);
+		const auto protocol = i->protocol;
+		const auto ip = i->ip.toStdString();
+		const auto port = i->port;
+		const auto latency = crl::now() - i->startedAt;
+		InvokeQueued(instance, [=] {
+			instance->dcOptions().recordEndpointConnected(
+				dcId,
+				protocol,
+				ip,
+				port,
+				latency);
+		});
+	}
 	const auto my = i->priority;
 	const auto j = ranges::find_if(
 		_testConnections,
-		[&](const TestConnection &test) { return test.priority > my; });
+		[&](const TestConnection &test) {
+			return test.startedAt && (test.priority > my);
+		});
 	if (j != end(_testConnections)) {
 		DEBUG_LOG(("MTP Info: connection %1 succeed, "
 			"waiting for %2.").arg(i->data->tag()).arg(j->data->tag()));
@@ -2259,20 +2467,22 @@ void SessionPrivate::onConnected(
 	} else {
 		DEBUG_LOG(("MTP Info: connection through IPv4 succeed."));
 		_waitForBetterTimer.cancel();
-		_connection = std::move(i->data);
-		_testConnections.clear();
+		_raceTimer.cancel();
+		chooseTestConnection(*i);
 		checkAuthKey();
 	}
 }
 
 void SessionPrivate::onDisconnected(
 		not_null<AbstractConnection*> connection) {
+	testConnectionFailed(connection);
 	removeTestConnection(connection);
 
 	if (_testConnections.empty()) {
 		destroyAllConnections();
 		restart();
 	} else {
+		ensureTestConnectionStarted();
 		confirmBestConnection();
 	}
 }
@@ -2295,12 +2505,26 @@ void SessionPrivate::confirmBestConnection() {
 	DEBUG_LOG(("MTP Info: can't connect through better, using %1."
 		).arg(i->data->tag()));
 
-	_connection = std::move(i->data);
-	_testConnections.clear();
+	_raceTimer.cancel();
+	chooseTestConnection(*i);
 
 	checkAuthKey();
 }
 
+void SessionPrivate::chooseTestConnection(TestConnection &test) {
+	// The first byte is measured for the chosen connection only.
+	_chosenEndpoint = test.trackHistory
+		? std::make_optional(ChosenEndpoint{
+			test.protocol,
+			test.ip.toStdString(),
+			test.port,
+			test.startedAt,
+		})
+		: std::nullopt;
+	_connection = std::move(test.data);
+	_testConnections.clear();
+}
+
 void SessionPrivate::removeTestConnection(
 		not_null<AbstractConnection*> connection) {
 	_testConnections.erase(
@@ -2311,6 +2535,28 @@ void SessionPrivate::removeTestConnection(
 		end(_testConnections));
 }
 
+void SessionPrivate::testConnectionFailed(
+		not_null<AbstractConnection*> connection) {
+	const auto i = ranges::find(
+		_testConnections,
+		connection.get(),
+		[](const TestConnection &test) { return test.data.get(); });
+	if (i == end(_testConnections)
+		|| !i->trackHistory
+		|| !i->startedAt
+		|| i->data->isConnected()) {
+		return;
+	}
+	const auto instance = _instance;
+	const auto dcId = BareDcId(_shiftedDcId);
+	const auto protocol = i->protocol;
+	const auto ip = i->ip.toStdString();
+	const auto port = i->port;
+	InvokeQueued(instance, [=] {
+		instance->dcOptions().recordEndpointFailed(dcId, protocol, ip, port);
+	});
+}
+
 void SessionPrivate::checkAuthKey() {
 	if (_keyId) {
 		authKeyChecked();
@@ -2533,11 +2779,13 @@ void SessionPrivate::onError(
 			instance->badConfigurationError();
 		});
 	}
+	testConnectionFailed(connection);
 	removeTestConnection(connection);
 
 	if (_testConnections.empty()) {
 		handleError(errorCode);
 	} else {
+		ensureTestConnectionStarted();
 		confirmBestConnection();
 	}
 }
@@ -2668,7 +2916,6 @@ mtpRequestId SessionPrivate::wasSent(mtpMsgId msgId) const {
 	}
 
 	{
-		QReadLocker locker(_sessionData->haveSentMutex());
 		const auto &haveSent = _sessionData->haveSentMap();
 		const auto i = haveSent.find(msgId);
 		if (i != haveSent.end()) {
@@ -50,13 +50,40 @@ public:
 	void restartNow();
 	void sendPingForce();
 	void tryToSend();
+	void cancelSent();
 
 private:
 	static constexpr auto kUpdateStateAlways = 666;
 
+	// Lets the background unpacking post its result to this object.
+	struct BackgroundGuard {
+		BackgroundGuard(
+			not_null<SessionPrivate*> that,
+			std::shared_ptr<SessionData> data)
+		: that(that)
+		, data(std::move(data)) {
+		}
+
+		QMutex mutex;
+		SessionPrivate *that = nullptr;
+		const std::shared_ptr<SessionData> data;
+	};
 	struct TestConnection {
 		ConnectionPointer data;
 		int priority = 0;
+		DcOptions::Variants::Protocol protocol = DcOptions::Variants::Tcp;
+		QString ip;
+		int port = 0;
+		bytes::vector protocolSecret;
+		std::optional<DcOptions::EndpointHistory> history;
+		bool trackHistory = false;
+		crl::time startedAt = 0;
+	};
+	struct ChosenEndpoint {
+		DcOptions::Variants::Protocol protocol = DcOptions::Variants::Tcp;
+		std::string ip;
+		int port = 0;
+		crl::time startedAt = 0;
 	};
 	struct SentContainer {
 		crl::time sent = 0;
@@ -72,7 +99,7 @@ private:
 	};
 
 	void connectToServer(bool afterConfig = false);
-	void connectingTimedOut();
+	void connectingTimedOut(crl::time timeout);
 	void doDisconnect();
 	void restart();
 	void requestCDNConfig();
@@ -97,6 +124,13 @@ private:
 
 	void confirmBestConnection();
 	void removeTestConnection(not_null<AbstractConnection*> connection);
+	void testConnectionFailed(not_null<AbstractConnection*> connection);
+	void startTestConnections();
+	void startTestConnection(TestConnection &test);
+	void startNextTestConnection();
+	void ensureTestConnectionStarted();
+	[[nodiscard]] crl::time raceStaggerDelay() const;
+	void chooseTestConnection(TestConnection &test);
 	[[nodiscard]] int16 getProtocolDcId() const;
 
 	void checkSentRequests();
@@ -120,11 +154,21 @@ private:
 		bool needAnyResponse);
 	mtpRequestId wasSent(mtpMsgId msgId) const;
 
-	[[nodiscard]] HandleResult handleOneReceived(const mtpPrime *from, const mtpPrime *end, uint64 msgId, int32 serverTime, uint64 serverSalt, bool badTime);
+	// [from, end) must point inside the buffer, slices of it are shared.
+	[[nodiscard]] HandleResult handleOneReceived(const mtpBuffer &buffer, const mtpPrime *from, const mtpPrime *end, uint64 msgId, int32 serverTime, uint64 serverSalt, bool badTime);
 	[[nodiscard]] HandleResult handleBindResponse(
 		mtpMsgId requestMsgId,
-		const mtpBuffer &response);
-	mtpBuffer ungzip(const mtpPrime *from, const mtpPrime *end) const;
+		const ReceivedSlice &response);
+	[[nodiscard]] HandleResult handleRpcResult(
+		mtpMsgId requestMsgId,
+		ReceivedSlice &&response,
+		uint64 slot = 0);
+	void ungzipInBackground(mtpMsgId requestMsgId, ReceivedSlice packed);
+	void handleUngzipped(
+		mtpMsgId requestMsgId,
+		uint64 slot,
+		uint64 keyId,
+		ReceivedSlice response);
 	void handleMsgsStates(const QVector<MTPlong> &ids, const QByteArray &states);
 
 	// _sessionDataMutex must be locked for read.
@@ -186,6 +230,7 @@ private:
 
 	ConnectionPointer _connection;
 	std::vector<TestConnection> _testConnections;
+	std::optional<ChosenEndpoint> _chosenEndpoint;
 	crl::time _startedConnectingAt = 0;
 
 	base::Timer _retryTimer; // exp retry timer
@@ -198,6 +243,7 @@ private:
 	base::Timer _waitForConnectedTimer;
 	base::Timer _waitForReceivedTimer;
 	base::Timer _waitForBetterTimer;
+	base::Timer _raceTimer;
 	crl::time _waitForReceived = 0;
 	crl::time _waitForConnected = 0;
 	crl::time _firstSentAt = -1;
@@ -210,6 +256,10 @@ private:
 	base::Timer _checkSentRequestsTimer;
 
 	std::shared_ptr<SessionData> _sessionData;
+	const std::shared_ptr<BackgroundGuard> _backgroundGuard;
+
+	// Received slots reserved for responses being unpacked in background.
+	base::flat_set<uint64> _ungzipSlots;
 	std::unique_ptr<SessionOptions> _options;
 	AuthKeyPtr _encryptionKey;
 	uint64 _keyId = 0;
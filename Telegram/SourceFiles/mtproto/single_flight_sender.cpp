@@ -0,0 +1,153 @@
+/*
+This file is part of Telegram Desktop,
+the official desktop application for the Telegram messaging service.
+
+For license and copyright information please follow this link:
+https://github.com/telegramdesktop/tdesktop/blob/master/LEGAL
+*/
+#include "mtproto/single_flight_sender.h"
+
+namespace MTP {
+namespace {
+
+constexpr auto kLogStatsEach = 100;
+
+} // namespace
+
+SingleFlightSender::SingleFlightSender(not_null<Instance*> instance)
+: _instance(instance) {
+}
+
+SingleFlightSender::~SingleFlightSender() {
+	for (const auto &[key, inFlight] : base::take(_inFlight)) {
+		_instance->cancel(inFlight.requestId);
+	}
+}
+
+auto SingleFlightSender::send(
+	Key &&key,
+	RawParse parse,
+	RawDone &&done,
+	RawFail &&fail,
+	RawSend &&sendRequest)
+-> WaiterId {
+	const auto id = ++_waiterIdAutoIncrement;
+	auto waiter = Waiter{ id, std::move(done), std::move(fail) };
+	if (const auto i = _inFlight.find(key); i != end(_inFlight)) {
+		++_stats.merged;
+		logStats();
+
+		i->second.waiters.push_back(std::move(waiter));
+		return id;
+	}
+	++_stats.sent;
+	logStats();
+
+	const auto weak = base::make_weak(this);
+	const auto onDone = [=](const mtpPrime *from, const mtpPrime *end) {
+		const auto strong = weak.get();
+		return !strong || strong->handleDone(key, from, end);
+	};
+	const auto onFail = [=](const RPCError &error) {
+		if (isDefaultHandledError(error)) {
+			return false;
+		} else if (const auto strong = weak.get()) {
+			strong->handleFail(key, error);
+		}
+		return true;
+	};
+	auto &inFlight = _inFlight[key];
+	inFlight.parse = parse;
+	inFlight.waiters.push_back(std::move(waiter));
+
+	// Instance may fail the request right away, so lookup it again.
+	const auto requestId = sendRequest(
+		rpcDone(onDone),
+		rpcFail(onFail),
+		key.dcId);
+	if (const auto i = _inFlight.find(key); i != end(_inFlight)) {
+		i->second.requestId = requestId;
+	}
+	return id;
+}
+
+bool SingleFlightSender::handleDone(
+		const Key &key,
+		const mtpPrime *from,
+		const mtpPrime *end) {
+	auto i = _inFlight.find(key);
+	if (i == _inFlight.end()) {
+		return true;
+	}
+	auto inFlight = std::move(i->second);
+	_inFlight.erase(i);
+
+	// Deliver only the responses that can be parsed.
+	const auto parsed = inFlight.parse(from, end);
+	if (!parsed) {
+		LOG(("API Error: Could not parse a shared request response."));
+		const auto error = RPCError::Local(
+			"RESPONSE_PARSE_FAILED",
+			"Response parse failed.");
+		for (auto &waiter : inFlight.waiters) {
+			if (waiter.fail) {
+				waiter.fail(error);
+			}
+		}
+		return false;
+	}
+	for (auto &waiter : inFlight.waiters) {
+		waiter.done(parsed.get());
+	}
+	return true;
+}
+
+void SingleFlightSender::handleFail(const Key &key, const RPCError &error) {
+	auto i = _inFlight.find(key);
+	if (i == _inFlight.end()) {
+		return;
+	}
+	auto inFlight = std::move(i->second);
+	_inFlight.erase(i);
+
+	for (auto &waiter : inFlight.waiters) {
+		if (waiter.fail) {
+			waiter.fail(error);
+		}
+	}
+}
+
+void SingleFlightSender::cancel(WaiterId waiterId) {
+	if (!waiterId) {
+		return;
+	}
+	for (auto i = _inFlight.begin(); i != _inFlight.end(); ++i) {
+		auto &waiters = i->second.waiters;
+		const auto j = ranges::find(waiters, waiterId, &Waiter::id);
+		if (j == end(waiters)) {
+			continue;
+		}
+		waiters.erase(j);
+		if (waiters.empty()) {
+			_instance->cancel(i->second.requestId);
+			_inFlight.erase(i);
+		}
+		return;
+	}
+}
+
+auto SingleFlightSender::stats() const -> Stats {
+	return _stats;
+}
+
+void SingleFlightSender::logStats() const {
+	const auto total = _stats.sent + _stats.merged;
+	if (total % kLogStatsEach) {
+		return;
+	}
+	DEBUG_LOG(("API Info: Shared requests sent %1, merged %2."
+		).arg(_stats.sent
+		).arg(_stats.merged));
+}
+
+} // namespace MTP
@@ -0,0 +1,199 @@
+/*
+This file is part of Telegram Desktop,
+the official desktop application for the Telegram messaging service.
+
+For license and copyright information please follow this link:
+https://github.com/telegramdesktop/tdesktop/blob/master/LEGAL
+*/
+#pragma once
+
+#include "base/weak_ptr.h"
+#include "base/flat_map.h"
+#include "mtproto/mtproto_rpc_sender.h"
+#include "mtproto/mtp_instance.h"
+
+namespace MTP {
+
+// Merges identical requests (same serialized TL bytes to the same dc)
+// that are in flight into one network request, delivering the response
+// to every caller.
+class SingleFlightSender final : public base::has_weak_ptr {
+public:
+	using WaiterId = uint64;
+
+	struct Stats {
+		int64 sent = 0;
+		int64 merged = 0;
+	};
+
+	explicit SingleFlightSender(not_null<Instance*> instance);
+	~SingleFlightSender();
+
+	template <typename Request>
+	class SpecificRequestBuilder final {
+	public:
+		using Response = typename Request::ResponseType;
+
+		SpecificRequestBuilder(const SpecificRequestBuilder &other) = delete;
+		SpecificRequestBuilder(SpecificRequestBuilder &&other) = default;
+
+		[[nodiscard]] SpecificRequestBuilder &toDC(
+				ShiftedDcId dcId) noexcept {
+			_dcId = dcId;
+			return *this;
+		}
+		[[nodiscard]] SpecificRequestBuilder &afterDelay(
+				crl::time ms) noexcept {
+			_canWait = ms;
+			return *this;
+		}
+		[[nodiscard]] SpecificRequestBuilder &done(
+				FnMut<void(const Response &result)> callback) {
+			_done = std::move(callback);
+			return *this;
+		}
+		[[nodiscard]] SpecificRequestBuilder &fail(
+				FnMut<void(const RPCError &error)> callback) {
+			_fail = std::move(callback);
+			return *this;
+		}
+
+		WaiterId send();
+
+	private:
+		friend class SingleFlightSender;
+		SpecificRequestBuilder(
+			not_null<SingleFlightSender*> sender,
+			Request &&request) noexcept
+		: _sender(sender)
+		, _request(std::move(request)) {
+		}
+
+		not_null<SingleFlightSender*> _sender;
+		Request _request;
+		ShiftedDcId _dcId = 0;
+		crl::time _canWait = 0;
+		FnMut<void(const Response &result)> _done;
+		FnMut<void(const RPCError &error)> _fail;
+
+	};
+
+	template <
+		typename Request,
+		typename = std::enable_if_t<!std::is_reference_v<Request>>,
+		typename = typename Request::Unboxed>
+	[[nodiscard]] SpecificRequestBuilder<Request> request(
+			Request &&request) noexcept {
+		return SpecificRequestBuilder<Request>(this, std::move(request));
+	}
+
+	void cancel(WaiterId waiterId);
+
+	[[nodiscard]] Stats stats() const;
+
+private:
+	template <typename Request>
+	friend class SpecificRequestBuilder;
+
+	// The response is parsed once and every waiter gets the same object.
+	using RawParsed = std::shared_ptr<const void>;
+	using RawParse = RawParsed(*)(const mtpPrime *from, const mtpPrime *end);
+	using RawDone = FnMut<void(const void *result)>;
+	using RawFail = FnMut<void(const RPCError &error)>;
+	using RawSend = FnMut<mtpRequestId(
+		RPCDoneHandlerPtr &&onDone,
+		RPCFailHandlerPtr &&onFail,
+		ShiftedDcId dcId)>;
+
+	struct Key {
+		QByteArray serialized;
+		ShiftedDcId dcId = 0;
+
+		friend inline bool operator<(const Key &a, const Key &b) {
+			return (a.dcId < b.dcId)
+				|| (a.dcId == b.dcId && a.serialized < b.serialized);
+		}
+	};
+	struct Waiter {
+		WaiterId id = 0;
+		RawDone done;
+		RawFail fail;
+	};
+	struct InFlight {
+		mtpRequestId requestId = 0;
+		RawParse parse = nullptr;
+		std::vector<Waiter> waiters;
+	};
+
+	template <typename Request>
+	[[nodiscard]] static QByteArray Serialize(const Request &request);
+
+	WaiterId send(
+		Key &&key,
+		RawParse parse,
+		RawDone &&done,
+		RawFail &&fail,
+		RawSend &&sendRequest);
+	bool handleDone(const Key &key, const mtpPrime *from, const mtpPrime *end);
+	void handleFail(const Key &key, const RPCError &error);
+	void logStats() const;
+
+	const not_null<Instance*> _instance;
+	base::flat_map<Key, InFlight> _inFlight;
+	WaiterId _waiterIdAutoIncrement = 0;
+	Stats _stats;
+
+};
+
+template <typename Request>
+QByteArray SingleFlightSender::Serialize(const Request &request) {
+	auto buffer = mtpBuffer();
+	buffer.reserve(tl::count_length(request) >> 2);
+	request.template write<mtpBuffer>(buffer);
+	return QByteArray(
+		reinterpret_cast<const char*>(buffer.constData()),
+		buffer.size() * sizeof(mtpPrime));
+}
+
+template <typename Request>
+auto SingleFlightSender::SpecificRequestBuilder<Request>::send()
+-> WaiterId {
+	auto key = Key{ Serialize(_request), _dcId };
+	const auto parse = [](
+			const mtpPrime *from,
+			const mtpPrime *end) -> RawParsed {
+		auto result = std::make_shared<Response>();
+		if (!result->read(from, end)) {
+			return nullptr;
+		}
+		return result;
+	};
+	auto done = [callback = std::move(_done)](const void *result) mutable {
+		if (callback) {
+			callback(*static_cast<const Response*>(result));
+		}
+	};
+	auto send = [
+		instance = _sender->_instance,
+		request = std::move(_request),
+		canWait = _canWait
+	](
+			RPCDoneHandlerPtr &&onDone,
+			RPCFailHandlerPtr &&onFail,
+			ShiftedDcId dcId) {
+		return instance->send(
+			request,
+			std::move(onDone),
+			std::move(onFail),
+			dcId,
+			canWait);
+	};
+	return _sender->send(
+		std::move(key),
+		parse,
+		std::move(done),
+		std::move(_fail),
+		std::move(send));
+}
+
+} // namespace MTP
@@ -987,6 +987,7 @@ void Document::paint(Painter &p, const QRect &clip, TextSelection selection, con
 	const auto cornerDownload = downloadInCorner();
 
 	_dataMedia->automaticLoad(parent()->fullId(), parent());
+	_data->markLoadShown();
 	const auto loaded = dataLoaded();
 	const auto displayLoading = _data->displayLoading();
 
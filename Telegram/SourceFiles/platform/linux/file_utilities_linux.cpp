@@ -16,6 +16,10 @@ https://github.com/telegramdesktop/tdesktop/blob/master/LEGAL
 
 #include <QtGui/QDesktopServices>
 
+#ifdef Q_OS_LINUX
+#include <fcntl.h>
+#endif // Q_OS_LINUX
+
 extern "C" {
 #undef signals
 #include <gio/gio.h>
@@ -69,6 +73,16 @@ void UnsafeLaunch(const QString &filepath) {
 	}
 }
 
+bool Preallocate(QFile &file, int64 size) {
+#ifdef Q_OS_LINUX
+	// Not all filesystems support it, resize the file in that case.
+	if (!fallocate(file.handle(), 0, 0, size)) {
+		return true;
+	}
+#endif // Q_OS_LINUX
+	return file.resize(size);
+}
+
 } // namespace File
 
 namespace FileDialog {
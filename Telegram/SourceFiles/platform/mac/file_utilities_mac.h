@@ -23,6 +23,10 @@ inline void UnsafeOpenEmailLink(const QString &email) {
 inline void PostprocessDownloaded(const QString &filepath) {
 }
 
+inline bool Preallocate(QFile &file, int64 size) {
+	return file.resize(size);
+}
+
 } // namespace File
 
 namespace FileDialog {
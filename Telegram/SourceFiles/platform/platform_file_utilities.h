@@ -23,6 +23,9 @@ void UnsafeLaunch(const QString &filepath);
 
 void PostprocessDownloaded(const QString &filepath);
 
+// Reserves the disk space for the whole file, the file must be open.
+bool Preallocate(QFile &file, int64 size);
+
 } // namespace File
 
 namespace FileDialog {
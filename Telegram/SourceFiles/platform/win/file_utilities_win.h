@@ -20,5 +20,9 @@ inline void UnsafeOpenUrl(const QString &url) {
 	return ::File::internal::UnsafeOpenUrlDefault(url);
 }
 
+inline bool Preallocate(QFile &file, int64 size) {
+	return file.resize(size);
+}
+
 } // namespace File
 } // namespace Platform
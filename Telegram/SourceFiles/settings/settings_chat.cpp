@@ -17,6 +17,7 @@ https://github.com/telegramdesktop/tdesktop/blob/master/LEGAL
 #include "boxes/download_path_box.h"
 #include "boxes/local_storage_box.h"
 #include "boxes/edit_color_box.h"
+#include "boxes/single_choice_box.h"
 #include "ui/wrap/vertical_layout.h"
 #include "ui/wrap/slide_wrap.h"
 #include "ui/widgets/input_fields.h"
@@ -28,6 +29,7 @@ https://github.com/telegramdesktop/tdesktop/blob/master/LEGAL
 #include "ui/effects/radial_animation.h"
 #include "ui/toast/toast.h"
 #include "ui/image/image.h"
+#include "ui/text/format_values.h"
 #include "lang/lang_keys.h"
 #include "export/export_manager.h"
 #include "window/themes/window_theme.h"
@@ -37,6 +39,7 @@ https://github.com/telegramdesktop/tdesktop/blob/master/LEGAL
 #include "window/window_session_controller.h"
 #include "window/window_controller.h"
 #include "storage/localstorage.h"
+#include "storage/download_manager_mtproto.h"
 #include "core/file_utilities.h"
 #include "core/application.h"
 #include "data/data_session.h"
@@ -46,6 +49,7 @@ https://github.com/telegramdesktop/tdesktop/blob/master/LEGAL
 #include "base/platform/base_platform_info.h"
 #include "platform/platform_specific.h"
 #include "base/call_delayed.h"
+#include "base/timer_rpl.h"
 #include "support/support_common.h"
 #include "support/support_templates.h"
 #include "main/main_session.h"
@@ -62,6 +66,15 @@ namespace {
 
 const auto kSchemesList = Window::Theme::EmbeddedThemes();
 constexpr auto kCustomColorButtonParts = 7;
+constexpr auto kDownloadRatesUpdateTimeout = crl::time(1000);
+constexpr auto kDownloadSpeedLimits = std::array<int64, 6>{ {
+	0,
+	256 * 1024,
+	512 * 1024,
+	1024 * 1024,
+	2 * 1024 * 1024,
+	5 * 1024 * 1024,
+} };
 
 class ColorsPalette final {
 public:
@@ -365,6 +378,71 @@ void ColorsPalette::updateInnerGeometry() {
 	inner->resize(inner->width(), y + size);
 }
 
+[[nodiscard]] QString DownloadSpeedText(int64 bytesPerSecond) {
+	return tr::lng_download_speed_value(
+		tr::now,
+		lt_size,
+		Ui::FormatSizeText(bytesPerSecond));
+}
+
+[[nodiscard]] QString DownloadSpeedLimitText(int64 limit) {
+	return limit
+		? DownloadSpeedText(limit)
+		: tr::lng_download_speed_limit_none(tr::now);
+}
+
+void DownloadSpeedLimitBox(
+		not_null<Ui::GenericBox*> box,
+		not_null<Main::Session*> session) {
+	const auto options = ranges::view::all(
+		kDownloadSpeedLimits
+	) | ranges::view::transform(DownloadSpeedLimitText) | ranges::to_vector;
+	const auto i = ranges::find(
+		kDownloadSpeedLimits,
+		Core::App().settings().downloadSpeedLimit());
+	const auto currentOption = (i != end(kDownloadSpeedLimits))
+		? int(i - begin(kDownloadSpeedLimits))
+		: 0;
+	SingleChoiceBox(box, {
+		.title = tr::lng_download_speed_limit(),
+		.options = options,
+		.initialSelection = currentOption,
+		.callback = [=](int option) {
+			Core::App().settings().setDownloadSpeedLimit(
+				kDownloadSpeedLimits[option]);
+			Core::App().saveSettingsDelayed();
+		},
+	});
+
+	const auto weak = base::make_weak(session.get());
+	auto rates = rpl::single(
+	) | rpl::then(
+		base::timer_each(kDownloadRatesUpdateTimeout)
+	) | rpl::filter([=] {
+		return weak.get() != nullptr;
+	}) | rpl::map([=] {
+		const auto rates = weak->downloader().rates();
+		return tr::lng_download_speed_now(
+			tr::now,
+			lt_speed,
+			DownloadSpeedText(rates.total),
+			lt_streaming,
+			DownloadSpeedText(rates.streaming));
+	});
+	box->addRow(
+		object_ptr<Ui::FlatLabel>(
+			box,
+			tr::lng_download_speed_limit_about(),
+			st::boxDividerLabel),
+		st::boxRowPadding);
+	box->addRow(
+		object_ptr<Ui::FlatLabel>(
+			box,
+			std::move(rates),
+			st::boxDividerLabel),
+		st::boxRowPadding);
+}
+
 } // namespace
 
 class BackgroundRow : public Ui::RpWidget {
@@ -879,6 +957,16 @@ void SetupDataStorage(
 
 	}, ask->lifetime());
 
+	AddButtonWithLabel(
+		container,
+		tr::lng_download_speed_limit(),
+		Core::App().settings().downloadSpeedLimitValue(
+		) | rpl::map(DownloadSpeedLimitText),
+		st::settingsButton
+	)->addClickHandler([=] {
+		Ui::show(Box(DownloadSpeedLimitBox, &controller->session()));
+	});
+
 	SetupLocalStorage(controller, container);
 	SetupExport(controller, container);
 
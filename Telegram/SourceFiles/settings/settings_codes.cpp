@@ -21,6 +21,7 @@ https://github.com/telegramdesktop/tdesktop/blob/master/LEGAL
 #include "core/application.h"
 #include "mtproto/mtp_instance.h"
 #include "mtproto/mtproto_dc_options.h"
+#include "mtproto/details/mtproto_network_conditions.h"
 #include "core/file_utilities.h"
 #include "core/update_checker.h"
 #include "window/themes/window_theme.h"
@@ -115,6 +116,17 @@ auto GenerateCodes() {
 			}
 		});
 	});
+	codes.emplace(qsl("netconditions"), [](SessionController *window) {
+		FileDialog::GetOpenPath(Core::App().getFileDialogParent(), "Open network conditions", "Network conditions (*.tdesktop-network)", [](const FileDialog::OpenResult &result) {
+			if (!result.paths.isEmpty()) {
+				if (MTP::details::LoadNetworkConditions(result.paths.front())) {
+					Ui::Toast::Show("Network conditions will be applied to new connections.");
+				} else {
+					Ui::show(Box<InformBox>("Could not load network conditions :( Errors in 'log.txt'."));
+				}
+			}
+		});
+	});
 	codes.emplace(qsl("testmode"), [](SessionController *window) {
 		auto &domain = Core::App().domain();
 		if (domain.started()
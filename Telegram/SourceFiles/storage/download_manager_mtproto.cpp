@@ -11,6 +11,8 @@ https://github.com/telegramdesktop/tdesktop/blob/master/LEGAL
 #include "mtproto/mtproto_auth_key.h"
 #include "mtproto/mtproto_rpc_sender.h"
 #include "main/main_session.h"
+#include "core/application.h"
+#include "core/core_settings.h"
 #include "apiwrap.h"
 #include "base/openssl_help.h"
 
@@ -19,7 +21,11 @@ namespace {
 
 constexpr auto kKillSessionTimeout = 15 * crl::time(1000);
 constexpr auto kStartWaitedInSession = 4 * kDownloadPartSize;
+constexpr auto kMinWaitedInSession = 2 * kDownloadPartSize;
 constexpr auto kMaxWaitedInSession = 16 * kDownloadPartSize;
+constexpr auto kEstimateWindow = 10 * crl::time(1000);
+constexpr auto kWindowGain = 2;
+constexpr auto kQueueingRttFactor = 3;
 constexpr auto kStartSessionsCount = 1;
 constexpr auto kMaxSessionsCount = 8;
 constexpr auto kMaxTrackedSessionRemoves = 64;
@@ -30,75 +36,105 @@ constexpr auto kMaxTrackedSuccesses = kRetryAddSessionSuccesses
 constexpr auto kRemoveSessionAfterTimeouts = 4;
 constexpr auto kResetDownloadPrioritiesTimeout = crl::time(200);
 constexpr auto kBadRequestDurationThreshold = 8 * crl::time(1000);
+constexpr auto kSpeedBudgetBurst = crl::time(500);
+constexpr auto kRatesWindow = 2 * crl::time(1000);
 
 // Each (session remove by timeouts) we wait for time:
 // kRetryAddSessionTimeout * max(removesCount, kMaxTrackedSessionRemoves)
 // and for successes in all remaining sessions:
 // kRetryAddSessionSuccesses * max(removesCount, kMaxTrackedSessionRemoves)
 
+// The in-flight window of each session follows the bandwidth-delay
+// product: kWindowGain * bandwidth * minRtt, where bandwidth is the max
+// delivery rate and minRtt is the min request duration seen recently.
+// While the window is full and requests don't queue up it grows by one
+// part. When durations exceed kQueueingRttFactor * minRtt the max rate is
+// aged towards the current one and the window drops to the smaller of its
+// half and the new target.
+
+[[nodiscard]] int RoundToParts(int64 amount) {
+	constexpr auto kMaxParts = kMaxWaitedInSession / kDownloadPartSize;
+	const auto parts = std::clamp(
+		(amount + kDownloadPartSize - 1) / kDownloadPartSize,
+		int64(0),
+		int64(kMaxParts));
+	return std::clamp(
+		int(parts) * kDownloadPartSize,
+		kMinWaitedInSession,
+		kMaxWaitedInSession);
+}
+
 } // namespace
 
 void DownloadManagerMtproto::Queue::enqueue(
 		not_null<Task*> task,
 		int priority) {
-	const auto position = ranges::find_if(_tasks, [&](const Enqueued &task) {
-		return task.priority <= priority;
-	}) - begin(_tasks);
-	const auto now = ranges::find(_tasks, task, &Enqueued::task);
-	const auto i = [&] {
-		if (now != end(_tasks)) {
-			(now->priority = priority);
-			return now;
-		}
-		_tasks.push_back({ task, priority });
-		return end(_tasks) - 1;
-	}();
-	const auto j = begin(_tasks) + position;
-	if (j < i) {
-		std::rotate(j, i, i + 1);
-	} else if (j > i + 1) {
-		std::rotate(i, i + 1, j);
+	remove(task);
+	const auto i = _tasks.insert(
+		Enqueued{ task, priority, _generation, ++_order }).first;
+	_positions.emplace(task, i);
+}
+
+void DownloadManagerMtproto::Queue::refresh(not_null<Task*> task) {
+	const auto i = _positions.find(task);
+	if (i != end(_positions)) {
+		i->second->generation = _generation;
 	}
 }
 
 void DownloadManagerMtproto::Queue::remove(not_null<Task*> task) {
-	_tasks.erase(ranges::remove(_tasks, task, &Enqueued::task), end(_tasks));
+	const auto i = _positions.find(task);
+	if (i != end(_positions)) {
+		_tasks.erase(i->second);
+		_positions.erase(i);
+	}
 }
 
-void DownloadManagerMtproto::Queue::resetGeneration() {
-	const auto from = ranges::find(_tasks, 0, &Enqueued::priority);
-	for (auto &task : ranges::make_subrange(from, end(_tasks))) {
-		if (task.priority) {
-			Assert(task.priority == -1);
+auto DownloadManagerMtproto::Queue::resetGeneration()
+-> std::vector<not_null<Task*>> {
+	auto result = std::vector<not_null<Task*>>();
+	for (const auto &enqueued : _tasks) {
+		if (enqueued.priority != kViewportDownloadPriority) {
 			break;
+		} else if (enqueued.generation != _generation) {
+			result.push_back(enqueued.task);
 		}
-		task.priority = -1;
 	}
+	++_generation;
+	return result;
+}
+
+bool DownloadManagerMtproto::Queue::hasViewportPriority() const {
+	return !_tasks.empty()
+		&& (_tasks.begin()->priority == kViewportDownloadPriority);
 }
 
 bool DownloadManagerMtproto::Queue::empty() const {
 	return _tasks.empty();
 }
 
+int DownloadManagerMtproto::Queue::topPriority() const {
+	return _tasks.empty()
+		? kDefaultDownloadPriority
+		: _tasks.begin()->priority;
+}
+
 auto DownloadManagerMtproto::Queue::nextTask(bool onlyHighestPriority) const
 -> Task* {
 	if (_tasks.empty()) {
 		return nullptr;
 	}
-	const auto highestPriority = _tasks.front().priority;
-	const auto notHighestPriority = [&](const Enqueued &enqueued) {
-		return (enqueued.priority != highestPriority);
-	};
-	const auto till = (onlyHighestPriority && highestPriority > 0)
-		? ranges::find_if(_tasks, notHighestPriority)
-		: end(_tasks);
-	const auto readyToRequest = [&](const Enqueued &enqueued) {
-		return enqueued.task->readyToRequest();
-	};
-	const auto first = ranges::find_if(
-		ranges::make_subrange(begin(_tasks), till),
-		readyToRequest);
-	return (first != till) ? first->task.get() : nullptr;
+	const auto highestPriority = _tasks.begin()->priority;
+	const auto limited = onlyHighestPriority
+		&& IsStreamingDownloadPriority(highestPriority);
+	for (const auto &enqueued : _tasks) {
+		if (limited && enqueued.priority != highestPriority) {
+			break;
+		} else if (enqueued.task->readyToRequest()) {
+			return enqueued.task;
+		}
+	}
+	return nullptr;
 }
 
 void DownloadManagerMtproto::Queue::removeSession(int index) {
@@ -111,6 +147,37 @@ DownloadManagerMtproto::DcSessionBalanceData::DcSessionBalanceData()
 : maxWaitedAmount(kStartWaitedInSession) {
 }
 
+void DownloadManagerMtproto::DcSessionBalanceData::feedSample(
+		int amount,
+		crl::time duration,
+		crl::time now) {
+	duration = std::max(duration, crl::time(1));
+	if (!minRtt
+		|| duration <= minRtt
+		|| now - minRttWhen > kEstimateWindow) {
+		minRtt = duration;
+		minRttWhen = now;
+	}
+	const auto queueing = (duration > kQueueingRttFactor * minRtt);
+	const auto rate = int64(amount) * 1000 / duration;
+	if (rate >= bandwidth || now - bandwidthWhen > kEstimateWindow) {
+		bandwidth = rate;
+		bandwidthWhen = now;
+	} else if (queueing) {
+		bandwidth = std::max(rate, bandwidth / 2);
+		bandwidthWhen = now;
+	}
+	const auto target = RoundToParts(
+		kWindowGain * bandwidth * minRtt / 1000);
+	if (queueing) {
+		maxWaitedAmount = RoundToParts(std::min(maxWaitedAmount / 2, target));
+	} else if (target > maxWaitedAmount) {
+		maxWaitedAmount = target;
+	} else if (amount == maxWaitedAmount) {
+		maxWaitedAmount = RoundToParts(maxWaitedAmount + kDownloadPartSize);
+	}
+}
+
 DownloadManagerMtproto::DcBalanceData::DcBalanceData()
 : sessions(kStartSessionsCount) {
 }
@@ -118,7 +185,13 @@ DownloadManagerMtproto::DcBalanceData::DcBalanceData()
 DownloadManagerMtproto::DownloadManagerMtproto(not_null<ApiWrap*> api)
 : _api(api)
 , _resetGenerationTimer([=] { resetGeneration(); })
-, _killSessionsTimer([=] { killSessions(); }) {
+, _killSessionsTimer([=] { killSessions(); })
+, _speedBudgetTimer([=] { checkSendNext(); }) {
+	Core::App().settings().downloadSpeedLimitValue(
+	) | rpl::start_with_next([=](int64 limit) {
+		setSpeedLimit(limit);
+	}, _lifetime);
+
 	_api->instance().restartsByTimeout(
 	) | rpl::filter([](MTP::ShiftedDcId shiftedDcId) {
 		return MTP::isDownloadDcId(shiftedDcId);
@@ -143,6 +216,13 @@ void DownloadManagerMtproto::enqueue(not_null<Task*> task, int priority) {
 	checkSendNext(dcId, queue);
 }
 
+void DownloadManagerMtproto::refresh(not_null<Task*> task) {
+	const auto i = _queues.find(task->dcId());
+	if (i != end(_queues)) {
+		i->second.refresh(task);
+	}
+}
+
 void DownloadManagerMtproto::remove(not_null<Task*> task) {
 	const auto dcId = task->dcId();
 	auto &queue = _queues[dcId];
@@ -151,18 +231,36 @@ void DownloadManagerMtproto::remove(not_null<Task*> task) {
 }
 
 void DownloadManagerMtproto::resetGeneration() {
+	// The viewport priority is kept only while the task is refreshed,
+	// the expired tasks are enqueued again with their own priorities.
 	_resetGenerationTimer.cancel();
+	auto expired = std::vector<not_null<Task*>>();
 	for (auto &[dcId, queue] : _queues) {
-		queue.resetGeneration();
+		auto tasks = queue.resetGeneration();
+		expired.insert(end(expired), begin(tasks), end(tasks));
+	}
+	for (const auto task : expired) {
+		task->viewportPriorityExpired();
+	}
+	const auto viewport = ranges::any_of(_queues, [](const auto &pair) {
+		return pair.second.hasViewportPriority();
+	});
+	if (viewport && !_resetGenerationTimer.isActive()) {
+		_resetGenerationTimer.callOnce(kResetDownloadPrioritiesTimeout);
 	}
 }
 
 void DownloadManagerMtproto::checkSendNext() {
-	for (auto &[dcId, queue] : _queues) {
-		if (queue.empty()) {
-			continue;
+	// The speed budget should go to the highest priority tasks first.
+	auto order = std::vector<std::pair<int, MTP::DcId>>();
+	for (const auto &[dcId, queue] : _queues) {
+		if (!queue.empty()) {
+			order.emplace_back(queue.topPriority(), dcId);
 		}
-		checkSendNext(dcId, queue);
+	}
+	ranges::sort(order, ranges::greater());
+	for (const auto &[priority, dcId] : order) {
+		checkSendNext(dcId, _queues[dcId]);
 	}
 }
 
@@ -193,11 +291,77 @@ bool DownloadManagerMtproto::trySendNextPart(MTP::DcId dcId, Queue &queue) {
 		return false;
 	}
 	const auto onlyHighestPriority = (balanceData.totalRequested > 0);
-	if (const auto task = queue.nextTask(onlyHighestPriority)) {
-		task->loadPart(bestIndex);
+	const auto task = queue.nextTask(onlyHighestPriority);
+	if (!task || !takeSpeedBudget()) {
+		return false;
+	}
+	task->loadPart(bestIndex);
+	return true;
+}
+
+void DownloadManagerMtproto::setSpeedLimit(int64 limit) {
+	if (_speedLimit == limit) {
+		return;
+	}
+	_speedLimit = std::max(limit, int64(0));
+	_speedBudget = 0;
+	_speedBudgetUpdated = crl::now();
+	_speedBudgetTimer.cancel();
+	checkSendNext();
+}
+
+bool DownloadManagerMtproto::takeSpeedBudget() {
+	if (!_speedLimit) {
 		return true;
 	}
-	return false;
+	const auto now = crl::now();
+	const auto burst = std::max(
+		_speedLimit * kSpeedBudgetBurst / 1000,
+		int64(kDownloadPartSize));
+	_speedBudget = std::min(
+		_speedBudget + _speedLimit * (now - _speedBudgetUpdated) / 1000,
+		burst);
+	_speedBudgetUpdated = now;
+	if (_speedBudget < kDownloadPartSize) {
+		if (!_speedBudgetTimer.isActive()) {
+			const auto wait = (kDownloadPartSize - _speedBudget) * 1000
+				/ _speedLimit;
+			_speedBudgetTimer.callOnce(std::max(wait, crl::time(1)));
+		}
+		return false;
+	}
+	_speedBudget -= kDownloadPartSize;
+	return true;
+}
+
+void DownloadManagerMtproto::partReceived(int priority, int size) {
+	const auto now = crl::now();
+	while (!_received.empty()
+		&& _received.front().when + kRatesWindow <= now) {
+		_received.pop_front();
+	}
+	_received.push_back({
+		now,
+		size,
+		IsStreamingDownloadPriority(priority),
+	});
+}
+
+auto DownloadManagerMtproto::rates() const -> Rates {
+	const auto now = crl::now();
+	auto result = Rates();
+	for (const auto &received : _received) {
+		if (received.when + kRatesWindow <= now) {
+			continue;
+		}
+		result.total += received.size;
+		if (received.streaming) {
+			result.streaming += received.size;
+		}
+	}
+	result.total = result.total * 1000 / kRatesWindow;
+	result.streaming = result.streaming * 1000 / kRatesWindow;
+	return result;
 }
 
 int DownloadManagerMtproto::changeRequestedAmount(
@@ -257,15 +421,16 @@ void DownloadManagerMtproto::requestSucceeded(
 		});
 		return;
 	}
-	if (amountAtRequestStart == data.maxWaitedAmount
-		&& data.maxWaitedAmount < kMaxWaitedInSession) {
-		data.maxWaitedAmount = std::min(
-			data.maxWaitedAmount + kDownloadPartSize,
-			kMaxWaitedInSession);
-		DEBUG_LOG(("Download (%1,%2) increased max waited amount %3."
+	const auto wasWaitedAmount = data.maxWaitedAmount;
+	data.feedSample(amountAtRequestStart, duration, crl::now());
+	if (data.maxWaitedAmount != wasWaitedAmount) {
+		DEBUG_LOG(("Download (%1,%2) max waited amount %3, "
+			"min rtt: %4, bandwidth: %5."
 			).arg(dcId
 			).arg(index
-			).arg(data.maxWaitedAmount));
+			).arg(data.maxWaitedAmount
+			).arg(data.minRtt
+			).arg(data.bandwidth));
 	}
 	data.successes = std::min(data.successes + 1, kMaxTrackedSuccesses);
 	const auto notEnough = ranges::any_of(
@@ -865,9 +1030,14 @@ void DownloadMtprotoTask::cancelRequest(mtpRequestId requestId) {
 }
 
 void DownloadMtprotoTask::addToQueue(int priority) {
+	_priority = priority;
 	_owner->enqueue(this, priority);
 }
 
+void DownloadMtprotoTask::refreshInQueue() {
+	_owner->refresh(this);
+}
+
 void DownloadMtprotoTask::removeFromQueue() {
 	_owner->remove(this);
 }
@@ -875,6 +1045,7 @@ void DownloadMtprotoTask::removeFromQueue() {
 void DownloadMtprotoTask::partLoaded(
 		int offset,
 		const QByteArray &bytes) {
+	_owner->partReceived(_priority, bytes.size());
 	feedPart(offset, bytes);
 }
 
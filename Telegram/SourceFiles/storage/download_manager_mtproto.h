@@ -22,12 +22,31 @@ namespace Storage {
 // fixed part size download for hash checking.
 constexpr auto kDownloadPartSize = 128 * 1024;
 
+// Download priority classes, from the most important one: the media that
+// is loaded to be shown after painting or a click, streaming playback with
+// its own priorities from 1 up to kViewportDownloadPriority - 1, automatic
+// loads to memory, cache or disk and, last, the files saved on request.
+constexpr auto kViewportDownloadPriority = 16;
+constexpr auto kDefaultDownloadPriority = 0;
+constexpr auto kAutoDownloadPriority = -1;
+constexpr auto kSaveDownloadPriority = -2;
+
+[[nodiscard]] constexpr bool IsStreamingDownloadPriority(int priority) {
+	return (priority > kDefaultDownloadPriority)
+		&& (priority < kViewportDownloadPriority);
+}
+
 class DownloadMtprotoTask;
 
 class DownloadManagerMtproto final : public base::has_weak_ptr {
 public:
 	using Task = DownloadMtprotoTask;
 
+	struct Rates {
+		int64 total = 0; // Bytes per second.
+		int64 streaming = 0;
+	};
+
 	explicit DownloadManagerMtproto(not_null<ApiWrap*> api);
 	~DownloadManagerMtproto();
 
@@ -36,6 +55,7 @@ public:
 	}
 
 	void enqueue(not_null<Task*> task, int priority);
+	void refresh(not_null<Task*> task);
 	void remove(not_null<Task*> task);
 
 	void notifyTaskFinished() {
@@ -54,30 +74,64 @@ public:
 	void checkSendNextAfterSuccess(MTP::DcId dcId);
 	[[nodiscard]] int chooseSessionIndex(MTP::DcId dcId) const;
 
+	void partReceived(int priority, int size);
+	[[nodiscard]] Rates rates() const;
+
 private:
 	class Queue final {
 	public:
 		void enqueue(not_null<Task*> task, int priority);
+		void refresh(not_null<Task*> task);
 		void remove(not_null<Task*> task);
-		void resetGeneration();
+
+		// Returns the tasks with the viewport priority that were not
+		// enqueued or refreshed since the previous call.
+		[[nodiscard]] std::vector<not_null<Task*>> resetGeneration();
+		[[nodiscard]] bool hasViewportPriority() const;
 		[[nodiscard]] bool empty() const;
+		[[nodiscard]] int topPriority() const;
 		[[nodiscard]] Task *nextTask(bool onlyHighestPriority) const;
 		void removeSession(int index);
 
 	private:
+		// Ordered by priority, then the most recently enqueued tasks go
+		// first. The generation is not a part of the order, it is updated
+		// in place when the task is refreshed.
 		struct Enqueued {
 			not_null<Task*> task;
 			int priority = 0;
+			mutable int generation = 0;
+			uint64 order = 0;
+
+			inline bool operator<(const Enqueued &other) const {
+				return std::tie(other.priority, other.order)
+					< std::tie(priority, order);
+			}
 		};
-		std::vector<Enqueued> _tasks;
+		std::set<Enqueued> _tasks;
+		std::unordered_map<
+			not_null<Task*>,
+			std::set<Enqueued>::const_iterator> _positions;
+		int _generation = 0;
+		uint64 _order = 0;
 
 	};
 	struct DcSessionBalanceData {
 		DcSessionBalanceData();
 
+		// Updates the estimates and the in-flight window by a request
+		// that was sent with 'amount' bytes in flight in this session.
+		void feedSample(int amount, crl::time duration, crl::time now);
+
 		int requested = 0;
 		int successes = 0; // Since last timeout in this dc in any session.
 		int maxWaitedAmount = 0;
+
+		// Windowed min of request durations and max of delivery rates.
+		crl::time minRtt = 0;
+		crl::time minRttWhen = 0;
+		int64 bandwidth = 0; // Bytes per second.
+		crl::time bandwidthWhen = 0;
 	};
 	struct DcBalanceData {
 		DcBalanceData();
@@ -89,11 +143,19 @@ private:
 		int timeouts = 0; // Since all sessions had successes >= required.
 		int totalRequested = 0;
 	};
+	struct Received {
+		crl::time when = 0;
+		int size = 0;
+		bool streaming = false;
+	};
 
 	void checkSendNext();
 	void checkSendNext(MTP::DcId dcId, Queue &queue);
 	bool trySendNextPart(MTP::DcId dcId, Queue &queue);
 
+	void setSpeedLimit(int64 limit);
+	[[nodiscard]] bool takeSpeedBudget();
+
 	void killSessionsSchedule(MTP::DcId dcId);
 	void killSessionsCancel(MTP::DcId dcId);
 	void killSessions();
@@ -114,6 +176,15 @@ private:
 	base::Timer _killSessionsTimer;
 
 	base::flat_map<MTP::DcId, Queue> _queues;
+
+	// Token bucket for the parts requested with the speed limit set.
+	int64 _speedLimit = 0; // Bytes per second, zero for no limit.
+	int64 _speedBudget = 0;
+	crl::time _speedBudgetUpdated = 0;
+	base::Timer _speedBudgetTimer;
+
+	std::deque<Received> _received;
+
 	rpl::lifetime _lifetime;
 
 };
@@ -143,6 +214,12 @@ public:
 	[[nodiscard]] const Location &location() const;
 
 	[[nodiscard]] virtual bool readyToRequest() const = 0;
+
+	// The task was enqueued with the viewport priority and was not
+	// enqueued or refreshed again during a reset generation period.
+	virtual void viewportPriorityExpired() {
+	}
+
 	void loadPart(int sessionIndex);
 	void removeSession(int sessionIndex);
 
@@ -157,7 +234,8 @@ protected:
 	void cancelAllRequests();
 	void cancelRequestForOffset(int offset);
 
-	void addToQueue(int priority = 0);
+	void addToQueue(int priority = kDefaultDownloadPriority);
+	void refreshInQueue();
 	void removeFromQueue();
 
 	[[nodiscard]] ApiWrap &api() const {
@@ -255,6 +333,7 @@ private:
 	// _location can be changed with an updated file_reference.
 	Location _location;
 	const Data::FileOrigin _origin;
+	int _priority = kDefaultDownloadPriority;
 
 	base::flat_map<mtpRequestId, RequestData> _sentRequests;
 	base::flat_map<int, mtpRequestId> _requestByOffset;
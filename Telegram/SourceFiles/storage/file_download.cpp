@@ -17,6 +17,7 @@ https://github.com/telegramdesktop/tdesktop/blob/master/LEGAL
 #include "storage/storage_account.h"
 #include "storage/file_download_mtproto.h"
 #include "storage/file_download_web.h"
+#include "storage/storage_file_writer.h"
 #include "platform/platform_file_utilities.h"
 #include "main/main_session.h"
 #include "apiwrap.h"
@@ -106,7 +107,6 @@ FileLoader::FileLoader(
 , _autoLoading(autoLoading)
 , _cacheTag(cacheTag)
 , _filename(toFile)
-, _file(_filename)
 , _toCache(toCache)
 , _fromCloud(fromCloud)
 , _loadSize(loadSize)
@@ -117,7 +117,7 @@ FileLoader::FileLoader(
 }
 
 FileLoader::~FileLoader() {
-	Expects(_finished);
+	Expects(_finished || _writing);
 }
 
 Main::Session &FileLoader::session() const {
@@ -128,28 +128,16 @@ void FileLoader::finishWithBytes(const QByteArray &data) {
 	_data = data;
 	_localStatus = LocalStatus::Loaded;
 	if (!_filename.isEmpty() && _toCache == LoadToCacheAsWell) {
-		if (!_fileIsOpen) _fileIsOpen = _file.open(QIODevice::WriteOnly);
-		if (!_fileIsOpen) {
-			cancel(true);
-			return;
-		}
-		_file.seek(0);
-		if (_file.write(_data) != qint64(_data.size())) {
-			cancel(true);
-			return;
-		}
+		// The data may be a raw data wrapper, so make a deep copy.
+		openWriter();
+		_writer->write(0, QByteArray(_data.constData(), _data.size()));
 	}
 
-	_finished = true;
-	if (_fileIsOpen) {
-		_file.close();
-		_fileIsOpen = false;
-		Platform::File::PostprocessDownloaded(
-			QFileInfo(_file).absoluteFilePath());
-	}
-	const auto session = _session;
-	_updates.fire_done();
-	session->notifyDownloaderTaskFinished();
+	finishWriting([=] {
+		const auto session = _session;
+		_updates.fire_done();
+		session->notifyDownloaderTaskFinished();
+	});
 }
 
 QImage FileLoader::imageData(int progressiveSizeLimit) const {
@@ -176,7 +164,7 @@ Data::FileOrigin FileLoader::fileOrigin() const {
 }
 
 float64 FileLoader::currentProgress() const {
-	return _finished
+	return (_finished || _writing)
 		? 1.
 		: !_loadSize
 		? 0.
@@ -188,7 +176,6 @@ bool FileLoader::setFileName(const QString &fileName) {
 		return fileName.isEmpty() || (fileName == _filename);
 	}
 	_filename = fileName;
-	_file.setFileName(_filename);
 	return true;
 }
 
@@ -204,6 +191,17 @@ void FileLoader::increaseLoadSize(int size, bool autoLoading) {
 	_autoLoading = autoLoading;
 }
 
+void FileLoader::markShown() {
+	const auto already = std::exchange(_shown, true);
+	if (_finished || _writing) {
+		return;
+	} else if (already) {
+		shownAgainHook();
+	} else {
+		shownHook();
+	}
+}
+
 void FileLoader::notifyAboutProgress() {
 	_updates.fire({});
 }
@@ -239,7 +237,7 @@ void FileLoader::localLoaded(
 }
 
 void FileLoader::start() {
-	if (_finished || tryLoadLocal()) {
+	if (_finished || _writing || tryLoadLocal()) {
 		return;
 	} else if (_fromCloud == LoadFromLocalOnly) {
 		cancel();
@@ -252,17 +250,102 @@ void FileLoader::start() {
 }
 
 bool FileLoader::checkForOpen() {
-	if (_filename.isEmpty()
-		|| (_toCache != LoadToFileOnly)
-		|| _fileIsOpen) {
+	if (_filename.isEmpty() || (_toCache != LoadToFileOnly)) {
 		return true;
+	} else if (!_writer) {
+		openWriter(resumableToFile());
 	}
-	_fileIsOpen = _file.open(QIODevice::WriteOnly);
-	if (_fileIsOpen) {
-		return true;
+
+	// Don't request the parts until the written ones are known.
+	return !_writerReading;
+}
+
+bool FileLoader::resumableToFile() const {
+	// Partial files are listed in the account storage, so they're cleaned
+	// up wherever they are, in the downloads folder or in a chosen one.
+	const auto key = cacheKey();
+	return supportsResumableFile()
+		&& (_fullSize > 0)
+		&& (_loadSize == _fullSize)
+		&& (key.low || key.high);
+}
+
+void FileLoader::openWriter(bool resumable) {
+	if (_writer) {
+		return;
 	}
-	cancel(true);
-	return false;
+	_writtenSize = 0;
+	_writerReading = resumable;
+	if (resumable) {
+		_session->local().addPartialDownload(_filename);
+	}
+	_writer = std::make_unique<Storage::FileWriter>(
+		_filename,
+		crl::guard(this, [=] {
+			if (!_cancelled) {
+				cancel(true);
+			}
+		}),
+		(resumable
+			? std::make_optional(Storage::FileWriter::Resumable{
+				cacheKey(),
+				_fullSize,
+				Storage::kDownloadPartSize })
+			: std::nullopt),
+		(resumable
+			? Fn<void()>([=] { _writerReading = false; start(); })
+			: nullptr));
+}
+
+void FileLoader::suspendWriter() {
+	// Keep the written parts, the download may be resumed later.
+	if (_writer && resumableToFile()) {
+		_writerReading = false;
+		base::take(_writer)->suspend();
+	}
+}
+
+void FileLoader::finishWriting(Fn<void()> done) {
+	if (!_writer) {
+		_finished = true;
+		done();
+		return;
+	}
+
+	// The loader is not finished until the file is closed and moved.
+	// If the loader is destroyed meanwhile the file is complete anyway,
+	// so the location is remembered without the loader.
+	_writing = true;
+	const auto cancelled = std::make_shared<bool>(false);
+	_writingCancelled = cancelled;
+	const auto session = _session.get();
+	const auto path = _filename;
+	const auto key = (_localStatus == LocalStatus::NotFound)
+		? fileLocationKey()
+		: std::nullopt;
+	const auto weak = base::make_weak(this);
+	_writer->finish(crl::guard(session, [=] {
+		if (*cancelled) {
+			return;
+		}
+		Platform::File::PostprocessDownloaded(
+			QFileInfo(path).absoluteFilePath());
+		session->local().removePartialDownloads({ path });
+		if (key) {
+			session->local().writeFileLocation(
+				*key,
+				Core::FileLocation(path));
+		}
+		if (const auto strong = weak.get()) {
+			strong->_writer = nullptr;
+			strong->_writingCancelled = nullptr;
+			strong->_writing = false;
+			strong->_finished = true;
+			done();
+		} else {
+			session->notifyDownloaderTaskFinished();
+		}
+	}));
 }
 
 void FileLoader::loadLocal(const Storage::Cache::Key &key) {
@@ -323,7 +406,7 @@ bool FileLoader::tryLoadLocal() {
 		}
 	}
 	if (_localStatus != LocalStatus::NotTried) {
-		return _finished;
+		return _finished || _writing;
 	} else if (_localLoading) {
 		_localStatus = LocalStatus::Loading;
 		return true;
@@ -343,10 +426,13 @@ void FileLoader::cancel(bool fail) {
 
 	_cancelled = true;
 	_finished = true;
-	if (_fileIsOpen) {
-		_file.close();
-		_fileIsOpen = false;
-		_file.remove();
+	_writing = false;
+	if (const auto cancelled = base::take(_writingCancelled)) {
+		*cancelled = true;
+	}
+	if (const auto writer = base::take(_writer)) {
+		writer->cancel();
+		_session->local().removePartialDownloads({ _filename });
 	}
 	_data = QByteArray();
 
@@ -358,34 +444,25 @@ void FileLoader::cancel(bool fail) {
 	}
 	if (weak) {
 		_filename = QString();
-		_file.setFileName(_filename);
 	}
 }
 
 int FileLoader::currentOffset() const {
-	return (_fileIsOpen ? _file.size() : _data.size()) - _skippedBytes;
+	return (_writer ? _writtenSize : _data.size()) - _skippedBytes;
 }
 
-bool FileLoader::writeResultPart(int offset, bytes::const_span buffer) {
-	Expects(!_finished);
+bool FileLoader::writeResultPart(int offset, const QByteArray &data) {
+	Expects(!_finished && !_writing);
 
-	if (buffer.empty()) {
+	if (data.isEmpty()) {
 		return true;
 	}
-	if (_fileIsOpen) {
-		auto fsize = _file.size();
-		if (offset < fsize) {
-			_skippedBytes -= buffer.size();
-		} else if (offset > fsize) {
-			_skippedBytes += offset - fsize;
-		}
-		_file.seek(offset);
-		if (_file.write(reinterpret_cast<const char*>(buffer.data()), buffer.size()) != qint64(buffer.size())) {
-			cancel(true);
-			return false;
-		}
+	if (_writer) {
+		markPartWritten(offset, data.size());
+		_writer->write(offset, data);
 		return true;
 	}
+	const auto buffer = bytes::make_span(data);
 	_data.reserve(offset + buffer.size());
 	if (offset > _data.size()) {
 		_skippedBytes += offset - _data.size();
@@ -406,23 +483,22 @@ bool FileLoader::writeResultPart(int offset, bytes::const_span buffer) {
 	return true;
 }
 
+void FileLoader::markPartWritten(int offset, int size) {
+	Expects(_writer != nullptr);
+
+	if (offset < _writtenSize) {
+		_skippedBytes -= size;
+	} else if (offset > _writtenSize) {
+		_skippedBytes += offset - _writtenSize;
+	}
+	accumulate_max(_writtenSize, offset + size);
+}
+
 QByteArray FileLoader::readLoadedPartBack(int offset, int size) {
 	Expects(offset >= 0 && size > 0);
 
-	if (_fileIsOpen) {
-		if (_file.openMode() == QIODevice::WriteOnly) {
-			_file.close();
-			_fileIsOpen = _file.open(QIODevice::ReadWrite);
-			if (!_fileIsOpen) {
-				cancel(true);
-				return QByteArray();
-			}
-		}
-		if (!_file.seek(offset)) {
-			return QByteArray();
-		}
-		auto result = _file.read(size);
-		return (result.size() == size) ? result : QByteArray();
+	if (_writer) {
+		return _writer->readBack(offset, size);
 	}
 	return (offset + size <= _data.size())
 		? _data.mid(offset, size)
@@ -430,34 +506,20 @@ QByteArray FileLoader::readLoadedPartBack(int offset, int size) {
 }
 
 bool FileLoader::finalizeResult() {
-	Expects(!_finished);
+	Expects(!_finished && !_writing);
 
 	if (!_filename.isEmpty() && (_toCache == LoadToCacheAsWell)) {
-		if (!_fileIsOpen) {
-			_fileIsOpen = _file.open(QIODevice::WriteOnly);
-		}
-		_file.seek(0);
-		if (!_fileIsOpen || _file.write(_data) != qint64(_data.size())) {
-			cancel(true);
-			return false;
-		}
+		openWriter();
+		_writer->write(0, _data);
 	}
 
-	_finished = true;
-	if (_fileIsOpen) {
-		_file.close();
-		_fileIsOpen = false;
-		Platform::File::PostprocessDownloaded(
-			QFileInfo(_file).absoluteFilePath());
-	}
+	finishWriting([=] { finalizeWritten(); });
+	return true;
+}
+
+void FileLoader::finalizeWritten() {
+	// The file location is written in finishWriting().
 	if (_localStatus == LocalStatus::NotFound) {
-		if (const auto key = fileLocationKey()) {
-			if (!_filename.isEmpty()) {
-				_session->local().writeFileLocation(
-					*key,
-					Core::FileLocation(_filename));
-			}
-		}
 		const auto key = cacheKey();
 		if ((_toCache == LoadToCacheAsWell)
 			&& (_data.size() <= Storage::kMaxFileInMemory)
@@ -474,7 +536,6 @@ bool FileLoader::finalizeResult() {
 	const auto session = _session;
 	_updates.fire_done();
 	session->notifyDownloaderTaskFinished();
-	return true;
 }
 
 std::unique_ptr<FileLoader> CreateFileLoader(
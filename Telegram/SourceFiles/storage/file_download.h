@@ -23,6 +23,7 @@ class Session;
 } // namespace Main
 
 namespace Storage {
+class FileWriter;
 namespace Cache {
 struct Key;
 } // namespace Cache
@@ -100,6 +101,10 @@ public:
 	void permitLoadFromCloud();
 	void increaseLoadSize(int size, bool autoLoading);
 
+	// The media is painted on screen, it is loaded before anything else.
+	// The mark expires if the media is not painted again for a while.
+	void markShown();
+
 	void start();
 	void cancel();
 
@@ -143,26 +148,45 @@ protected:
 	virtual void startLoadingWithPartial(const QByteArray &data) {
 		startLoading();
 	}
+	[[nodiscard]] virtual bool supportsResumableFile() const {
+		return false;
+	}
+	virtual void shownHook() {
+	}
+	virtual void shownAgainHook() {
+	}
 
 	void cancel(bool failed);
 
 	void notifyAboutProgress();
 
-	bool writeResultPart(int offset, bytes::const_span buffer);
+	// The data must not be a raw data wrapper, it's written asynchronously.
+	bool writeResultPart(int offset, const QByteArray &data);
+	void markPartWritten(int offset, int size);
 	bool finalizeResult();
 	[[nodiscard]] QByteArray readLoadedPartBack(int offset, int size);
 
+	[[nodiscard]] bool resumableToFile() const;
+	void openWriter(bool resumable = false);
+	void suspendWriter();
+	void finishWriting(Fn<void()> done);
+	void finalizeWritten();
+
 	const not_null<Main::Session*> _session;
 
 	bool _autoLoading = false;
+	bool _shown = false;
 	uint8 _cacheTag = 0;
 	bool _finished = false;
+	bool _writing = false; // The writer is finishing the file.
 	bool _cancelled = false;
 	mutable LocalStatus _localStatus = LocalStatus::NotTried;
 
 	QString _filename;
-	QFile _file;
-	bool _fileIsOpen = false;
+	std::unique_ptr<Storage::FileWriter> _writer;
+	std::shared_ptr<bool> _writingCancelled;
+	bool _writerReading = false; // The writer reads the written parts.
+	int _writtenSize = 0;
 
 	LoadToCacheSetting _toCache;
 	LoadFromCloudSetting _fromCloud;
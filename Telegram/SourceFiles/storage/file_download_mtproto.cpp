@@ -10,6 +10,7 @@ https://github.com/telegramdesktop/tdesktop/blob/master/LEGAL
 #include "data/data_document.h"
 #include "data/data_file_origin.h"
 #include "storage/cache/storage_cache_types.h"
+#include "storage/storage_file_writer.h"
 #include "main/main_session.h"
 #include "apiwrap.h"
 #include "mtproto/mtp_instance.h"
@@ -91,7 +92,8 @@ mtpFileLoader::mtpFileLoader(
 }
 
 mtpFileLoader::~mtpFileLoader() {
-	if (!_finished) {
+	if (!_finished && !_writing) {
+		suspendWriter();
 		cancel();
 	}
 }
@@ -106,6 +108,7 @@ uint64 mtpFileLoader::objId() const {
 
 bool mtpFileLoader::readyToRequest() const {
 	return !_finished
+		&& !_writing
 		&& !_lastComplete
 		&& (_fullSize != 0 || !haveSentRequests())
 		&& (!_fullSize || _nextRequestOffset < _loadSize);
@@ -116,12 +119,27 @@ int mtpFileLoader::takeNextRequestOffset() {
 
 	const auto result = _nextRequestOffset;
 	_nextRequestOffset += Storage::kDownloadPartSize;
+	skipWrittenParts();
 	return result;
 }
 
+void mtpFileLoader::skipWrittenParts() {
+	if (!_writer) {
+		return;
+	}
+	while (_nextRequestOffset < _loadSize
+		&& _writer->partWritten(
+			_nextRequestOffset / Storage::kDownloadPartSize)) {
+		markPartWritten(
+			_nextRequestOffset,
+			std::min(Storage::kDownloadPartSize, _fullSize - _nextRequestOffset));
+		_nextRequestOffset += Storage::kDownloadPartSize;
+	}
+}
+
 bool mtpFileLoader::feedPart(int offset, const QByteArray &bytes) {
 	const auto buffer = bytes::make_span(bytes);
-	if (!writeResultPart(offset, buffer)) {
+	if (!writeResultPart(offset, bytes)) {
 		return false;
 	}
 	if (buffer.empty() || (buffer.size() % 1024)) { // bad next offset
@@ -158,7 +176,46 @@ bool mtpFileLoader::setWebFileSizeHook(int size) {
 }
 
 void mtpFileLoader::startLoading() {
-	addToQueue();
+	skipWrittenParts();
+	if (_nextRequestOffset > 0 && _nextRequestOffset >= _loadSize) {
+		// All the parts were written by an interrupted previous attempt.
+		finalizeResult();
+		return;
+	}
+	_loadingStarted = true;
+	addToQueue(queuePriority());
+}
+
+int mtpFileLoader::queuePriority() const {
+	// The media painted on screen and the loads to memory started by a click
+	// are shown right away, automatic loads wait for everything else.
+	if (_shown) {
+		return Storage::kViewportDownloadPriority;
+	} else if (_autoLoading) {
+		return Storage::kAutoDownloadPriority;
+	} else if (_filename.isEmpty()) {
+		return Storage::kViewportDownloadPriority;
+	}
+	return Storage::kSaveDownloadPriority;
+}
+
+void mtpFileLoader::shownHook() {
+	if (_loadingStarted) {
+		addToQueue(queuePriority());
+	}
+}
+
+void mtpFileLoader::shownAgainHook() {
+	// Keep the viewport priority while the media is still painted.
+	if (_loadingStarted) {
+		refreshInQueue();
+	}
+}
+
+void mtpFileLoader::viewportPriorityExpired() {
+	// Not painted for a while, go back to the own priority class.
+	_shown = false;
+	addToQueue(queuePriority());
 }
 
 void mtpFileLoader::startLoadingWithPartial(const QByteArray &data) {
@@ -178,6 +235,10 @@ void mtpFileLoader::cancelHook() {
 	cancelAllRequests();
 }
 
+bool mtpFileLoader::supportsResumableFile() const {
+	return true;
+}
+
 Storage::Cache::Key mtpFileLoader::cacheKey() const {
 	return v::match(location().data, [&](const WebFileLocation &location) {
 		return Data::WebDocumentCacheKey(location);
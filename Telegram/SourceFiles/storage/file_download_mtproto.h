@@ -53,13 +53,21 @@ private:
 	void startLoading() override;
 	void startLoadingWithPartial(const QByteArray &data) override;
 	void cancelHook() override;
+	bool supportsResumableFile() const override;
+	void shownHook() override;
+	void shownAgainHook() override;
+
+	void skipWrittenParts();
+	[[nodiscard]] int queuePriority() const;
 
 	bool readyToRequest() const override;
+	void viewportPriorityExpired() override;
 	int takeNextRequestOffset() override;
 	bool feedPart(int offset, const QByteArray &bytes) override;
 	void cancelOnFail() override;
 	bool setWebFileSizeHook(int size) override;
 
+	bool _loadingStarted = false;
 	bool _lastComplete = false;
 	int32 _nextRequestOffset = 0;
 
@@ -454,7 +454,7 @@ webFileLoader::webFileLoader(
 }
 
 webFileLoader::~webFileLoader() {
-	if (!_finished) {
+	if (!_finished && !_writing) {
 		cancel();
 	}
 }
@@ -464,7 +464,7 @@ QString webFileLoader::url() const {
 }
 
 void webFileLoader::startLoading() {
-	if (_finished) {
+	if (_finished || _writing) {
 		return;
 	} else if (!_manager) {
 		_manager = GetManager();
@@ -495,7 +495,7 @@ void webFileLoader::loadProgress(qint64 ready, qint64 total) {
 
 void webFileLoader::loadFinished(const QByteArray &data) {
 	cancelRequest();
-	if (writeResultPart(0, bytes::make_span(data))) {
+	if (writeResultPart(0, data)) {
 		finalizeResult();
 	}
 }
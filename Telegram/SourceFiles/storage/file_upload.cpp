@@ -11,6 +11,7 @@ https://github.com/telegramdesktop/tdesktop/blob/master/LEGAL
 #include "api/api_send_progress.h"
 #include "storage/localimageloader.h"
 #include "storage/file_download.h"
+#include "storage/storage_file_parts_reader.h"
 #include "data/data_document.h"
 #include "data/data_document_media.h"
 #include "data/data_photo.h"
@@ -21,13 +22,23 @@ https://github.com/telegramdesktop/tdesktop/blob/master/LEGAL
 #include "core/file_location.h"
 #include "core/mime_type.h"
 #include "main/main_session.h"
+#include "main/main_session_settings.h"
 #include "apiwrap.h"
 
 namespace Storage {
 namespace {
 
-// max 512kb uploaded at the same time in each session
-constexpr auto kMaxUploadFileParallelSize = MTP::kUploadSessionsCount * 512 * 1024;
+// Start with 512kb uploaded at the same time in each session and adapt
+// it to the acknowledgement latency between 256kb and 2mb per session.
+constexpr auto kStartUploadParallelSize = MTP::kUploadSessionsCount * 512 * 1024;
+constexpr auto kMinUploadParallelSize = MTP::kUploadSessionsCount * 256 * 1024;
+constexpr auto kMaxUploadParallelSize = MTP::kUploadSessionsCount * 2048 * 1024;
+
+// Grow while acks come within kAckLatencyGrowFactor * min latency,
+// shrink when they take more than kAckLatencyShrinkFactor * min latency.
+constexpr auto kAckLatencyGrowFactor = 2;
+constexpr auto kAckLatencyShrinkFactor = 4;
+constexpr auto kAckLatencyWindow = 10 * crl::time(1000);
 
 constexpr auto kDocumentMaxPartsCount = 3000;
 
@@ -46,6 +57,14 @@ constexpr auto kDocumentUploadPartSize3 = 256 * 1024;
 // 512kb for large document ( <= 1500mb )
 constexpr auto kDocumentUploadPartSize4 = 512 * 1024;
 
+// Adaptive part size is chosen so that a part takes that long to upload
+// at the throughput measured on the recent documents of at least that size.
+constexpr auto kAdaptivePartDuration = crl::time(250);
+constexpr auto kAdaptiveMinDocumentSize = 1024 * 1024;
+
+// Each new throughput sample moves the average by 1 / kAdaptiveSmoothing.
+constexpr auto kAdaptiveSmoothing = 4;
+
 // One part each half second, if not uploaded faster.
 constexpr auto kUploadRequestInterval = crl::time(500);
 
@@ -56,13 +75,30 @@ constexpr auto kKillSessionTimeout = 15 * crl::time(000);
 	return Core::IsMimeSticker(mime) ? "WEBP" : "JPG";
 }
 
+[[nodiscard]] int AdaptivePartSize(int64 bytesPerSecond) {
+	const auto wanted = bytesPerSecond * kAdaptivePartDuration / 1000;
+	for (const auto size : {
+		kDocumentUploadPartSize4,
+		kDocumentUploadPartSize3,
+		kDocumentUploadPartSize2,
+		kDocumentUploadPartSize1,
+	}) {
+		if (size <= wanted) {
+			return size;
+		}
+	}
+	return kDocumentUploadPartSize0;
+}
+
 } // namespace
 
 struct Uploader::File {
-	File(const SendMediaReady &media);
-	File(const std::shared_ptr<FileLoadResult> &file);
+	File(const SendMediaReady &media, int preferredPartSize);
+	File(
+		const std::shared_ptr<FileLoadResult> &file,
+		int preferredPartSize);
 
-	void setDocSize(int32 size);
+	void setDocSize(int32 size, int preferredPartSize);
 	bool setPartSize(uint32 partSize);
 
 	std::shared_ptr<FileLoadResult> file;
@@ -77,27 +113,31 @@ struct Uploader::File {
 
 	HashMd5 md5Hash;
 
-	std::unique_ptr<QFile> docFile;
+	std::unique_ptr<FilePartsReader> docReader;
 	int32 docSentParts = 0;
 	int32 docSize = 0;
 	int32 docPartSize = 0;
 	int32 docPartsCount = 0;
+	crl::time docStarted = 0;
 
 };
 
-Uploader::File::File(const SendMediaReady &media) : media(media) {
+Uploader::File::File(const SendMediaReady &media, int preferredPartSize)
+: media(media) {
 	partsCount = media.parts.size();
 	if (type() == SendMediaType::File
 		|| type() == SendMediaType::ThemeFile
 		|| type() == SendMediaType::Audio) {
-		setDocSize(media.file.isEmpty()
-			? media.data.size()
-			: media.filesize);
+		setDocSize(
+			(media.file.isEmpty() ? media.data.size() : media.filesize),
+			preferredPartSize);
 	} else {
 		docSize = docPartSize = docPartsCount = 0;
 	}
 }
-Uploader::File::File(const std::shared_ptr<FileLoadResult> &file)
+Uploader::File::File(
+	const std::shared_ptr<FileLoadResult> &file,
+	int preferredPartSize)
 : file(file) {
 	partsCount = (type() == SendMediaType::Photo
 		|| type() == SendMediaType::Secure)
@@ -106,14 +146,27 @@ Uploader::File::File(const std::shared_ptr<FileLoadResult> &file)
 	if (type() == SendMediaType::File
 		|| type() == SendMediaType::ThemeFile
 		|| type() == SendMediaType::Audio) {
-		setDocSize(file->filesize);
+		setDocSize(file->filesize, preferredPartSize);
 	} else {
 		docSize = docPartSize = docPartsCount = 0;
 	}
 }
 
-void Uploader::File::setDocSize(int32 size) {
+void Uploader::File::setDocSize(int32 size, int preferredPartSize) {
 	docSize = size;
+	if (preferredPartSize > 0) {
+		for (const auto partSize : {
+			kDocumentUploadPartSize0,
+			kDocumentUploadPartSize1,
+			kDocumentUploadPartSize2,
+			kDocumentUploadPartSize3,
+			kDocumentUploadPartSize4,
+		}) {
+			if (partSize >= preferredPartSize && setPartSize(partSize)) {
+				return;
+			}
+		}
+	}
 	constexpr auto limit0 = 1024 * 1024;
 	constexpr auto limit1 = 32 * limit0;
 	if (docSize >= limit0 || !setPartSize(kDocumentUploadPartSize0)) {
@@ -153,7 +206,8 @@ const QString &Uploader::File::filename() const {
 }
 
 Uploader::Uploader(not_null<ApiWrap*> api)
-: _api(api) {
+: _api(api)
+, _parallelSize(kStartUploadParallelSize) {
 	nextTimer.setSingleShot(true);
 	connect(&nextTimer, SIGNAL(timeout()), this, SLOT(sendNext()));
 	stopSessionsTimer.setSingleShot(true);
@@ -324,7 +378,7 @@ void Uploader::uploadMedia(
 			document->setLocation(Core::FileLocation(media.file));
 		}
 	}
-	queue.emplace(msgId, File(media));
+	queue.emplace(msgId, File(media, preferredPartSize()));
 	sendNext();
 }
 
@@ -375,7 +429,7 @@ void Uploader::upload(
 			document->checkWallPaperProperties();
 		}
 	}
-	queue.emplace(msgId, File(file));
+	queue.emplace(msgId, File(file, preferredPartSize()));
 	sendNext();
 }
 
@@ -402,6 +456,7 @@ void Uploader::currentFailed() {
 
 	requestsSent.clear();
 	docRequestsSent.clear();
+	docRequestsSentAt.clear();
 	dcMap.clear();
 	uploadingId = FullMsgId();
 	sentSize = 0;
@@ -419,8 +474,13 @@ void Uploader::stopSessions() {
 }
 
 void Uploader::sendNext() {
-	if (sentSize >= kMaxUploadFileParallelSize || _pausedId.msg) {
-		return;
+	while (sendNextPart()) {
+	}
+}
+
+bool Uploader::sendNextPart() {
+	if (sentSize >= uint32(_parallelSize) || _pausedId.msg) {
+		return false;
 	}
 
 	bool stopping = stopSessionsTimer.isActive();
@@ -428,7 +488,7 @@ void Uploader::sendNext() {
 		if (!stopping) {
 			stopSessionsTimer.start(kKillSessionTimeout);
 		}
-		return;
+		return false;
 	}
 
 	if (stopping) {
@@ -490,6 +550,8 @@ void Uploader::sendNext() {
 				} else if (uploadingData.type() == SendMediaType::File
 					|| uploadingData.type() == SendMediaType::ThemeFile
 					|| uploadingData.type() == SendMediaType::Audio) {
+					learnPartSize(uploadingData);
+
 					QByteArray docMd5(32, Qt::Uninitialized);
 					hashMd5Hex(uploadingData.md5Hash.result(), docMd5.data());
 
@@ -538,7 +600,7 @@ void Uploader::sendNext() {
 				uploadingId = FullMsgId();
 				sendNext();
 			}
-			return;
+			return false;
 		}
 
 		auto &content = uploadingData.file
@@ -546,19 +608,34 @@ void Uploader::sendNext() {
 			: uploadingData.media.data;
 		QByteArray toSend;
 		if (content.isEmpty()) {
-			if (!uploadingData.docFile) {
+			auto &reader = uploadingData.docReader;
+			if (!reader) {
 				const auto filepath = uploadingData.file
 					? uploadingData.file->filepath
 					: uploadingData.media.file;
-				uploadingData.docFile = std::make_unique<QFile>(filepath);
-				if (!uploadingData.docFile->open(QIODevice::ReadOnly)) {
-					currentFailed();
-					return;
-				}
+				const auto fullId = uploadingId;
+				reader = std::make_unique<FilePartsReader>(
+					filepath,
+					uploadingData.docPartSize,
+					uploadingData.docPartsCount,
+					(uploadingData.docSize <= kUseBigFilesFrom),
+					[=] { sendNext(); },
+					[=] {
+						if (uploadingId == fullId) {
+							currentFailed();
+						}
+					});
 			}
-			toSend = uploadingData.docFile->read(uploadingData.docPartSize);
-			if (uploadingData.docSize <= kUseBigFilesFrom) {
-				uploadingData.md5Hash.feed(toSend.constData(), toSend.size());
+			reader->setWindow(
+				std::max(_parallelSize / uploadingData.docPartSize, 1));
+
+			// We'll be notified when the part is read.
+			toSend = reader->takeNext();
+			if (toSend.isEmpty()) {
+				return false;
+			} else if (uploadingData.docSentParts + 1
+				== uploadingData.docPartsCount) {
+				uploadingData.md5Hash = reader->md5();
 			}
 		} else {
 			const auto offset = uploadingData.docSentParts
@@ -575,7 +652,7 @@ void Uploader::sendNext() {
 			|| ((toSend.size() < uploadingData.docPartSize
 				&& uploadingData.docSentParts + 1 != uploadingData.docPartsCount))) {
 			currentFailed();
-			return;
+			return false;
 		}
 		mtpRequestId requestId;
 		if (uploadingData.docSize > kUseBigFilesFrom) {
@@ -601,6 +678,10 @@ void Uploader::sendNext() {
 			}).toDC(MTP::uploadDcId(todc)).send();
 		}
 		docRequestsSent.emplace(requestId, uploadingData.docSentParts);
+		docRequestsSentAt.emplace(requestId, crl::now());
+		if (!uploadingData.docStarted) {
+			uploadingData.docStarted = crl::now();
+		}
 		dcMap.emplace(requestId, todc);
 		sentSize += uploadingData.docPartSize;
 		sentSizes[todc] += uploadingData.docPartSize;
@@ -626,6 +707,69 @@ void Uploader::sendNext() {
 		parts.erase(part);
 	}
 	nextTimer.start(kUploadRequestInterval);
+	return true;
+}
+
+int Uploader::preferredPartSize() const {
+	return session().settings().uploadPartSize(_api->instance().mainDcId());
+}
+
+void Uploader::learnPartSize(const File &file) {
+	const auto duration = crl::now() - file.docStarted;
+	if (file.docSize < kAdaptiveMinDocumentSize
+		|| !file.docStarted
+		|| duration <= 0) {
+		return;
+	}
+	const auto sample = int64(file.docSize) * 1000 / duration;
+	const auto dcId = _api->instance().mainDcId();
+	auto &settings = session().settings();
+	auto i = _averageUploadSpeed.find(dcId);
+	if (i == end(_averageUploadSpeed)) {
+		// Start from the speed the saved part size was chosen for.
+		const auto saved = settings.uploadPartSize(dcId);
+		i = _averageUploadSpeed.emplace(
+			dcId,
+			saved ? (int64(saved) * 1000 / kAdaptivePartDuration) : sample
+		).first;
+	}
+	auto &bytesPerSecond = i->second;
+	bytesPerSecond = (bytesPerSecond * (kAdaptiveSmoothing - 1) + sample)
+		/ kAdaptiveSmoothing;
+	const auto partSize = AdaptivePartSize(bytesPerSecond);
+	if (settings.uploadPartSize(dcId) != partSize) {
+		DEBUG_LOG(("Upload part size for dc %1: %2, speed: %3."
+			).arg(dcId
+			).arg(partSize
+			).arg(bytesPerSecond));
+		settings.setUploadPartSize(dcId, partSize);
+		session().saveSettingsDelayed();
+	}
+}
+
+void Uploader::docPartAcked(crl::time latency, int partSize, bool full) {
+	const auto now = crl::now();
+	latency = std::max(latency, crl::time(1));
+	if (!_minAckLatency
+		|| latency <= _minAckLatency
+		|| now - _minAckLatencyWhen > kAckLatencyWindow) {
+		_minAckLatency = latency;
+		_minAckLatencyWhen = now;
+	}
+	const auto was = _parallelSize;
+	if (latency > kAckLatencyShrinkFactor * _minAckLatency) {
+		_parallelSize = std::max(_parallelSize / 2, kMinUploadParallelSize);
+	} else if (full && latency < kAckLatencyGrowFactor * _minAckLatency) {
+		_parallelSize = std::min(
+			_parallelSize + partSize,
+			kMaxUploadParallelSize);
+	}
+	if (_parallelSize != was) {
+		DEBUG_LOG(("Upload parallel size: %1, ack latency: %2, min: %3."
+			).arg(_parallelSize
+			).arg(latency
+			).arg(_minAckLatency));
+	}
 }
 
 void Uploader::cancel(const FullMsgId &msgId) {
@@ -638,10 +782,20 @@ void Uploader::cancel(const FullMsgId &msgId) {
 }
 
 void Uploader::pause(const FullMsgId &msgId) {
+	if (!_pausedId.msg) {
+		_pausedAt = crl::now();
+	}
 	_pausedId = msgId;
 }
 
 void Uploader::unpause() {
+	if (_pausedId.msg) {
+		// Paused time shouldn't count in the measured throughput.
+		const auto i = queue.find(uploadingId);
+		if (i != end(queue) && i->second.docStarted) {
+			i->second.docStarted += crl::now() - _pausedAt;
+		}
+	}
 	_pausedId = FullMsgId();
 	sendNext();
 }
@@ -660,6 +814,7 @@ void Uploader::clear() {
 		_api->request(requestData.first).cancel();
 	}
 	docRequestsSent.clear();
+	docRequestsSentAt.clear();
 	dcMap.clear();
 	sentSize = 0;
 	for (int i = 0; i < MTP::kUploadSessionsCount; ++i) {
@@ -698,6 +853,13 @@ void Uploader::partLoaded(const MTPBool &result, mtpRequestId requestId) {
 			} else {
 				sentPartSize = file.docPartSize;
 				docRequestsSent.erase(j);
+				const auto sentAt = docRequestsSentAt.take(requestId);
+				if (sentAt) {
+					docPartAcked(
+						crl::now() - *sentAt,
+						sentPartSize,
+						(sentSize >= uint32(_parallelSize)));
+				}
 			}
 			sentSize -= sentPartSize;
 			sentSizes[dc] -= sentPartSize;
@@ -122,6 +122,11 @@ public slots:
 private:
 	struct File;
 
+	bool sendNextPart();
+	[[nodiscard]] int preferredPartSize() const;
+	void learnPartSize(const File &file);
+	void docPartAcked(crl::time latency, int partSize, bool full);
+
 	void partLoaded(const MTPBool &result, mtpRequestId requestId);
 	void partFailed(const RPCError &error, mtpRequestId requestId);
 
@@ -140,12 +145,18 @@ private:
 	const not_null<ApiWrap*> _api;
 	base::flat_map<mtpRequestId, QByteArray> requestsSent;
 	base::flat_map<mtpRequestId, int32> docRequestsSent;
+	base::flat_map<mtpRequestId, crl::time> docRequestsSentAt;
 	base::flat_map<mtpRequestId, int32> dcMap;
 	uint32 sentSize = 0;
 	uint32 sentSizes[MTP::kUploadSessionsCount] = { 0 };
+	int _parallelSize = 0;
+	crl::time _minAckLatency = 0;
+	crl::time _minAckLatencyWhen = 0;
+	base::flat_map<MTP::DcId, int64> _averageUploadSpeed;
 
 	FullMsgId uploadingId;
 	FullMsgId _pausedId;
+	crl::time _pausedAt = 0;
 	std::map<FullMsgId, File> queue;
 	std::map<FullMsgId, File> uploaded;
 	QTimer nextTimer, stopSessionsTimer;
@@ -40,6 +40,7 @@ namespace {
 constexpr auto kThumbnailQuality = 87;
 constexpr auto kThumbnailSize = 320;
 constexpr auto kPhotoUploadPartSize = 32 * 1024;
+constexpr auto kReadImageSideLimit = 2560;
 
 using Ui::ValidateThumbDimensions;
 
@@ -254,7 +255,10 @@ SendMediaReady PreparePeerPhoto(MTP::DcId dcId, PeerId peerId, QImage &&image) {
 		0);
 }
 
-TaskQueue::TaskQueue(crl::time stopTimeoutMs) {
+TaskQueue::TaskQueue(crl::time stopTimeoutMs, int workersCount)
+: _workersCount(workersCount) {
+	Expects(_workersCount > 0);
+
 	if (stopTimeoutMs > 0) {
 		_stopTimer = new QTimer(this);
 		connect(_stopTimer, SIGNAL(timeout()), this, SLOT(stop()));
@@ -265,6 +269,10 @@ TaskQueue::TaskQueue(crl::time stopTimeoutMs) {
 
 TaskId TaskQueue::addTask(std::unique_ptr<Task> &&task) {
 	const auto result = task->id();
+	{
+		QMutexLocker lock(&_tasksToFinishMutex);
+		_finishOrder.push_back(result);
+	}
 	{
 		QMutexLocker lock(&_tasksToProcessMutex);
 		_tasksToProcess.push_back(std::move(task));
@@ -276,6 +284,12 @@ TaskId TaskQueue::addTask(std::unique_ptr<Task> &&task) {
 }
 
 void TaskQueue::addTasks(std::vector<std::unique_ptr<Task>> &&tasks) {
+	{
+		QMutexLocker lock(&_tasksToFinishMutex);
+		for (const auto &task : tasks) {
+			_finishOrder.push_back(task->id());
+		}
+	}
 	{
 		QMutexLocker lock(&_tasksToProcessMutex);
 		for (auto &task : tasks) {
@@ -287,16 +301,19 @@ void TaskQueue::addTasks(std::vector<std::unique_ptr<Task>> &&tasks) {
 }
 
 void TaskQueue::wakeThread() {
-	if (!_thread) {
-		_thread = new QThread();
-
-		_worker = new TaskQueueWorker(this);
-		_worker->moveToThread(_thread);
-
-		connect(this, SIGNAL(taskAdded()), _worker, SLOT(onTaskAdded()));
-		connect(_worker, SIGNAL(taskProcessed()), this, SLOT(onTaskProcessed()));
-
-		_thread->start();
+	if (_threads.empty()) {
+		for (auto i = 0; i != _workersCount; ++i) {
+			const auto thread = new QThread();
+			const auto worker = new TaskQueueWorker(this);
+			worker->moveToThread(thread);
+
+			connect(this, SIGNAL(taskAdded()), worker, SLOT(onTaskAdded()));
+			connect(worker, SIGNAL(taskProcessed()), this, SLOT(onTaskProcessed()));
+
+			thread->start();
+			_threads.push_back(thread);
+			_workers.push_back(worker);
+		}
 	}
 	if (_stopTimer) _stopTimer->stop();
 	emit taskAdded();
@@ -315,12 +332,22 @@ void TaskQueue::cancelTask(TaskId id) {
 	{
 		QMutexLocker lock(&_tasksToProcessMutex);
 		removeFrom(_tasksToProcess);
-		if (_taskInProcessId == id) {
-			_taskInProcessId = TaskId();
+		const auto i = ranges::find(_tasksInProcess, id);
+		if (i != end(_tasksInProcess)) {
+			_tasksInProcess.erase(i);
 		}
 	}
 	QMutexLocker lock(&_tasksToFinishMutex);
 	removeFrom(_tasksToFinish);
+	const auto i = ranges::find(_finishOrder, id);
+	if (i != end(_finishOrder)) {
+		_finishOrder.erase(i);
+
+		// Tasks processed after this one may be waiting for it.
+		if (!_tasksToFinish.empty()) {
+			InvokeQueued(this, [=] { onTaskProcessed(); });
+		}
+	}
 }
 
 void TaskQueue::onTaskProcessed() {
@@ -328,33 +355,51 @@ void TaskQueue::onTaskProcessed() {
 		auto task = std::unique_ptr<Task>();
 		{
 			QMutexLocker lock(&_tasksToFinishMutex);
-			if (_tasksToFinish.empty()) break;
-			task = std::move(_tasksToFinish.front());
-			_tasksToFinish.pop_front();
+			if (_finishOrder.empty()) break;
+			const auto proj = [](const std::unique_ptr<Task> &task) {
+				return task->id();
+			};
+			const auto i = ranges::find(
+				_tasksToFinish,
+				_finishOrder.front(),
+				proj);
+			if (i == end(_tasksToFinish)) break;
+			task = std::move(*i);
+			_tasksToFinish.erase(i);
+			_finishOrder.pop_front();
 		}
 		task->finish();
 	} while (true);
 
 	if (_stopTimer) {
 		QMutexLocker lock(&_tasksToProcessMutex);
-		if (_tasksToProcess.empty() && !_taskInProcessId) {
+		if (_tasksToProcess.empty() && _tasksInProcess.empty()) {
 			_stopTimer->start();
 		}
 	}
 }
 
 void TaskQueue::stop() {
-	if (_thread) {
-		_thread->requestInterruption();
-		_thread->quit();
+	if (!_threads.empty()) {
+		for (const auto thread : _threads) {
+			thread->requestInterruption();
+			thread->quit();
+		}
 		DEBUG_LOG(("Waiting for taskThread to finish"));
-		_thread->wait();
-		delete base::take(_worker);
-		delete base::take(_thread);
+		for (const auto thread : _threads) {
+			thread->wait();
+		}
+		for (const auto worker : base::take(_workers)) {
+			delete worker;
+		}
+		for (const auto thread : base::take(_threads)) {
+			delete thread;
+		}
 	}
 	_tasksToProcess.clear();
 	_tasksToFinish.clear();
-	_taskInProcessId = TaskId();
+	_finishOrder.clear();
+	_tasksInProcess.clear();
 }
 
 TaskQueue::~TaskQueue() {
@@ -374,7 +419,7 @@ void TaskQueueWorker::onTaskAdded() {
 			if (!_queue->_tasksToProcess.empty()) {
 				task = std::move(_queue->_tasksToProcess.front());
 				_queue->_tasksToProcess.pop_front();
-				_queue->_taskInProcessId = task->id();
+				_queue->_tasksInProcess.push_back(task->id());
 			}
 		}
 
@@ -383,12 +428,16 @@ void TaskQueueWorker::onTaskAdded() {
 			bool emitTaskProcessed = false;
 			{
 				QMutexLocker lockToProcess(&_queue->_tasksToProcessMutex);
-				if (_queue->_taskInProcessId == task->id()) {
-					_queue->_taskInProcessId = TaskId();
+				auto &inProcess = _queue->_tasksInProcess;
+				const auto i = ranges::find(inProcess, task->id());
+				if (i != end(inProcess)) {
+					inProcess.erase(i);
 					someTasksLeft = !_queue->_tasksToProcess.empty();
 
+					// Only the first task in order can be finished now.
 					QMutexLocker lockToFinish(&_queue->_tasksToFinishMutex);
-					emitTaskProcessed = _queue->_tasksToFinish.empty();
+					emitTaskProcessed = !_queue->_finishOrder.empty()
+						&& (_queue->_finishOrder.front() == task->id());
 					_queue->_tasksToFinish.push_back(std::move(task));
 				}
 			}
@@ -646,6 +695,7 @@ bool FileLoadTask::CheckForImage(
 		const QByteArray &content,
 		std::unique_ptr<Ui::PreparedFileInformation> &result) {
 	auto animated = false;
+	auto original = QSize();
 	auto image = [&] {
 		if (filepath.endsWith(qstr(".tgs"), Qt::CaseInsensitive)) {
 			auto image = Lottie::ReadThumbnail(
@@ -659,11 +709,25 @@ bool FileLoadTask::CheckForImage(
 		if (!content.isEmpty()) {
 			return App::readImage(content, nullptr, false, &animated);
 		} else if (!filepath.isEmpty()) {
-			return App::readImage(filepath, nullptr, false, &animated);
+			// Photos are sent at most 1280px large, so twice that size
+			// is enough for any thumbnail and keeps the decoding cheap.
+			return App::readImageBounded(
+				filepath,
+				kReadImageSideLimit,
+				&original,
+				nullptr,
+				&animated);
 		}
 		return QImage();
 	}();
-	return FillImageInformation(std::move(image), animated, result);
+	if (!FillImageInformation(std::move(image), animated, result)) {
+		return false;
+	} else if (!original.isEmpty()) {
+		auto &media = std::get<Ui::PreparedFileInformation::Image>(
+			result->media);
+		media.original = original;
+	}
+	return true;
 }
 
 bool FileLoadTask::FillImageInformation(
@@ -676,6 +740,7 @@ bool FileLoadTask::FillImageInformation(
 		return false;
 	}
 	auto media = Ui::PreparedFileInformation::Image();
+	media.original = image.size();
 	media.data = std::move(image);
 	media.animated = animated;
 	result->media = media;
@@ -703,6 +768,7 @@ void FileLoadTask::process(Args &&args) {
 	auto isSticker = false;
 
 	auto fullimage = QImage();
+	auto fullsize = QSize();
 	auto info = _filepath.isEmpty() ? QFileInfo() : QFileInfo(_filepath);
 	if (info.exists()) {
 		if (info.isDir()) {
@@ -724,6 +790,7 @@ void FileLoadTask::process(Args &&args) {
 		if (auto image = std::get_if<Ui::PreparedFileInformation::Image>(
 				&_information->media)) {
 			fullimage = base::take(image->data);
+			fullsize = image->original;
 			if (!Core::IsMimeSticker(filemime)) {
 				fullimage = Images::prepareOpaque(std::move(fullimage));
 			}
@@ -852,7 +919,11 @@ void FileLoadTask::process(Args &&args) {
 	}
 
 	if (!fullimage.isNull() && fullimage.width() > 0 && !isSong && !isVideo && !isVoice) {
-		auto w = fullimage.width(), h = fullimage.height();
+		// The attributes describe the file, even if it was decoded smaller.
+		if (fullsize.isEmpty()) {
+			fullsize = fullimage.size();
+		}
+		auto w = fullsize.width(), h = fullsize.height();
 		attributes.push_back(MTP_documentAttributeImageSize(MTP_int(w), MTP_int(h)));
 
 		if (ValidateThumbDimensions(w, h)) {
@@ -877,8 +948,9 @@ void FileLoadTask::process(Args &&args) {
 				attributes.push_back(MTP_documentAttributeAnimated());
 			} else if (filemime.startsWith(u"image/"_q)
 				&& _type != SendMediaType::File) {
-				auto medium = (w > 320 || h > 320) ? fullimage.scaled(320, 320, Qt::KeepAspectRatio, Qt::SmoothTransformation) : fullimage;
-				auto full = (w > 1280 || h > 1280) ? fullimage.scaled(1280, 1280, Qt::KeepAspectRatio, Qt::SmoothTransformation) : fullimage;
+				const auto decoded = fullimage.size();
+				auto medium = (decoded.width() > 320 || decoded.height() > 320) ? fullimage.scaled(320, 320, Qt::KeepAspectRatio, Qt::SmoothTransformation) : fullimage;
+				auto full = (decoded.width() > 1280 || decoded.height() > 1280) ? fullimage.scaled(1280, 1280, Qt::KeepAspectRatio, Qt::SmoothTransformation) : fullimage;
 				{
 					// We have an example of dark .png image that when being sent without
 					// removing its color space is displayed fine on tdesktop, but with
@@ -136,7 +136,11 @@ class TaskQueue : public QObject {
 	Q_OBJECT
 
 public:
-	explicit TaskQueue(crl::time stopTimeoutMs = 0); // <= 0 - never stop worker
+	// With several workers tasks are processed in parallel,
+	// but finish() is still called in the order the tasks were added.
+	explicit TaskQueue(
+		crl::time stopTimeoutMs = 0, // <= 0 - never stop workers
+		int workersCount = 1);
 
 	TaskId addTask(std::unique_ptr<Task> &&task);
 	void addTasks(std::vector<std::unique_ptr<Task>> &&tasks);
@@ -156,12 +160,14 @@ private:
 
 	void wakeThread();
 
+	const int _workersCount = 1;
 	std::deque<std::unique_ptr<Task>> _tasksToProcess;
 	std::deque<std::unique_ptr<Task>> _tasksToFinish;
-	TaskId _taskInProcessId = TaskId();
+	std::deque<TaskId> _finishOrder;
+	std::vector<TaskId> _tasksInProcess;
 	QMutex _tasksToProcessMutex, _tasksToFinishMutex;
-	QThread *_thread = nullptr;
-	TaskQueueWorker *_worker = nullptr;
+	std::vector<QThread*> _threads;
+	std::vector<TaskQueueWorker*> _workers;
 	QTimer *_stopTimer = nullptr;
 
 };
@@ -76,6 +76,7 @@ enum { // Local Storage Keys
 	lskExportSettings = 0x13, // no data
 	lskBackgroundOld = 0x14, // no data
 	lskSelfSerialized = 0x15, // serialized self
+	lskPartialDownloads = 0x16, // no data
 };
 
 [[nodiscard]] FileKey ComputeDataNameKey(const QString &dataName) {
@@ -184,6 +185,7 @@ base::flat_set<QString> Account::collectGoodNames() const {
 		_recentHashtagsAndBotsKey,
 		_exportSettingsKey,
 		_trustedBotsKey,
+		_partialDownloadsKey,
 	};
 	auto result = base::flat_set<QString>{
 		"map0",
@@ -267,6 +269,7 @@ Account::ReadMapResult Account::readMapWith(
 	quint64 savedGifsKey = 0;
 	quint64 legacyBackgroundKeyDay = 0, legacyBackgroundKeyNight = 0;
 	quint64 userSettingsKey = 0, recentHashtagsAndBotsKey = 0, exportSettingsKey = 0;
+	quint64 partialDownloadsKey = 0;
 	while (!map.stream.atEnd()) {
 		quint32 keyType;
 		map.stream >> keyType;
@@ -358,6 +361,9 @@ Account::ReadMapResult Account::readMapWith(
 		case lskExportSettings: {
 			map.stream >> exportSettingsKey;
 		} break;
+		case lskPartialDownloads: {
+			map.stream >> partialDownloadsKey;
+		} break;
 		default:
 			LOG(("App Error: unknown key type in encrypted map: %1").arg(keyType));
 			return ReadMapResult::Failed;
@@ -387,6 +393,7 @@ Account::ReadMapResult Account::readMapWith(
 	_settingsKey = userSettingsKey;
 	_recentHashtagsAndBotsKey = recentHashtagsAndBotsKey;
 	_exportSettingsKey = exportSettingsKey;
+	_partialDownloadsKey = partialDownloadsKey;
 	_oldMapVersion = mapData.version;
 
 	if (_oldMapVersion < AppVersion) {
@@ -486,6 +493,7 @@ void Account::writeMap() {
 	if (_settingsKey) mapSize += sizeof(quint32) + sizeof(quint64);
 	if (_recentHashtagsAndBotsKey) mapSize += sizeof(quint32) + sizeof(quint64);
 	if (_exportSettingsKey) mapSize += sizeof(quint32) + sizeof(quint64);
+	if (_partialDownloadsKey) mapSize += sizeof(quint32) + sizeof(quint64);
 
 	EncryptedDescriptor mapData(mapSize);
 	if (!self.isEmpty()) {
@@ -531,6 +539,9 @@ void Account::writeMap() {
 	if (_exportSettingsKey) {
 		mapData.stream << quint32(lskExportSettings) << quint64(_exportSettingsKey);
 	}
+	if (_partialDownloadsKey) {
+		mapData.stream << quint32(lskPartialDownloads) << quint64(_partialDownloadsKey);
+	}
 	map.writeEncrypted(mapData, _localKey);
 
 	_mapChanged = false;
@@ -551,6 +562,9 @@ void Account::reset() {
 	_savedGifsKey = 0;
 	_legacyBackgroundKeyDay = _legacyBackgroundKeyNight = 0;
 	_settingsKey = _recentHashtagsAndBotsKey = _exportSettingsKey = 0;
+	_partialDownloadsKey = 0;
+	_partialDownloads.clear();
+	_partialDownloadsRead = false;
 	_oldMapVersion = 0;
 	_fileLocations.clear();
 	_fileLocationPairs.clear();
@@ -2552,6 +2566,83 @@ bool Account::isBotTrusted(not_null<UserData*> bot) {
 	return _trustedBots.contains(bot->id);
 }
 
+void Account::writePartialDownloads() {
+	if (_partialDownloads.empty()) {
+		if (_partialDownloadsKey) {
+			ClearKey(_partialDownloadsKey, _basePath);
+			_partialDownloadsKey = 0;
+			writeMapDelayed();
+		}
+		return;
+	}
+	if (!_partialDownloadsKey) {
+		_partialDownloadsKey = GenerateKey(_basePath);
+		writeMapQueued();
+	}
+	quint32 size = sizeof(qint32);
+	for (const auto &path : _partialDownloads) {
+		size += Serialize::stringSize(path);
+	}
+	EncryptedDescriptor data(size);
+	data.stream << qint32(_partialDownloads.size());
+	for (const auto &path : _partialDownloads) {
+		data.stream << path;
+	}
+
+	FileWriteDescriptor file(_partialDownloadsKey, _basePath);
+	file.writeEncrypted(data, _localKey);
+}
+
+void Account::readPartialDownloads() {
+	if (!_partialDownloadsKey) return;
+
+	FileReadDescriptor partial;
+	if (!ReadEncryptedFile(partial, _partialDownloadsKey, _basePath, _localKey)) {
+		ClearKey(_partialDownloadsKey, _basePath);
+		_partialDownloadsKey = 0;
+		writeMapDelayed();
+		return;
+	}
+
+	qint32 size = 0;
+	partial.stream >> size;
+	for (int i = 0; i < size; ++i) {
+		auto path = QString();
+		partial.stream >> path;
+		if (!CheckStreamStatus(partial.stream)) {
+			break;
+		}
+		_partialDownloads.emplace(path);
+	}
+}
+
+void Account::addPartialDownload(const QString &path) {
+	if (!partialDownloads().contains(path)) {
+		_partialDownloads.emplace(path);
+		writePartialDownloads();
+	}
+}
+
+void Account::removePartialDownloads(const std::vector<QString> &paths) {
+	auto changed = false;
+	for (const auto &path : paths) {
+		if (_partialDownloads.remove(path)) {
+			changed = true;
+		}
+	}
+	if (changed) {
+		writePartialDownloads();
+	}
+}
+
+const base::flat_set<QString> &Account::partialDownloads() {
+	if (!_partialDownloadsRead) {
+		readPartialDownloads();
+		_partialDownloadsRead = true;
+	}
+	return _partialDownloads;
+}
+
 bool Account::encrypt(
 		const void *src,
 		void *dst,
@@ -138,6 +138,11 @@ public:
 	void markBotTrusted(not_null<UserData*> bot);
 	[[nodiscard]] bool isBotTrusted(not_null<UserData*> bot);
 
+	// Files downloaded to "<path>.part", that may be resumed later.
+	void addPartialDownload(const QString &path);
+	void removePartialDownloads(const std::vector<QString> &paths);
+	[[nodiscard]] const base::flat_set<QString> &partialDownloads();
+
 	[[nodiscard]] bool encrypt(
 		const void *src,
 		void *dst,
@@ -212,6 +217,9 @@ private:
 	void readTrustedBots();
 	void writeTrustedBots();
 
+	void readPartialDownloads();
+	void writePartialDownloads();
+
 	std::optional<RecentHashtagPack> saveRecentHashtags(
 		Fn<RecentHashtagPack()> getPack,
 		const QString &text);
@@ -247,6 +255,7 @@ private:
 	FileKey _settingsKey = 0;
 	FileKey _recentHashtagsAndBotsKey = 0;
 	FileKey _exportSettingsKey = 0;
+	FileKey _partialDownloadsKey = 0;
 
 	qint64 _cacheTotalSizeLimit = 0;
 	qint64 _cacheBigFileTotalSizeLimit = 0;
@@ -255,6 +264,8 @@ private:
 
 	base::flat_set<uint64> _trustedBots;
 	bool _trustedBotsRead = false;
+	base::flat_set<QString> _partialDownloads;
+	bool _partialDownloadsRead = false;
 	bool _readingUserSettings = false;
 	bool _recentHashtagsAndBotsWereRead = false;
 
@@ -0,0 +1,185 @@
+/*
+This file is part of Telegram Desktop,
+the official desktop application for the Telegram messaging service.
+
+For license and copyright information please follow this link:
+https://github.com/telegramdesktop/tdesktop/blob/master/LEGAL
+*/
+#include "storage/storage_file_parts_reader.h"
+
+#include <QtCore/QMutex>
+
+namespace Storage {
+namespace {
+
+constexpr auto kDefaultWindow = 4;
+
+} // namespace
+
+struct FilePartsReader::Shared {
+	Shared(Fn<void()> ready, Fn<void()> failed)
+	: ready(std::move(ready))
+	, failed(std::move(failed)) {
+	}
+
+	const Fn<void()> ready;
+	const Fn<void()> failed;
+
+	QMutex mutex;
+	std::deque<QByteArray> parts;
+	int window = kDefaultWindow;
+	bool readScheduled = false;
+	bool waiting = false;
+	HashMd5 md5;
+};
+
+class FilePartsReader::Object final {
+public:
+	Object(
+		crl::weak_on_queue<Object> weak,
+		std::shared_ptr<Shared> shared,
+		const QString &path,
+		int partSize,
+		int partsCount,
+		bool computeMd5);
+
+	void read();
+
+private:
+	[[nodiscard]] bool ensureOpened();
+	void fail();
+
+	const std::shared_ptr<Shared> _shared;
+	const int _partSize = 0;
+	const int _partsCount = 0;
+	const bool _computeMd5 = false;
+	QFile _file;
+	HashMd5 _md5;
+	int _index = 0;
+	bool _failed = false;
+
+};
+
+FilePartsReader::Object::Object(
+	crl::weak_on_queue<Object> weak,
+	std::shared_ptr<Shared> shared,
+	const QString &path,
+	int partSize,
+	int partsCount,
+	bool computeMd5)
+: _shared(std::move(shared))
+, _partSize(partSize)
+, _partsCount(partsCount)
+, _computeMd5(computeMd5)
+, _file(path) {
+}
+
+bool FilePartsReader::Object::ensureOpened() {
+	if (_file.isOpen()) {
+		return true;
+	} else if (_failed || !_file.open(QIODevice::ReadOnly)) {
+		fail();
+		return false;
+	}
+	return true;
+}
+
+void FilePartsReader::Object::read() {
+	while (true) {
+		{
+			QMutexLocker lock(&_shared->mutex);
+			if (_failed
+				|| _index == _partsCount
+				|| int(_shared->parts.size()) >= _shared->window) {
+				_shared->readScheduled = false;
+				return;
+			}
+		}
+		if (!ensureOpened()) {
+			return;
+		}
+		auto bytes = _file.read(_partSize);
+		const auto last = (_index + 1 == _partsCount);
+		if (bytes.size() != _partSize && (!last || bytes.isEmpty())) {
+			fail();
+			return;
+		} else if (_computeMd5) {
+			_md5.feed(bytes.constData(), bytes.size());
+		}
+		++_index;
+
+		auto notify = false;
+		{
+			QMutexLocker lock(&_shared->mutex);
+			_shared->parts.push_back(std::move(bytes));
+			if (last) {
+				_shared->md5 = _md5;
+			}
+			notify = std::exchange(_shared->waiting, false);
+		}
+		if (notify) {
+			crl::on_main(_shared->ready);
+		}
+	}
+}
+
+void FilePartsReader::Object::fail() {
+	if (!std::exchange(_failed, true)) {
+		LOG(("File Error: Could not read from '%1'.").arg(_file.fileName()));
+		crl::on_main(_shared->failed);
+	}
+	QMutexLocker lock(&_shared->mutex);
+	_shared->readScheduled = false;
+}
+
+FilePartsReader::FilePartsReader(
+	const QString &path,
+	int partSize,
+	int partsCount,
+	bool computeMd5,
+	Fn<void()> ready,
+	Fn<void()> failed)
+: _shared(std::make_shared<Shared>(
+	crl::guard(this, std::move(ready)),
+	crl::guard(this, std::move(failed))))
+, _wrapped(_shared, path, partSize, partsCount, computeMd5) {
+	Expects(partSize > 0 && partsCount > 0);
+
+	_shared->readScheduled = true;
+	_wrapped.with([](Object &that) {
+		that.read();
+	});
+}
+
+FilePartsReader::~FilePartsReader() = default;
+
+void FilePartsReader::setWindow(int parts) {
+	Expects(parts > 0);
+
+	QMutexLocker lock(&_shared->mutex);
+	_shared->window = parts;
+}
+
+QByteArray FilePartsReader::takeNext() {
+	QMutexLocker lock(&_shared->mutex);
+	auto result = QByteArray();
+	if (_shared->parts.empty()) {
+		_shared->waiting = true;
+	} else {
+		result = std::move(_shared->parts.front());
+		_shared->parts.pop_front();
+	}
+	if (!std::exchange(_shared->readScheduled, true)) {
+		_wrapped.with([](Object &that) {
+			that.read();
+		});
+	}
+	return result;
+}
+
+HashMd5 FilePartsReader::md5() const {
+	QMutexLocker lock(&_shared->mutex);
+	return _shared->md5;
+}
+
+} // namespace Storage
@@ -0,0 +1,48 @@
+/*
+This file is part of Telegram Desktop,
+the official desktop application for the Telegram messaging service.
+
+For license and copyright information please follow this link:
+https://github.com/telegramdesktop/tdesktop/blob/master/LEGAL
+*/
+#pragma once
+
+#include "base/weak_ptr.h"
+
+#include <crl/crl_object_on_queue.h>
+
+namespace Storage {
+
+// Reads the parts of a file being uploaded on a background queue,
+// keeping a window of parts ready before they are requested.
+class FilePartsReader final : public base::has_weak_ptr {
+public:
+	// Both callbacks are invoked on the main thread.
+	// The 'ready' one is called when a part was not ready in takeNext().
+	FilePartsReader(
+		const QString &path,
+		int partSize,
+		int partsCount,
+		bool computeMd5,
+		Fn<void()> ready,
+		Fn<void()> failed);
+	~FilePartsReader();
+
+	void setWindow(int parts);
+
+	// Returns an empty array if the next part is not read yet.
+	[[nodiscard]] QByteArray takeNext();
+
+	// Available after the last part was taken.
+	[[nodiscard]] HashMd5 md5() const;
+
+private:
+	struct Shared;
+	class Object;
+
+	const std::shared_ptr<Shared> _shared;
+	crl::object_on_queue<Object> _wrapped;
+
+};
+
+} // namespace Storage
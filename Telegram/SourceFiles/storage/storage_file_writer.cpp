@@ -0,0 +1,532 @@
+/*
+This file is part of Telegram Desktop,
+the official desktop application for the Telegram messaging service.
+
+For license and copyright information please follow this link:
+https://github.com/telegramdesktop/tdesktop/blob/master/LEGAL
+*/
+#include "storage/storage_file_writer.h"
+
+#include "platform/platform_file_utilities.h"
+
+#include <QtCore/QMutex>
+#include <QtCore/QSaveFile>
+
+namespace Storage {
+namespace {
+
+constexpr auto kPartsMapMagic = quint32(0x7444504DU);
+
+QMutex WritingMutex;
+base::flat_set<QString> WritingPaths;
+
+struct PartsMap {
+	FileWriter::Resumable resumable;
+	QByteArray written;
+};
+
+[[nodiscard]] QString PartsMapPath(const QString &path) {
+	return path + qsl(".parts");
+}
+
+[[nodiscard]] int PartsMapSize(const FileWriter::Resumable &resumable) {
+	const auto count = (resumable.size + resumable.partSize - 1)
+		/ resumable.partSize;
+	return (count + 7) / 8;
+}
+
+[[nodiscard]] bool PartSet(const QByteArray &written, int index) {
+	return (index >= 0)
+		&& (index / 8 < written.size())
+		&& (written[index / 8] & (1 << (index % 8)));
+}
+
+[[nodiscard]] std::optional<PartsMap> ReadPartsMap(const QString &path) {
+	QFile file(PartsMapPath(path));
+	if (!file.open(QIODevice::ReadOnly)) {
+		return std::nullopt;
+	}
+	QDataStream stream(&file);
+	stream.setVersion(QDataStream::Qt_5_1);
+
+	auto magic = quint32();
+	auto high = quint64();
+	auto low = quint64();
+	auto size = qint32();
+	auto partSize = qint32();
+	auto written = QByteArray();
+	stream >> magic >> high >> low >> size >> partSize >> written;
+	if (stream.status() != QDataStream::Ok
+		|| magic != kPartsMapMagic
+		|| size <= 0
+		|| partSize <= 0) {
+		return std::nullopt;
+	}
+	auto result = PartsMap();
+	result.resumable.key.high = high;
+	result.resumable.key.low = low;
+	result.resumable.size = size;
+	result.resumable.partSize = partSize;
+	result.written = std::move(written);
+	if (result.written.size() != PartsMapSize(result.resumable)
+		|| QFileInfo(FileWriter::PartialPath(path)).size() != size) {
+		return std::nullopt;
+	}
+	return result;
+}
+
+[[nodiscard]] bool WritePartsMap(
+		const QString &path,
+		const FileWriter::Resumable &resumable,
+		const QByteArray &written) {
+	// Replace the bitmap atomically, so that it never marks the parts
+	// written by a different attempt if the app is killed meanwhile.
+	QSaveFile file(PartsMapPath(path));
+	if (!file.open(QIODevice::WriteOnly)) {
+		return false;
+	}
+	QDataStream stream(&file);
+	stream.setVersion(QDataStream::Qt_5_1);
+	stream
+		<< kPartsMapMagic
+		<< quint64(resumable.key.high)
+		<< quint64(resumable.key.low)
+		<< qint32(resumable.size)
+		<< qint32(resumable.partSize)
+		<< written;
+	return (stream.status() == QDataStream::Ok) && file.commit();
+}
+
+[[nodiscard]] QByteArray ReadWritten(
+		const QString &path,
+		const FileWriter::Resumable &resumable) {
+	const auto map = ReadPartsMap(path);
+	const auto same = map
+		&& (map->resumable.key.high == resumable.key.high)
+		&& (map->resumable.key.low == resumable.key.low)
+		&& (map->resumable.size == resumable.size)
+		&& (map->resumable.partSize == resumable.partSize);
+	return same
+		? map->written
+		: QByteArray(PartsMapSize(resumable), char(0));
+}
+
+} // namespace
+
+struct FileWriter::Shared {
+	struct Part {
+		int offset = 0;
+		QByteArray bytes;
+	};
+
+	Shared(const QString &path, std::optional<Resumable> resumable)
+	: path(path)
+	, filePath(resumable ? FileWriter::PartialPath(path) : path)
+	, resumable(resumable)
+	, written(resumable
+		? QByteArray(PartsMapSize(*resumable), char(0))
+		: QByteArray()) {
+		if (resumable) {
+			QMutexLocker lock(&WritingMutex);
+			WritingPaths.emplace(path);
+		}
+	}
+	~Shared() {
+		if (resumable) {
+			QMutexLocker lock(&WritingMutex);
+			WritingPaths.remove(path);
+		}
+	}
+
+	const QString path;
+	const QString filePath; // Where the data is written until finished.
+	const std::optional<Resumable> resumable;
+
+	// Parts stay here until they're written, so they can be read back.
+	QMutex mutex;
+	std::vector<Part> parts;
+	int writing = 0; // Count of the first parts the queue is writing now.
+	bool flushScheduled = false;
+	bool cancelled = false;
+
+	// Bitmap of the parts of the resumable file that are on disk.
+	QByteArray written;
+};
+
+class FileWriter::Object final {
+public:
+	Object(
+		crl::weak_on_queue<Object> weak,
+		std::shared_ptr<Shared> shared,
+		Fn<void()> failed);
+
+	void readWritten(Fn<void()> ready);
+	void flush();
+	void finish(Fn<void()> done);
+	void remove();
+	void suspend();
+
+private:
+	[[nodiscard]] bool ensureOpened();
+	[[nodiscard]] bool open();
+	void markWritten(QByteArray &written, int offset, int size) const;
+	void fail();
+
+	const std::shared_ptr<Shared> _shared;
+	const Fn<void()> _failed;
+	QFile _file;
+	bool _resuming = false;
+	bool _failedOnce = false;
+
+};
+
+FileWriter::Object::Object(
+	crl::weak_on_queue<Object> weak,
+	std::shared_ptr<Shared> shared,
+	Fn<void()> failed)
+: _shared(std::move(shared))
+, _failed(std::move(failed))
+, _file(_shared->filePath) {
+}
+
+void FileWriter::Object::readWritten(Fn<void()> ready) {
+	const auto written = ReadWritten(_shared->path, *_shared->resumable);
+	_resuming = ranges::any_of(written, [](char byte) { return byte != 0; });
+	{
+		QMutexLocker lock(&_shared->mutex);
+		_shared->written = written;
+	}
+	if (ready) {
+		crl::on_main(std::move(ready));
+	}
+}
+
+bool FileWriter::Object::ensureOpened() {
+	if (_file.isOpen()) {
+		return true;
+	} else if (_failedOnce || !open()) {
+		fail();
+		return false;
+	}
+	return true;
+}
+
+bool FileWriter::Object::open() {
+	const auto &resumable = _shared->resumable;
+	if (!resumable) {
+		return _file.open(QIODevice::WriteOnly);
+	} else if (_resuming) {
+		return _file.open(QIODevice::ReadWrite);
+	}
+	return _file.open(QIODevice::ReadWrite | QIODevice::Truncate)
+		&& Platform::File::Preallocate(_file, resumable->size);
+}
+
+void FileWriter::Object::markWritten(
+		QByteArray &written,
+		int offset,
+		int size) const {
+	const auto partSize = _shared->resumable->partSize;
+	const auto till = offset + size;
+	for (auto index = (offset + partSize - 1) / partSize;; ++index) {
+		const auto from = index * partSize;
+		const auto to = std::min(from + partSize, _shared->resumable->size);
+		if (from >= to || to > till) {
+			break;
+		}
+		written[index / 8] |= char(1 << (index % 8));
+	}
+}
+
+void FileWriter::Object::flush() {
+	auto parts = std::vector<Shared::Part>();
+	{
+		QMutexLocker lock(&_shared->mutex);
+		_shared->flushScheduled = false;
+		if (_shared->cancelled) {
+			return;
+		}
+		_shared->writing = int(_shared->parts.size());
+		parts = _shared->parts;
+	}
+	if (parts.empty()) {
+		return;
+	}
+	for (const auto &part : parts) {
+		if (!ensureOpened()) {
+			break;
+		} else if (!_file.seek(part.offset)
+			|| _file.write(part.bytes) != qint64(part.bytes.size())) {
+			fail();
+			break;
+		}
+	}
+
+	// Mark the parts in the bitmap only after they reach the file.
+	const auto resumable = _shared->resumable && !_failedOnce;
+	if (resumable) {
+		_file.flush();
+	}
+	auto written = QByteArray();
+	{
+		QMutexLocker lock(&_shared->mutex);
+		if (!_shared->cancelled) {
+			if (resumable) {
+				for (const auto &part : parts) {
+					markWritten(
+						_shared->written,
+						part.offset,
+						part.bytes.size());
+				}
+				written = _shared->written;
+			}
+			_shared->parts.erase(
+				begin(_shared->parts),
+				begin(_shared->parts) + _shared->writing);
+		}
+		_shared->writing = 0;
+	}
+	if (!written.isEmpty()
+		&& !WritePartsMap(_shared->path, *_shared->resumable, written)) {
+		LOG(("File Error: Could not write parts map for '%1'."
+			).arg(_shared->path));
+	}
+}
+
+void FileWriter::Object::finish(Fn<void()> done) {
+	flush();
+	if (!ensureOpened()) {
+		return;
+	}
+	_file.close();
+	if (_shared->resumable) {
+		if (QFile::exists(_shared->path)) {
+			QFile::remove(_shared->path);
+		}
+		if (!_file.rename(_shared->path)) {
+			LOG(("File Error: Could not rename '%1' to '%2'."
+				).arg(_shared->filePath
+				).arg(_shared->path));
+			fail();
+			return;
+		}
+		QFile::remove(PartsMapPath(_shared->path));
+	}
+	if (!_failedOnce) {
+		crl::on_main(std::move(done));
+	}
+}
+
+void FileWriter::Object::remove() {
+	if (_file.isOpen()) {
+		_file.close();
+	}
+	_file.remove();
+	if (_shared->resumable) {
+		QFile::remove(PartsMapPath(_shared->path));
+	}
+}
+
+void FileWriter::Object::suspend() {
+	flush();
+	if (_file.isOpen()) {
+		_file.close();
+	}
+}
+
+void FileWriter::Object::fail() {
+	if (!std::exchange(_failedOnce, true)) {
+		LOG(("File Error: Could not write to '%1'.").arg(_shared->path));
+		crl::on_main(_failed);
+	}
+}
+
+FileWriter::FileWriter(
+	const QString &path,
+	Fn<void()> failed,
+	std::optional<Resumable> resumable,
+	Fn<void()> ready)
+: _shared(std::make_shared<Shared>(path, resumable))
+, _wrapped(_shared, std::move(failed)) {
+	Expects(!resumable
+		|| (resumable->size > 0 && resumable->partSize > 0));
+	Expects(!ready || resumable);
+
+	if (resumable) {
+		auto guarded = Fn<void()>();
+		if (ready) {
+			guarded = crl::guard(this, std::move(ready));
+		}
+		_wrapped.with([ready = std::move(guarded)](Object &that) mutable {
+			that.readWritten(std::move(ready));
+		});
+	}
+}
+
+FileWriter::~FileWriter() = default;
+
+bool FileWriter::partWritten(int index) const {
+	QMutexLocker lock(&_shared->mutex);
+	return PartSet(_shared->written, index);
+}
+
+void FileWriter::write(int offset, const QByteArray &bytes) {
+	Expects(offset >= 0);
+
+	if (bytes.isEmpty()) {
+		return;
+	}
+	QMutexLocker lock(&_shared->mutex);
+	auto &parts = _shared->parts;
+	if (int(parts.size()) > _shared->writing
+		&& parts.back().offset + parts.back().bytes.size() == offset) {
+		parts.back().bytes.append(bytes);
+	} else {
+		parts.push_back({ offset, bytes });
+	}
+	if (!std::exchange(_shared->flushScheduled, true)) {
+		_wrapped.with([](Object &that) {
+			that.flush();
+		});
+	}
+}
+
+QByteArray FileWriter::readBack(int offset, int size) const {
+	Expects(offset >= 0 && size > 0);
+
+	// Take the pending parts before reading the file: the queue removes
+	// a part from the list only after it is written and marked, so each
+	// byte is either in the copied parts or already in the file.
+	const auto till = offset + size;
+	auto parts = std::vector<Shared::Part>();
+	auto written = QByteArray();
+	{
+		QMutexLocker lock(&_shared->mutex);
+		for (const auto &part : _shared->parts) {
+			if (part.offset < till
+				&& part.offset + part.bytes.size() > offset) {
+				parts.push_back(part);
+			}
+		}
+		written = _shared->written;
+	}
+	auto result = QByteArray();
+	QFile file(_shared->filePath);
+	if (file.open(QIODevice::ReadOnly) && file.seek(offset)) {
+		result = file.read(size);
+	}
+	auto covered = std::vector<std::pair<int, int>>();
+	if (const auto &resumable = _shared->resumable) {
+		// The file is preallocated, only the marked parts are written.
+		const auto partSize = resumable->partSize;
+		const auto read = offset + int(result.size());
+		for (auto index = offset / partSize;; ++index) {
+			const auto from = std::max(index * partSize, offset);
+			const auto to = std::min((index + 1) * partSize, read);
+			if (from >= to) {
+				break;
+			} else if (PartSet(written, index)) {
+				covered.emplace_back(from - offset, to - offset);
+			}
+		}
+	} else {
+		covered.emplace_back(0, int(result.size()));
+	}
+	for (const auto &part : parts) {
+		const auto from = std::max(part.offset, offset);
+		const auto to = std::min(part.offset + part.bytes.size(), till);
+		if (from >= to) {
+			continue;
+		} else if (result.size() < to - offset) {
+			result.resize(to - offset);
+		}
+		memcpy(
+			result.data() + (from - offset),
+			part.bytes.constData() + (from - part.offset),
+			to - from);
+		covered.emplace_back(from - offset, to - offset);
+	}
+	ranges::sort(covered);
+	auto filled = 0;
+	for (const auto &[from, to] : covered) {
+		if (from > filled) {
+			break;
+		}
+		accumulate_max(filled, to);
+	}
+	return (filled == size) ? result : QByteArray();
+}
+
+void FileWriter::finish(Fn<void()> done) {
+	_wrapped.with([done = std::move(done)](Object &that) mutable {
+		that.finish(std::move(done));
+	});
+}
+
+void FileWriter::cancel() {
+	{
+		QMutexLocker lock(&_shared->mutex);
+		_shared->cancelled = true;
+	}
+	_wrapped.with([](Object &that) {
+		that.remove();
+	});
+}
+
+void FileWriter::suspend() {
+	_wrapped.with([](Object &that) {
+		that.suspend();
+	});
+}
+
+QString FileWriter::PartialPath(const QString &path) {
+	return path + qsl(".part");
+}
+
+bool FileWriter::HasPartial(const QString &path) {
+	return QFileInfo(PartsMapPath(path)).exists();
+}
+
+void FileWriter::RemovePartial(
+		std::vector<QString> paths,
+		crl::time age,
+		Fn<void(std::vector<QString>)> done) {
+	crl::async([=, paths = std::move(paths)] {
+		auto removed = std::vector<QString>();
+		const auto now = QDateTime::currentDateTime();
+		for (const auto &path : paths) {
+			const auto map = QFileInfo(PartsMapPath(path));
+			if (!map.exists() || !ReadPartsMap(path)) {
+				// Finished, removed or not ours, don't track it anymore.
+				removed.push_back(path);
+				continue;
+			} else if (map.lastModified().msecsTo(now) < age) {
+				continue;
+			}
+			QMutexLocker lock(&WritingMutex);
+			if (!WritingPaths.contains(path)) {
+				QFile::remove(PartialPath(path));
+				QFile::remove(PartsMapPath(path));
+				removed.push_back(path);
+			}
+		}
+		if (done) {
+			crl::on_main([=, removed = std::move(removed)]() mutable {
+				done(std::move(removed));
+			});
+		}
+	});
+}
+
+bool FileWriter::CanResume(
+		const QString &path,
+		const Cache::Key &key,
+		int size) {
+	const auto map = ReadPartsMap(path);
+	return map
+		&& (map->resumable.key.high == key.high)
+		&& (map->resumable.key.low == key.low)
+		&& (map->resumable.size == size);
+}
+
+} // namespace Storage
@@ -0,0 +1,84 @@
+/*
+This file is part of Telegram Desktop,
+the official desktop application for the Telegram messaging service.
+
+For license and copyright information please follow this link:
+https://github.com/telegramdesktop/tdesktop/blob/master/LEGAL
+*/
+#pragma once
+
+#include "storage/cache/storage_cache_types.h"
+#include "base/weak_ptr.h"
+
+#include <crl/crl_object_on_queue.h>
+
+namespace Storage {
+
+// Writes parts of a downloaded file on a background queue.
+// Adjacent parts that are still waiting for the queue are coalesced.
+class FileWriter final : public base::has_weak_ptr {
+public:
+	// A resumable file is written to "<path>.part", preallocated to the
+	// full size, and renamed to the path when finished. The written parts
+	// are marked in a "<path>.parts" bitmap, so that an interrupted
+	// download of the same file could continue from where it stopped.
+	struct Resumable {
+		Cache::Key key;
+		int size = 0;
+		int partSize = 0;
+	};
+
+	// All callbacks are invoked on the main thread. The bitmap of the
+	// resumable file is read on the queue, ready() is called after that,
+	// so it may be passed only together with the resumable data.
+	FileWriter(
+		const QString &path,
+		Fn<void()> failed,
+		std::optional<Resumable> resumable = std::nullopt,
+		Fn<void()> ready = nullptr);
+	~FileWriter();
+
+	// Whether the part of the resumable file is already written,
+	// possibly by an interrupted previous attempt.
+	// Always false until the bitmap is read and ready() is called.
+	[[nodiscard]] bool partWritten(int index) const;
+
+	void write(int offset, const QByteArray &bytes);
+	[[nodiscard]] QByteArray readBack(int offset, int size) const;
+
+	// Flushes everything and closes the file.
+	// A resumable file is moved to the path before done() is called.
+	void finish(Fn<void()> done);
+
+	// Drops the parts not written yet and removes the file.
+	void cancel();
+
+	// Flushes everything and keeps the resumable file with its bitmap.
+	void suspend();
+
+	[[nodiscard]] static QString PartialPath(const QString &path);
+	[[nodiscard]] static bool HasPartial(const QString &path);
+	[[nodiscard]] static bool CanResume(
+		const QString &path,
+		const Cache::Key &key,
+		int size);
+
+	// Removes the partial files of the paths that were not modified
+	// for the given time, except for the ones being written right now.
+	// Only the files with a valid bitmap are considered partial.
+	// The paths that don't need to be tracked anymore are passed to done.
+	static void RemovePartial(
+		std::vector<QString> paths,
+		crl::time age,
+		Fn<void(std::vector<QString>)> done);
+
+private:
+	struct Shared;
+	class Object;
+
+	const std::shared_ptr<Shared> _shared;
+	crl::object_on_queue<Object> _wrapped;
+
+};
+
+} // namespace Storage
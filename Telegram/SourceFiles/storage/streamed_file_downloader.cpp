@@ -9,6 +9,8 @@ https://github.com/telegramdesktop/tdesktop/blob/master/LEGAL
 
 #include "media/streaming/media_streaming_loader.h"
 #include "media/streaming/media_streaming_reader.h"
+#include "storage/download_manager_mtproto.h"
+#include "storage/storage_file_writer.h"
 
 namespace Storage {
 namespace {
@@ -18,6 +20,9 @@ using namespace Media::Streaming;
 constexpr auto kPartSize = Loader::kPartSize;
 constexpr auto kRequestPartsCount = 8;
 
+// Written parts of a resumable file are marked by download parts.
+static_assert(kPartSize == kDownloadPartSize);
+
 } // namespace
 
 StreamedFileDownloader::StreamedFileDownloader(
@@ -67,7 +72,8 @@ StreamedFileDownloader::StreamedFileDownloader(
 }
 
 StreamedFileDownloader::~StreamedFileDownloader() {
-	if (!_finished) {
+	if (!_finished && !_writing) {
+		suspendWriter();
 		cancel();
 	} else {
 		_reader->cancelForDownloader(this);
@@ -132,7 +138,32 @@ void StreamedFileDownloader::cancelHook() {
 	_reader->cancelForDownloader(this);
 }
 
+bool StreamedFileDownloader::supportsResumableFile() const {
+	return true;
+}
+
+void StreamedFileDownloader::skipWrittenParts() {
+	if (!_writer) {
+		return;
+	}
+	for (auto index = 0; index != _partsCount; ++index) {
+		if (_partIsSaved[index] || !_writer->partWritten(index)) {
+			continue;
+		}
+		const auto offset = index * kPartSize;
+		_partIsSaved[index] = true;
+		++_partsSaved;
+		markPartWritten(offset, std::min(kPartSize, _fullSize - offset));
+	}
+}
+
 void StreamedFileDownloader::startLoading() {
+	skipWrittenParts();
+	if (_partsSaved == _partsCount) {
+		// All the parts were written by an interrupted previous attempt.
+		finalizeResult();
+		return;
+	}
 	requestParts();
 }
 
@@ -156,7 +187,7 @@ void StreamedFileDownloader::savePart(const LoadedPart &part) {
 	if (index < _nextPartIndex) {
 		--_partsRequested;
 	}
-	if (!writeResultPart(offset, bytes::make_span(part.bytes))) {
+	if (!writeResultPart(offset, part.bytes)) {
 		return;
 	}
 	_reader->doneForDownloader(offset);
@@ -52,6 +52,8 @@ private:
 	Cache::Key cacheKey() const override;
 	std::optional<MediaKey> fileLocationKey() const override;
 	void cancelHook() override;
+	bool supportsResumableFile() const override;
+	void skipWrittenParts();
 	void requestParts();
 	void requestPart();
 
@@ -17,6 +17,7 @@ class SendFilesWay;
 struct PreparedFileInformation {
 	struct Image {
 		QImage data;
+		QSize original; // Large photos are decoded to a smaller data.
 		bool animated = false;
 	};
 	struct Song {
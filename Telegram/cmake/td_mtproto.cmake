@@ -25,8 +25,14 @@ PRIVATE
     mtproto/details/mtproto_domain_resolver.h
     mtproto/details/mtproto_dump_to_text.cpp
     mtproto/details/mtproto_dump_to_text.h
+    mtproto/details/mtproto_network_conditions.cpp
+    mtproto/details/mtproto_network_conditions.h
     mtproto/details/mtproto_received_ids_manager.cpp
     mtproto/details/mtproto_received_ids_manager.h
+    mtproto/details/mtproto_received_slice.cpp
+    mtproto/details/mtproto_received_slice.h
+    mtproto/details/mtproto_requests_table.cpp
+    mtproto/details/mtproto_requests_table.h
     mtproto/details/mtproto_rsa_public_key.cpp
     mtproto/details/mtproto_rsa_public_key.h
     mtproto/details/mtproto_serialized_request.cpp
@@ -35,6 +41,8 @@ PRIVATE
     mtproto/details/mtproto_tcp_socket.h
     mtproto/details/mtproto_tls_socket.cpp
     mtproto/details/mtproto_tls_socket.h
+    mtproto/details/mtproto_ungzip.cpp
+    mtproto/details/mtproto_ungzip.h
     mtproto/mtproto_auth_key.cpp
     mtproto/mtproto_auth_key.h
     mtproto/mtproto_concurrent_sender.cpp